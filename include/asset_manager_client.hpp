@@ -25,19 +25,327 @@
 /// @date September, 2011
 /// @brief Main public interface for Asset Manager Client
 
+#include <cstdarg>
+#include <cstddef>
 #include <string>
 #include <vector>
 
+#include "thread_options.hpp"
+
 #ifndef DISALLOW_COPY_AND_ASSIGN
 #define DISALLOW_COPY_AND_ASSIGN(TypeName) \
   TypeName(const TypeName&);               \
   void operator=(const TypeName&)
 #endif
 
+namespace tnyosc {
+class Message;
+class MessageBuilder;
+class Bundle;
+} // namespace tnyosc
+
 namespace am {
 
 class TCPClient;
 class UDPClient;
+class MessageBuffer;
+class MessageBufferPool;
+class MessageEncoder;
+class BlobData;
+class AddressTable;
+class TrafficRecorder;
+class AssetManagerClient;
+class SceneState;
+
+/// @brief Binary data sent as an OSC blob without being copied.
+///
+/// A Blob references memory owned by the caller and is passed by pointer to
+/// @a AssetManagerClient::SendCustomTCP or @a AssetManagerClient::SendCustomUDP
+/// for a 'b' argument. The bytes are not copied into the message; they are
+/// written to the socket straight from the caller's memory. Copies of a Blob
+/// share the same data and the client keeps a copy for every message that
+/// references it, so the Blob object itself may go out of scope right after the
+/// call.
+///
+/// The memory must stay valid and unchanged until @a release is called with
+/// @a context. This happens once the last copy of the Blob is destroyed, i.e.
+/// after every message referencing it has been sent (or dropped), and may be
+/// called on an internal I/O thread.
+///
+/// @code
+///   static void FreeImpulseResponse(void* context) {
+///     delete static_cast<std::vector<float>*>(context);
+///   }
+///   ...
+///   std::vector<float>* ir = new std::vector<float>(LoadImpulseResponse());
+///   am::Blob blob(&(*ir)[0], ir->size() * sizeof(float),
+///       FreeImpulseResponse, ir);
+///   am.SendCustomTCP("/reverb/ir", "ib", 2, &blob);
+/// @endcode
+class Blob {
+ public:
+  typedef void (*ReleaseFunction)(void* context);
+
+  /// @param[in] data         Bytes of the blob.
+  /// @param[in] size         Number of bytes.
+  /// @param[in] release      (Optional) Called once the bytes are not needed
+  ///                         anymore.
+  /// @param[in] context      (Optional) Argument passed to @a release.
+  Blob(const void* data, std::size_t size, ReleaseFunction release=NULL,
+      void* context=NULL);
+  Blob(const Blob& other);
+  Blob& operator=(const Blob& other);
+  ~Blob();
+
+  const void* data() const;
+  std::size_t size() const;
+
+ private:
+  friend BlobData* GetBlobData(const Blob& blob);
+  BlobData* data_;
+};
+
+/// @brief Priority class of an outgoing message.
+///
+/// The TCP and UDP clients keep one queue per class and, whenever a message
+/// was written, pick the next one from the most urgent class with anything
+/// queued. Messages of the same class keep their order, but an urgent
+/// message overtakes the bulk messages queued before it. Core messages
+/// (mute, volume, load and unload) are urgent, so a panic mute is not stuck
+/// behind a backlog of custom messages.
+enum Priority {
+  PRIORITY_URGENT,
+  PRIORITY_BULK,
+  PRIORITY_COUNT
+};
+
+/// @brief Handle of an OSC address interned with @a
+/// AssetManagerClient::InternAddress.
+///
+/// A handle is only valid for the client that returned it. A default
+/// constructed handle is invalid and messages sent with it are ignored.
+class AddressHandle {
+ public:
+  AddressHandle() : index_(-1) {}
+
+  bool valid() const { return index_ >= 0; }
+
+ private:
+  friend class AssetManagerClient;
+  explicit AddressHandle(int index) : index_(index) {}
+
+  int index_;
+};
+
+/// @brief State of an asynchronous operation of AssetManagerClient.
+///
+/// The caller provides the storage of the operation, so starting one does not
+/// allocate. The object must stay alive until its completion function is
+/// called, which happens exactly once, on one of the client's I/O threads or,
+/// if the operation completes right away, on the calling thread. The
+/// function may start new operations, including with the same object.
+///
+/// See asset_manager_client_coro.hpp for C++20 awaitables built on top.
+class AsyncOperation {
+ public:
+  typedef void (*CompletionFunction)(AsyncOperation* operation,
+      void* context);
+
+  AsyncOperation(CompletionFunction function, void* context)
+  : function_(function), context_(context), client_(0), success_(false) {}
+
+  /// Outcome of the last completed operation.
+  bool success() const { return success_; }
+
+ private:
+  friend class AssetManagerClient;
+
+  CompletionFunction function_;
+  void* context_;
+  AssetManagerClient* client_;
+  bool success_;
+};
+
+/// @brief Lightweight handle of one project of an AssetManagerClient.
+///
+/// A controller managing many projects on the same Asset Manager host opens
+/// one handle per project with @a AssetManagerClient::OpenProject instead of
+/// constructing a client per project. All handles of a client share its TCP
+/// connection, UDP socket, I/O threads, message memory and open bundle, so
+/// the UDP messages of every project sent between @a
+/// AssetManagerClient::StartBundle and @a AssetManagerClient::EndBundle go
+/// out in the same datagrams. Options, statistics and flushing are those of
+/// the client.
+///
+/// A handle only holds the base address and a pointer to the client. It may
+/// be copied freely but must not be used after the client is destroyed, and,
+/// like the client, is not meant to be used from several threads at once. A
+/// default constructed handle is invalid and its calls are ignored.
+///
+/// @code
+///   am::AssetManagerClient am("/lobby", "10.0.0.5");
+///   am::Project hall = am.OpenProject("/hall");
+///   am::Project foyer = am.OpenProject("/foyer");
+///   hall.Load();
+///   foyer.Load();
+///   ...
+///   am.StartBundle();
+///   hall.SendObjectsUDP("/object", &ids[0], &x[0], &y[0], &z[0], n);
+///   foyer.SendCustomUDP("/ambience/level", "f", level);
+///   am.EndBundle(); // one datagram for both projects if it fits
+/// @endcode
+class Project {
+ public:
+  Project() : client_(0) {}
+
+  bool valid() const { return client_ != 0; }
+  const std::string& base_address() const { return base_address_; }
+
+  /// @brief Same as @a AssetManagerClient::Load for this project.
+  void Load();
+
+  /// @brief Same as @a AssetManagerClient::Unload for this project.
+  void Unload();
+
+  /// @brief Same as @a AssetManagerClient::SetMute for this project.
+  void SetMute(bool mute);
+
+  /// @brief Same as @a AssetManagerClient::SetVolume for this project.
+  void SetVolume(float volume);
+
+  /// @brief Same as @a AssetManagerClient::SendCustomTCP with the address
+  /// prefixed with the base address of this project.
+  void SendCustomTCP(const std::string& url, const char* format, ...);
+
+  /// @brief Same as @a AssetManagerClient::SendCustomUDP with the address
+  /// prefixed with the base address of this project.
+  void SendCustomUDP(const std::string& url, const char* format, ...);
+
+  /// @brief Same as @a AssetManagerClient::SendCustomReliableUDP with the
+  /// address prefixed with the base address of this project.
+  void SendCustomReliableUDP(const std::string& url, const char* format, ...);
+
+  /// @brief Same as @a AssetManagerClient::SendObjectsUDP with the address
+  /// prefixed with the base address of this project.
+  void SendObjectsUDP(const std::string& url, const int* ids, const float* x,
+      const float* y, const float* z, std::size_t count,
+      const float* gains=NULL);
+
+  /// @brief Intern base address + @a url in the client. The handle is sent
+  /// with the @a AddressHandle variants of the client's send functions.
+  AddressHandle InternAddress(const std::string& url);
+
+ private:
+  friend class AssetManagerClient;
+  friend class SceneState;
+  Project(AssetManagerClient* client, const std::string& base_address)
+  : client_(client), base_address_(base_address) {}
+
+  AssetManagerClient* client_;
+  std::string base_address_;
+};
+
+/// @brief Client-side mirror of the parameters of many sound objects.
+///
+/// An application that writes the position, gain and mute state of every
+/// object each frame, whether it changed or not, writes them into a
+/// SceneState instead and calls @a Flush once per frame. Only the values that
+/// differ from the last ones written are sent, using the messages of @a
+/// AssetManagerClient::SendObjectsUDP plus @a url + "/" + id + "/mute" with
+/// an integer argument.
+///
+/// The parameters are stored as one array per value and changes are tracked
+/// with one bit per object and parameter, so @a Flush skips 32 unchanged
+/// objects at a time. As UDP datagrams may be lost, @a SetRefreshPeriod makes
+/// @a Flush resend every object periodically, a slice per call.
+///
+/// Like the client, a SceneState is not meant to be used from several
+/// threads at once and must not be used after the client is destroyed.
+///
+/// @code
+///   am::SceneState scene(am.OpenProject("/hall"), "/object");
+///   for (int id = 1; id <= 500; ++id) scene.AddObject(id);
+///   scene.SetRefreshPeriod(60); // every object once a second at 60 Hz
+///   ...
+///   for (std::size_t i = 0; i < scene.size(); ++i) {
+///     scene.SetPosition(i, x[i], y[i], z[i]);
+///     scene.SetGain(i, gains[i]);
+///   }
+///   scene.Flush(); // only the objects that moved or changed gain
+/// @endcode
+class SceneState {
+ public:
+  /// @param[in] project      Project of the objects.
+  /// @param[in] url          OSC's URL address common to all objects.
+  SceneState(const Project& project, const std::string& url);
+
+  /// @brief Add the object @a id, at position (0, 0, 0) with gain 1 and not
+  /// muted. Every parameter of a new object is sent by the next @a Flush.
+  ///
+  /// @return Index of the object, passed to the functions below.
+  std::size_t AddObject(int id);
+
+  std::size_t size() const { return ids_.size(); }
+  int id(std::size_t index) const { return ids_[index]; }
+
+  /// @brief Set the position of the object at @a index. Nothing is sent if
+  /// the position is unchanged.
+  void SetPosition(std::size_t index, float x, float y, float z);
+
+  /// @brief Set the gain of the object at @a index. Nothing is sent if the
+  /// gain is unchanged.
+  void SetGain(std::size_t index, float gain);
+
+  /// @brief Mute or unmute the object at @a index. Nothing is sent if the
+  /// state is unchanged.
+  void SetMute(std::size_t index, bool mute);
+
+  /// @brief Send every parameter of every object with the next @a Flush,
+  /// e.g. after the server restarted.
+  void MarkAllDirty();
+
+  /// @brief Resend every object once every @a flushes calls to @a Flush.
+  ///
+  /// Each call to @a Flush resends about size() / @a flushes objects in
+  /// turn, on top of the changes, so the refresh does not add a burst of
+  /// packets. 0 (the default) disables the refresh.
+  void SetRefreshPeriod(std::size_t flushes);
+
+  /// @brief Send the parameters changed since the last call.
+  ///
+  /// The messages are bundled like @a AssetManagerClient::SendObjectsUDP:
+  /// between @a AssetManagerClient::StartBundle and @a
+  /// AssetManagerClient::EndBundle they are added to the open bundle, and
+  /// otherwise the last bundle is sent before returning. Messages dropped by
+  /// the client, e.g. under @a AssetManagerClient::SetMemoryLimit, are sent
+  /// again by the next call.
+  ///
+  /// @return Number of messages sent.
+  std::size_t Flush();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(SceneState);
+
+  enum { POSITION, GAIN, MUTE, PARAMETER_COUNT };
+  enum { WORD_BITS = 32 };
+
+  void MarkDirty(int parameter, std::size_t index) {
+    dirty_[parameter][index / WORD_BITS] |= 1u << (index % WORD_BITS);
+  }
+  void Refresh();
+
+  Project project_;
+  std::string prefix_;  // base address + url + "/"
+  std::vector<int> ids_;
+  std::vector<float> x_;
+  std::vector<float> y_;
+  std::vector<float> z_;
+  std::vector<float> gain_;
+  std::vector<int> mute_;
+  std::vector<unsigned int> dirty_[PARAMETER_COUNT];
+  std::size_t refresh_period_;
+  std::size_t refresh_cursor_;
+};
 
 /// @brief Simple interface for interacting with Asset Manager server.
 ///
@@ -53,6 +361,30 @@ class AssetManagerClient {
   enum Option {
     /// Use UDP instead of TCP (default) for sending core messages.
     CORE_USE_UDP                        = 1 << 0,
+    /// Send arrays passed to SendFloatArrayTCP and friends as a single OSC
+    /// array ("[fff...]") instead of one argument per value.
+    ARRAY_USE_OSC_ARRAY                 = 1 << 1,
+    /// Hold every UDP message until the TCP messages sent before it have been
+    /// written to the socket, as if @a OrderingBarrier was called after each
+    /// TCP message. See @a OrderingBarrier.
+    ORDERED                             = 1 << 2,
+    /// Send core messages as reliable UDP messages (see @a
+    /// SendCustomReliableUDP). Takes precedence over CORE_USE_UDP.
+    CORE_USE_RELIABLE_UDP               = 1 << 3,
+    /// Send UDP datagrams through io_uring instead of sendmmsg. Only
+    /// available on Linux when the library is built with the
+    /// AMCLIENT_IO_URING CMake option; ignored otherwise.
+    UDP_USE_IO_URING                    = 1 << 4,
+    /// With UDP_USE_IO_URING, have a kernel thread poll the io_uring
+    /// submission queue so that most sends take no system call at all, at
+    /// the cost of a kernel thread spinning while messages are sent.
+    IO_URING_SQPOLL                     = 1 << 5,
+    /// Write UDP datagrams from the calling thread with a non-blocking send
+    /// instead of handing them to the I/O thread, which saves a thread hop
+    /// and a wake-up per message. Messages fall back to the I/O thread while
+    /// earlier ones are still queued or held by @a OrderingBarrier, or when
+    /// the socket would block. Has no effect on Windows.
+    UDP_INLINE                          = 1 << 6,
   };
 
   /// @brief Constructor of @a AssetManagerClient.
@@ -76,9 +408,40 @@ class AssetManagerClient {
       long tcp_port=TCP_PORT,
       long udp_port=UDP_PORT);
 
+  /// @brief Constructor of @a AssetManagerClient sending to several hosts.
+  ///
+  /// Same as above, except that every message is sent to each host of @a
+  /// hosts, e.g. to redundant Asset Manager render nodes. A message or bundle
+  /// is encoded once and the same buffer is sent to all hosts, from a single
+  /// UDP socket and one TCP connection per host served by the same thread.
+  /// A host that is down or does not resolve does not affect the others; see
+  /// @a GetDestinationStatistics.
+  ///
+  /// @param[in] base_address Base Open Sound Control address.
+  /// @param[in] hosts        Addresses of the computers running Asset Manager.
+  /// @param[in] tcp_port     (Optional) Destination TCP port of every host.
+  /// @param[in] udp_port     (Optional) Destination UDP port of every host.
+  AssetManagerClient(const std::string& base_address,
+      const std::vector<std::string>& hosts,
+      long tcp_port=TCP_PORT,
+      long udp_port=UDP_PORT);
+
   /// @brief Destructor of @a AssetManagerClient.
   ~AssetManagerClient();
 
+  /// @brief Returns a handle for sending to another project through this
+  /// client.
+  ///
+  /// The project with the base address passed to the constructor is served
+  /// by the client's own functions; use this for every further project on
+  /// the same hosts rather than another client, which would open its own
+  /// sockets and threads. Opening a project sends nothing.
+  ///
+  /// @param[in] base_address Base Open Sound Control address of the project.
+  ///
+  /// @see @a Project
+  Project OpenProject(const std::string& base_address);
+
   /// @brief Set option to change internal behavior.
   ///
   /// Multiple options can be set by using the bitwise OR (|). Once the option
@@ -168,7 +531,9 @@ class AssetManagerClient {
   /// messages order is guaranteed and should not be expected. For example, if
   /// @a SendCustomUDP is called right after @a SendCustomTCP, the UDP message
   /// is likely to arrive before the TCP message (although that also depends).
-  /// Therefore, if order of arrival is important, use only @a SendCustomTCP.
+  /// Therefore, if order of arrival is important, use only @a SendCustomTCP,
+  /// or use @a OrderingBarrier or the @a ORDERED option so that UDP messages
+  /// are sent after the preceding TCP messages.
   ///
   /// The arguments are similar to printf-like functions. @a format specifies
   /// the number of arguments and their types, and the appropriate number of
@@ -185,6 +550,12 @@ class AssetManagerClient {
   ///   - F: False (No argument required)
   ///   - N: Nil (No argument required)
   ///   - I: Infinitum (No argument required)
+  ///   - t: OSC timetag (64-bit NTP time as @c uint64_t)
+  ///   - r: 32-bit RGBA color (@c uint32_t, red in the most significant byte)
+  ///   - m: 4 byte MIDI message (@c uint32_t, from the most significant byte:
+  ///        port id, status byte, data1, data2)
+  ///   - b: blob (pointer to an @a am::Blob). Large blobs are sent straight
+  ///        from the caller's memory without being copied; see @a Blob.
   ///
   /// @param[in] url          OSC's URL address of the message.
   /// @param[in] format       A character string representing OSC argument types.
@@ -216,6 +587,239 @@ class AssetManagerClient {
   /// @see @a SendCustomTCP
   void SendCustomUDP(const std::string& url, const char* format, ...);
 
+  /// @brief Intern an address for repeated custom messages.
+  ///
+  /// The full address (base_address + @a url) is encoded once and kept by the
+  /// client. Sending with the returned handle copies the encoded address
+  /// instead of building and measuring the address string on every call,
+  /// which matters for addresses that are sent many times per second.
+  /// Addresses are interned by the full address, so interning the same @a
+  /// url again, or the same full address through a @a Project of this
+  /// client, returns the same handle. Interned addresses are kept until the
+  /// client is destroyed.
+  ///
+  /// @param[in] url          OSC's URL address of the messages.
+  ///
+  /// @code
+  ///   am::AddressHandle pos = am.InternAddress("/object/pos");
+  ///   ...
+  ///   am.SendCustomUDP(pos, "fff", x, y, z);
+  /// @endcode
+  AddressHandle InternAddress(const std::string& url);
+
+  /// @brief Send custom TCP message to an interned address.
+  ///
+  /// Same as @a SendCustomTCP with the url passed to @a InternAddress.
+  void SendCustomTCP(const AddressHandle& address, const char* format, ...);
+
+  /// @brief Send custom UDP message to an interned address.
+  ///
+  /// Same as @a SendCustomUDP with the url passed to @a InternAddress.
+  void SendCustomUDP(const AddressHandle& address, const char* format, ...);
+
+  /// @brief Send custom TCP message ahead of the bulk traffic.
+  ///
+  /// Same as @a SendCustomTCP, except that the message is queued with the
+  /// core messages in the urgent class (see @a Priority) and is written
+  /// before any custom message that is still waiting in the queue. Meant
+  /// for the occasional time-critical message, e.g. a panic cue.
+  void SendCustomUrgentTCP(const std::string& url, const char* format, ...);
+
+  /// @brief Send custom UDP message ahead of the bulk traffic.
+  ///
+  /// UDP variant of @a SendCustomUrgentTCP. The message is not added to an
+  /// open bundle but sent on its own right away.
+  void SendCustomUrgentUDP(const std::string& url, const char* format, ...);
+
+  /// @brief Send custom reliable UDP message to the project.
+  ///
+  /// Lightweight alternative to @a SendCustomTCP for control messages. The
+  /// message is wrapped with a session id and a sequence number and sent over
+  /// UDP. Every host acknowledges it and hosts that do not are sent the
+  /// message again, waiting twice as long between each attempt, for a bounded
+  /// number of attempts. Messages are delivered in the order they arrive, so
+  /// a lost datagram does not delay the messages sent after it as it would
+  /// with TCP. Retransmissions and failures are counted in
+  /// DestinationStatistics.
+  ///
+  /// The receiver must understand the wrapping, for example by running
+  /// am_reliable_shim in front of Asset Manager. Reliable messages are never
+  /// bundled, are not held by @a OrderingBarrier and are meant for unicast
+  /// hosts. @a BlockUntilQueuesAreEmpty waits until every reliable message
+  /// has been acknowledged or given up on.
+  ///
+  /// @see @a SendCustomTCP
+  void SendCustomReliableUDP(const std::string& url, const char* format, ...);
+
+  /// @brief Send custom reliable UDP message to an interned address.
+  ///
+  /// Same as @a SendCustomReliableUDP with the url passed to @a
+  /// InternAddress.
+  void SendCustomReliableUDP(const AddressHandle& address,
+      const char* format, ...);
+
+  /// @brief Send an encoded OSC message or bundle over TCP.
+  ///
+  /// For messages and bundles built by the caller, e.g. with tnyosc. The
+  /// packet is sent as is, without prefixing base_address, and is copied
+  /// once, straight into the buffer written to the socket. Anything that is
+  /// not an OSC message or bundle padded to a multiple of 4 bytes is ignored.
+  ///
+  /// @param[in] data         The encoded packet.
+  /// @param[in] size         Size of the packet in bytes.
+  ///
+  /// @return False if the packet was ignored or dropped, e.g. because it is
+  ///         too large to be copied or under @a SetMemoryLimit. The other
+  ///         functions sending packets, messages and bundles return the same.
+  ///
+  /// @see @a SendPacketUDP
+  bool SendPacketTCP(const char* data, std::size_t size);
+
+  /// @brief Send an encoded OSC message or bundle over UDP.
+  ///
+  /// UDP variant of @a SendPacketTCP. Between @a StartBundle and @a EndBundle
+  /// the packet is copied into the open bundle.
+  bool SendPacketUDP(const char* data, std::size_t size);
+
+  /// @brief Send an encoded OSC message or bundle over TCP without copying
+  /// it.
+  ///
+  /// Same as @a SendPacketTCP, except that the packet is written to the
+  /// socket from the memory referenced by @a packet, which is released as
+  /// described in @a Blob. Packets smaller than a few hundred bytes are
+  /// copied anyway as that is cheaper.
+  bool SendPacketTCP(const Blob& packet);
+
+  /// @brief UDP variant of @a SendPacketTCP taking a @a Blob.
+  bool SendPacketUDP(const Blob& packet);
+
+  /// @brief Send a tnyosc message over TCP.
+  ///
+  /// Same as @a SendPacketTCP with the bytes of @a message.
+  bool SendMessageTCP(const tnyosc::Message& message);
+
+  /// @brief Send a tnyosc message over UDP.
+  ///
+  /// Same as @a SendPacketUDP with the bytes of @a message.
+  bool SendMessageUDP(const tnyosc::Message& message);
+
+  /// @brief Send a message built with tnyosc::MessageBuilder over TCP.
+  bool SendMessageTCP(const tnyosc::MessageBuilder& message);
+
+  /// @brief Send a message built with tnyosc::MessageBuilder over UDP.
+  bool SendMessageUDP(const tnyosc::MessageBuilder& message);
+
+  /// @brief Send a tnyosc bundle over TCP.
+  ///
+  /// Same as @a SendPacketTCP with the bytes of @a bundle.
+  bool SendBundleTCP(const tnyosc::Bundle& bundle);
+
+  /// @brief Send a tnyosc bundle over UDP.
+  ///
+  /// Same as @a SendPacketUDP with the bytes of @a bundle.
+  bool SendBundleUDP(const tnyosc::Bundle& bundle);
+
+#if __cplusplus >= 201103L
+  /// @brief Send an encoded packet over TCP, taking ownership of its bytes.
+  ///
+  /// The vector is moved into the client and sent like a @a Blob, so large
+  /// packets are not copied. Only available when compiling as C++11 or
+  /// later, both the library and the caller.
+  ///
+  /// @code
+  ///   std::vector<char> packet = BuildScene();
+  ///   am.SendPacketTCP(std::move(packet));
+  /// @endcode
+  bool SendPacketTCP(std::vector<char>&& packet);
+
+  /// @brief UDP variant of @a SendPacketTCP taking ownership of the bytes.
+  bool SendPacketUDP(std::vector<char>&& packet);
+
+  /// @brief Send a tnyosc bundle over TCP, taking its bytes.
+  ///
+  /// Like @a SendPacketTCP(std::vector<char>&&); @a bundle is left empty.
+  bool SendBundleTCP(tnyosc::Bundle&& bundle);
+
+  /// @brief UDP variant of @a SendBundleTCP taking the bundle's bytes.
+  bool SendBundleUDP(tnyosc::Bundle&& bundle);
+#endif
+
+  /// @brief Send an encoded OSC message or bundle as a reliable UDP message.
+  ///
+  /// Reliable variant of @a SendPacketUDP; see @a SendCustomReliableUDP.
+  bool SendPacketReliableUDP(const char* data, std::size_t size);
+
+  /// @brief Send an array of floats as a custom TCP message.
+  ///
+  /// Equivalent to calling @a SendCustomTCP with an "fff..." format and one
+  /// argument per value, but the values are converted to network byte order
+  /// in bulk using vector instructions when the CPU supports them. This should
+  /// be preferred for long lists of values such as per-speaker gains or
+  /// trajectory points. If @a ARRAY_USE_OSC_ARRAY is set, the values are sent
+  /// as a single OSC array argument instead.
+  ///
+  /// Over TCP, an array may be as large as about 13000 values. Over UDP, the
+  /// message must fit in a 1500 bytes packet, i.e. about 290 values.
+  ///
+  /// @param[in] url          OSC's URL address of the message.
+  /// @param[in] values       Values to send.
+  /// @param[in] count        Number of values.
+  ///
+  /// @code
+  ///   float gains[64];
+  ///   ...
+  ///   am.SendFloatArrayTCP("/speaker/gains", gains, 64);
+  /// @endcode
+  ///
+  /// @see @a SendFloatArrayUDP
+  void SendFloatArrayTCP(const std::string& url, const float* values,
+      std::size_t count);
+
+  /// @brief UDP variant of @a SendFloatArrayTCP.
+  void SendFloatArrayUDP(const std::string& url, const float* values,
+      std::size_t count);
+
+  /// @brief Send an array of 32-bit integers as a custom TCP message.
+  ///
+  /// Integer variant of @a SendFloatArrayTCP.
+  void SendIntArrayTCP(const std::string& url, const int* values,
+      std::size_t count);
+
+  /// @brief UDP variant of @a SendIntArrayTCP.
+  void SendIntArrayUDP(const std::string& url, const int* values,
+      std::size_t count);
+
+  /// @brief Send the positions and optionally the gains of many sound objects.
+  ///
+  /// Bulk variant of calling @a SendCustomUDP for every object. Object @a i
+  /// gets the message @a url + "/" + @a ids[i] + "/pos" with the three float
+  /// arguments @a x[i], @a y[i] and @a z[i] and, if @a gains is given, the
+  /// message @a url + "/" + @a ids[i] + "/gain" with the argument @a
+  /// gains[i]. The arrays are read in one pass and the messages are encoded
+  /// straight into bundles that are filled up to the maximum packet size, so
+  /// a frame is sent in as few packets as possible.
+  ///
+  /// If called between @a StartBundle and @a EndBundle, the messages are added
+  /// to the open bundle. Otherwise the last bundle is sent before returning.
+  ///
+  /// @param[in] url          OSC's URL address common to all objects.
+  /// @param[in] ids          Object ids.
+  /// @param[in] x            X coordinates.
+  /// @param[in] y            Y coordinates.
+  /// @param[in] z            Z coordinates.
+  /// @param[in] count        Number of objects, i.e. length of each array.
+  /// @param[in] gains        (Optional) Object gains.
+  ///
+  /// @code
+  ///   std::vector<int> ids;
+  ///   std::vector<float> x, y, z;
+  ///   ...
+  ///   am.SendObjectsUDP("/object", &ids[0], &x[0], &y[0], &z[0], ids.size());
+  /// @endcode
+  void SendObjectsUDP(const std::string& url, const int* ids, const float* x,
+      const float* y, const float* z, std::size_t count,
+      const float* gains=NULL);
+
   /// @brief Mark the start of a new bundle.
   ///
   /// Bundle groups UDP messages into a single packet so the number of packets
@@ -241,6 +845,29 @@ class AssetManagerClient {
   /// @see @a StartBundle
   void EndBundle();
 
+  /// @brief Send the following UDP messages after the preceding TCP messages.
+  ///
+  /// UDP messages (and bundles ended) after this call are held by the
+  /// client until every TCP message sent before the call has been written to
+  /// the TCP socket, so the TCP message leaves this machine first. The call
+  /// does not block: the UDP messages are released by the I/O threads as
+  /// soon as the TCP writes complete. If a TCP message cannot be delivered
+  /// (e.g. the server is unreachable), it is dropped and the UDP messages are
+  /// released.
+  ///
+  /// This orders the messages on the wire; like before, a datagram may still
+  /// be processed first by a server that reads its UDP socket before its TCP
+  /// socket.
+  ///
+  /// @code
+  ///   am.SendCustomTCP("/object/cue", "i", 1);
+  ///   am.OrderingBarrier();
+  ///   am.SendCustomUDP("/object/pos", "fff", x, y, z); // sent after the cue
+  /// @endcode
+  ///
+  /// @see @a ORDERED
+  void OrderingBarrier();
+
   /// @brief Block and process all messages in the TCP and UDP queues
   ///
   /// The function blocks and process all the messages that are in the TCP and
@@ -248,26 +875,261 @@ class AssetManagerClient {
   /// exiting the program.
   void BlockUntilQueuesAreEmpty();
 
+  /// @brief Asynchronous variant of @a BlockUntilQueuesAreEmpty.
+  ///
+  /// Completes @a operation once every TCP and UDP message sent before the
+  /// call has been written to the sockets (or dropped, e.g. because a host
+  /// is unreachable) and every reliable message has been acknowledged or
+  /// given up on. An open bundle is not sent; call @a EndBundle first. The
+  /// operation always succeeds.
+  void AsyncFlush(AsyncOperation* operation);
+
+  /// @brief Connect to every host over TCP.
+  ///
+  /// Starts connecting to the hosts that are not connected and completes @a
+  /// operation once no connection attempt is in progress. The operation
+  /// succeeds if every host is connected.
+  void AsyncWaitConnected(AsyncOperation* operation);
+
+  /// Memory used to store messages. See @a GetMemoryStatistics.
+  struct MemoryStatistics {
+    std::size_t slot_size;          ///< Bytes per message slot.
+    std::size_t large_slot_size;    ///< Bytes per slot for large TCP messages.
+    std::size_t slots_total;        ///< Slots reserved so far.
+    std::size_t slots_in_use;       ///< Slots holding queued messages.
+    std::size_t peak_slots_in_use;  ///< Highest value of slots_in_use.
+    std::size_t bytes_reserved;     ///< Memory reserved for all slots.
+    std::size_t memory_limit;       ///< Cap set by SetMemoryLimit, 0 if none.
+    std::size_t dropped_messages;   ///< Messages dropped due to the cap.
+  };
+
+  /// @brief Limit the memory used to store messages.
+  ///
+  /// Messages and bundles are stored in fixed-size slots that are reserved in
+  /// blocks and reused once the message was sent, so the memory footprint of
+  /// the client stops growing once it reached its working size. By default
+  /// there is no limit. With a limit, messages that would need more memory
+  /// than @a bytes, e.g. because the network cannot keep up, are dropped and
+  /// counted in @a MemoryStatistics::dropped_messages.
+  ///
+  /// @param[in] bytes        Maximum memory reserved for messages, or 0 for
+  ///                         no limit. Memory already reserved is kept.
+  void SetMemoryLimit(std::size_t bytes);
+
+  /// @brief Returns the current memory usage for message storage.
+  MemoryStatistics GetMemoryStatistics() const;
+
+  /// Scheduling of a transport I/O thread. See @a SetTCPThreadOptions.
+  typedef am::ThreadOptions ThreadOptions;
+
+  /// @brief Configure the thread that sends TCP messages.
+  ///
+  /// By default the I/O threads are time-shared with every other thread of
+  /// the process and wake up from the kernel for each message, which adds
+  /// scheduling jitter. For microsecond-scale dispatch, pin the thread to a
+  /// dedicated core, give it a real-time priority and let it busy-poll for
+  /// new messages instead of sleeping. Real-time priorities need the
+  /// CAP_SYS_NICE capability or an rtprio limit on Linux; settings that
+  /// cannot be applied are reported on stderr and the others still apply.
+  /// Affinity and names are only supported on Linux and names on macOS;
+  /// nothing is changed on Windows.
+  ///
+  /// Options can be changed at any time and apply from the next event of
+  /// the thread on.
+  ///
+  /// @code
+  ///   am::AssetManagerClient::ThreadOptions options;
+  ///   options.cpu = 3;
+  ///   options.policy = am::AssetManagerClient::ThreadOptions::SCHEDULE_FIFO;
+  ///   options.priority = 80;
+  ///   options.busy_poll_us = 200;
+  ///   am.SetUDPThreadOptions(options);
+  /// @endcode
+  void SetTCPThreadOptions(const ThreadOptions& options);
+
+  /// @brief Configure the thread that sends UDP messages.
+  ///
+  /// @see @a SetTCPThreadOptions
+  void SetUDPThreadOptions(const ThreadOptions& options);
+
+  /// @brief Batch UDP messages adaptively within a latency budget.
+  ///
+  /// @a StartBundle and @a EndBundle pack messages into as few packets as
+  /// possible, but only if the application knows where its frames begin and
+  /// end. With adaptive batching, the UDP thread instead holds standalone
+  /// messages for at most @a latency_budget_us microseconds and sends the
+  /// messages that arrive meanwhile in one bundle. The hold time follows the
+  /// observed message rate: at low rates, when the next message is not
+  /// expected within the budget, messages go out right away; at high rates
+  /// a message is held about as long as it takes to fill a packet, and a
+  /// full packet is sent without waiting for the budget to run out.
+  ///
+  /// Bundles built with @a StartBundle, messages with large blobs and urgent
+  /// messages (see @a Priority) are sent as is, reliable messages are not
+  /// affected and messages keep their order. Flushing sends the held
+  /// messages right away. While batching, @a UDP_INLINE has no effect.
+  ///
+  /// @param[in] latency_budget_us  Longest time a message is held, e.g.
+  ///                               250, or 0 to send every message right
+  ///                               away (the default).
+  void SetUDPBatching(unsigned int latency_budget_us);
+
+  /// Settings for sending UDP messages to a multicast group. See @a
+  /// SetMulticastOptions.
+  struct MulticastOptions {
+    MulticastOptions() : ttl(1), loopback(true) {}
+
+    int ttl;                        ///< Number of hops, 1 for the local net.
+    bool loopback;                  ///< Deliver to listeners on this machine.
+    std::string interface_address;  ///< IPv4 address of the outgoing
+                                    ///< interface, empty for the default.
+  };
+
+  /// @brief Configure UDP for sending to a multicast group.
+  ///
+  /// To reach every Asset Manager instance with a single packet, pass a
+  /// multicast group address (e.g. "239.255.0.1") as the host of the
+  /// constructor and have each instance join that group. UDP messages are
+  /// then sent once to the group instead of once per host. TCP messages
+  /// cannot be multicast; set @a CORE_USE_UDP so that core messages are sent
+  /// to the group as well.
+  ///
+  /// The options apply to the messages sent after the call.
+  ///
+  /// @code
+  ///   am::AssetManagerClient am("/project", "239.255.0.1");
+  ///   am.SetOption(am::AssetManagerClient::CORE_USE_UDP);
+  ///   am::AssetManagerClient::MulticastOptions multicast;
+  ///   multicast.ttl = 2;
+  ///   multicast.interface_address = "192.168.1.10";
+  ///   am.SetMulticastOptions(multicast);
+  /// @endcode
+  void SetMulticastOptions(const MulticastOptions& options);
+
+  /// @brief Record every outgoing message to a file.
+  ///
+  /// Each packet is appended, with the time and the transport it is sent
+  /// with, to a memory-mapped log as it is handed to the TCP or UDP client:
+  /// bundles once they are flushed and reliable messages without their
+  /// wrapping. am_replay sends a log to a host again, either at the original
+  /// pace or as fast as possible. A previous recording is stopped first.
+  ///
+  /// @param[in] path         File to write the log to. An existing file is
+  ///                         overwritten.
+  ///
+  /// @return false if the file could not be created.
+  bool StartRecording(const std::string& path);
+
+  /// @brief Stop recording and close the log.
+  void StopRecording();
+
+  /// Traffic and health of one destination host. See @a
+  /// GetDestinationStatistics.
+  struct DestinationStatistics {
+    std::string host;
+    bool resolved;                  ///< Host name resolved for UDP.
+    bool tcp_connected;             ///< TCP connection currently established.
+    std::size_t tcp_messages_sent;
+    std::size_t tcp_bytes_sent;     ///< Including the length prefixes.
+    std::size_t tcp_errors;         ///< Failed connection attempts and writes.
+    std::size_t udp_packets_sent;
+    std::size_t udp_bytes_sent;
+    std::size_t udp_errors;         ///< Packets that could not be sent.
+    std::size_t reliable_sent;      ///< Reliable messages sent.
+    std::size_t reliable_acked;     ///< Reliable messages acknowledged.
+    std::size_t retransmissions;    ///< Reliable messages sent again.
+    std::size_t reliable_failed;    ///< Reliable messages given up on.
+  };
+
+  /// @brief Returns the statistics of every destination host.
+  ///
+  /// The statistics are listed in the order of the hosts passed to the
+  /// constructor.
+  std::vector<DestinationStatistics> GetDestinationStatistics() const;
+
+  /// Transport queues of one priority class. See @a GetQueueStatistics.
+  struct QueueStatistics {
+    std::size_t tcp_queued;         ///< TCP messages waiting to be written
+                                    ///< to the most backed-up host.
+    std::size_t tcp_peak_queued;    ///< Highest tcp_queued of any host.
+    std::size_t tcp_sent;           ///< TCP messages written, all hosts.
+    std::size_t udp_queued;         ///< UDP packets waiting to be sent,
+                                    ///< including those held by a barrier.
+    std::size_t udp_peak_queued;    ///< Highest value of udp_queued.
+    std::size_t udp_sent;           ///< UDP packets sent to every host.
+  };
+
+  /// @brief Returns the queue usage of the priority class @a priority.
+  ///
+  /// @see @a Priority
+  QueueStatistics GetQueueStatistics(Priority priority) const;
+
  private:
   DISALLOW_COPY_AND_ASSIGN(AssetManagerClient);
+  friend class Project;
+  friend class SceneState;
 
   enum {
     TCP_PORT = 15002,
     UDP_PORT = 15003,
-    MAX_MESSAGE_SIZE = 1500
+    MAX_MESSAGE_SIZE = 1500,
+    MAX_TCP_MESSAGE_SIZE = 65536,
+    // TCP messages with blobs are limited only by the 32-bit length prefix
+    MAX_TCP_FRAME_SIZE = 0x7fffffff
   };
 
-  void SendCoreMessage(const std::vector<char>& msg);
-  void NewBundle(std::vector<char>& bundle);
-  void AppendBundle(std::vector<char>& bundle, const std::vector<char>& message);
+  void Init(const std::vector<std::string>& hosts, long tcp_port,
+      long udp_port);
+  void SendCoreMessage(const tnyosc::MessageBuilder& msg);
+  void SentTCP();
+  bool NewBundle();
+  void FlushBundle();
+  /// Return false if the message was dropped, e.g. by the memory limit.
+  bool SendTCP(MessageEncoder& encoder, Priority priority=PRIORITY_BULK);
+  bool SendUDP(MessageEncoder& encoder, Priority priority=PRIORITY_BULK);
+  bool SendReliableUDP(MessageEncoder& encoder,
+      Priority priority=PRIORITY_BULK);
+  int PackBundleElement(MessageEncoder& encoder);
+
+  /// Bundles the UDP messages sent through it, unless the caller already
+  /// opened a bundle with StartBundle. The bundle is sent on destruction.
+  class ImplicitBundle {
+   public:
+    explicit ImplicitBundle(AssetManagerClient* client);
+    ~ImplicitBundle();
+    bool Send(MessageEncoder& encoder) { return client_->SendUDP(encoder); }
+   private:
+    DISALLOW_COPY_AND_ASSIGN(ImplicitBundle);
+    AssetManagerClient* client_;
+    bool bundling_;
+  };
+
+  /// Sends shared by the client and its Project handles, which pass the
+  /// base address of their project.
+  typedef bool (AssetManagerClient::*SendFunction)(MessageEncoder& encoder,
+      Priority priority);
+  void SendFormatted(SendFunction send, const std::string& base_address,
+      const std::string& url, const char* format, va_list ap,
+      Priority priority=PRIORITY_BULK);
+  void SendObjects(const std::string& prefix, const int* ids, const float* x,
+      const float* y, const float* z, std::size_t count, const float* gains);
+  AddressHandle Intern(const std::string& address);
+
+  /// Steps of AsyncFlush and AsyncWaitConnected.
+  static void FlushedTCP(void* operation, bool success);
+  static void Completed(void* operation, bool success);
 
   std::string base_address_;
+  /// Handle of the project of @a base_address_.
+  Project project_;
   int options_;
+  AddressTable* addresses_;
+  MessageBufferPool* pool_;
   TCPClient* tcp_client_;
   UDPClient* udp_client_;
   bool start_bundle_;
-  std::vector<char> tcp_bundle_;
-  std::vector<char> udp_bundle_;
+  MessageBuffer* udp_bundle_; // holds one reference while a bundle is open
+  TrafficRecorder* recorder_; // NULL unless recording
 };
 
 } // namespace am
@@ -0,0 +1,143 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _ASSET_MANAGER_CLIENT_CORO_HPP_
+#define _ASSET_MANAGER_CLIENT_CORO_HPP_
+
+/// @file asset_manager_client_coro.hpp
+/// @brief C++20 coroutine interface for Asset Manager Client
+///
+/// Optional layer over AssetManagerClient for code written with C++20
+/// coroutines. The library itself does not need C++20; only the code that
+/// includes this header does.
+
+#include "asset_manager_client.hpp"
+
+#if !defined(__cpp_impl_coroutine)
+#error "asset_manager_client_coro.hpp requires C++20 coroutines"
+#endif
+
+#include <coroutine>
+#include <string>
+
+namespace am {
+
+/// @brief Awaits an AsyncOperation of AssetManagerClient.
+///
+/// The operation state lives in the awaitable, i.e. in the coroutine frame,
+/// so awaiting does not allocate. co_await returns whether the operation
+/// succeeded. The coroutine is resumed on the I/O thread that completed the
+/// operation, or right away if there was nothing to wait for; do not call
+/// the blocking @a AssetManagerClient::BlockUntilQueuesAreEmpty from there.
+class OperationAwaitable {
+ public:
+  typedef void (AssetManagerClient::*StartFunction)(AsyncOperation*);
+
+  OperationAwaitable(AssetManagerClient& client, StartFunction start)
+  : client_(client), start_(start), operation_(&Resume, this) {}
+
+  OperationAwaitable(const OperationAwaitable&) = delete;
+  OperationAwaitable& operator=(const OperationAwaitable&) = delete;
+
+  bool await_ready() const noexcept { return false; }
+
+  void await_suspend(std::coroutine_handle<> handle) {
+    handle_ = handle;
+    // The coroutine may be resumed, and this object destroyed, before the
+    // call returns
+    (client_.*start_)(&operation_);
+  }
+
+  bool await_resume() const noexcept { return operation_.success(); }
+
+ private:
+  static void Resume(AsyncOperation*, void* context) {
+    static_cast<OperationAwaitable*>(context)->handle_.resume();
+  }
+
+  AssetManagerClient& client_;
+  StartFunction start_;
+  AsyncOperation operation_;
+  std::coroutine_handle<> handle_;
+};
+
+/// @brief Coroutine interface for an AssetManagerClient.
+///
+/// The send functions send the message right away, like their counterparts
+/// in AssetManagerClient, and the returned awaitable completes once the
+/// message and every message sent before it has been written (see @a
+/// AssetManagerClient::AsyncFlush). The wrapped client can still be used
+/// directly alongside.
+///
+/// @code
+///   Task Cue(am::CoroutineClient& am) {
+///     if (!co_await am.Connected()) co_return;
+///     co_await am.SendTCP("/cue", "i", 1);
+///     co_await am.SendUDP("/object/pos", "fff", x, y, z);
+///   }
+/// @endcode
+class CoroutineClient {
+ public:
+  explicit CoroutineClient(AssetManagerClient& client) : client_(client) {}
+
+  AssetManagerClient& client() { return client_; }
+
+  /// Send with @a AssetManagerClient::SendCustomTCP.
+  template <typename... Args>
+  OperationAwaitable SendTCP(const std::string& url, const char* format,
+      Args... args) {
+    client_.SendCustomTCP(url, format, args...);
+    return Flush();
+  }
+
+  /// Send with @a AssetManagerClient::SendCustomUDP.
+  template <typename... Args>
+  OperationAwaitable SendUDP(const std::string& url, const char* format,
+      Args... args) {
+    client_.SendCustomUDP(url, format, args...);
+    return Flush();
+  }
+
+  /// Send with @a AssetManagerClient::SendCustomReliableUDP. Completes once
+  /// the message has been acknowledged or given up on.
+  template <typename... Args>
+  OperationAwaitable SendReliableUDP(const std::string& url,
+      const char* format, Args... args) {
+    client_.SendCustomReliableUDP(url, format, args...);
+    return Flush();
+  }
+
+  /// See @a AssetManagerClient::AsyncFlush.
+  OperationAwaitable Flush() {
+    return OperationAwaitable(client_, &AssetManagerClient::AsyncFlush);
+  }
+
+  /// See @a AssetManagerClient::AsyncWaitConnected.
+  OperationAwaitable Connected() {
+    return OperationAwaitable(client_,
+        &AssetManagerClient::AsyncWaitConnected);
+  }
+
+ private:
+  AssetManagerClient& client_;
+};
+
+} // namespace am
+
+#endif // _ASSET_MANAGER_CLIENT_CORO_HPP_
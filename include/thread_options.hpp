@@ -0,0 +1,62 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _THREAD_OPTIONS_HPP_
+#define _THREAD_OPTIONS_HPP_
+
+/// @file thread_options.hpp
+/// @brief Scheduling options of the I/O threads
+///
+/// Included by asset_manager_client.hpp, where the options are known as
+/// AssetManagerClient::ThreadOptions, and by the transports, which do not
+/// depend on the client.
+
+#include <string>
+
+namespace am {
+
+/// Scheduling of a transport I/O thread. See @a
+/// AssetManagerClient::SetTCPThreadOptions.
+struct ThreadOptions {
+  enum Policy {
+    SCHEDULE_DEFAULT,             ///< Time-sharing (SCHED_OTHER).
+    SCHEDULE_FIFO,                ///< Real-time SCHED_FIFO.
+    SCHEDULE_RR                   ///< Real-time SCHED_RR.
+  };
+
+  ThreadOptions() : cpu(-1), policy(SCHEDULE_DEFAULT), priority(0),
+    busy_poll_us(0) {}
+
+  int cpu;                        ///< CPU to pin the thread to, or -1 to
+                                  ///< leave the affinity unchanged.
+  Policy policy;                  ///< SCHEDULE_DEFAULT with priority 0
+                                  ///< keeps the scheduling inherited by
+                                  ///< the thread.
+  int priority;                   ///< Priority for SCHEDULE_FIFO and
+                                  ///< SCHEDULE_RR, 1 to 99 on Linux.
+  int busy_poll_us;               ///< Time to keep polling for work after
+                                  ///< the last event before sleeping, 0 to
+                                  ///< sleep right away.
+  std::string name;               ///< Thread name, empty for the default
+                                  ///< "am_tcp" or "am_udp".
+};
+
+} // namespace am
+
+#endif // _THREAD_OPTIONS_HPP_
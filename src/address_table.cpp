@@ -0,0 +1,44 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "address_table.hpp"
+
+using namespace am;
+
+//-----------------------------------------------------------------------------
+int AddressTable::Intern(const std::string& address)
+{
+  std::map<std::string, int>::const_iterator it = indices_.find(address);
+  if (it != indices_.end()) return it->second;
+
+  int index = (int)padded_.size();
+  std::string padded(address);
+  padded.append(4 - address.size() % 4, '\0');
+  padded_.push_back(padded);
+  indices_.insert(std::make_pair(address, index));
+  return index;
+}
+
+bool AddressTable::Lookup(int index, PaddedAddress* address) const
+{
+  if (index < 0 || (std::size_t)index >= padded_.size()) return false;
+  address->data = padded_[index].data();
+  address->size = padded_[index].size();
+  return true;
+}
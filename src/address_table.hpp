@@ -0,0 +1,60 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _ADDRESS_TABLE_HPP_
+#define _ADDRESS_TABLE_HPP_
+
+#include <cstddef>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "disallow_copy_and_assign.hpp"
+#include "osc_packer.hpp"
+
+namespace am {
+
+/// Interned Open Sound Control addresses.
+///
+/// Each address is stored once, already followed by its null padding, so a
+/// message can be encoded by copying the address instead of concatenating
+/// and measuring strings for every send. Addresses are looked up by the
+/// index returned from @a Intern. Entries are never removed.
+class AddressTable {
+ public:
+  AddressTable() {}
+
+  /// Returns the index of @a address, adding it to the table if needed.
+  int Intern(const std::string& address);
+
+  /// Returns true and sets @a address to the entry at @a index if it exists.
+  bool Lookup(int index, PaddedAddress* address) const;
+
+  std::size_t size() const { return padded_.size(); }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(AddressTable);
+
+  std::map<std::string, int> indices_;
+  std::vector<std::string> padded_;
+};
+
+} // namespace am
+
+#endif // _ADDRESS_TABLE_HPP_
@@ -22,19 +22,30 @@
 #include <cstring>
 #include <csignal>
 #include <string>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/tokenizer.hpp>
 #include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "asset_manager_client.hpp"
+#include "tnyosc.hpp"
+
+typedef boost::tokenizer< boost::char_separator<char> > Tokenizer;
 
 // global variables
 std::string g_base_address = "";
 bool g_use_udp = false;
 std::string g_host_address = "127.0.0.1";
+std::string g_batch_path;  // commands file, "-" for stdin, empty if none
+long g_window_ms = 5;      // UDP bundling window of the batch mode
+long g_line = 0;           // line being processed in batch mode
 
 void ProcessArguments(int argc, const char* argv[]);
-void ProcessInput(am::AssetManagerClient& am, const std::string& input);
+bool ProcessInput(am::AssetManagerClient& am, const std::string& input);
+int RunBatch(am::AssetManagerClient& am, std::istream& in);
 void Signal(int what);
 
 template <class T>
@@ -54,12 +65,23 @@ bool from_string(T& t,
 int main(int argc, const char* argv[])
 {
   ProcessArguments(argc, argv);
-  std::cout << "Using base address: " << g_base_address << "\n";
-  std::cout << "Type \"help\" to list commands\n";
 
   am::AssetManagerClient am(g_base_address, g_host_address);
   if (g_use_udp) am.SetOption(am::AssetManagerClient::CORE_USE_UDP);
 
+  if (!g_batch_path.empty()) {
+    if (g_batch_path == "-") return RunBatch(am, std::cin);
+    std::ifstream in(g_batch_path.c_str());
+    if (!in) {
+      std::cerr << "Cannot open " << g_batch_path << "\n";
+      return 1;
+    }
+    return RunBatch(am, in);
+  }
+
+  std::cout << "Using base address: " << g_base_address << "\n";
+  std::cout << "Type \"help\" to list commands\n";
+
   signal(SIGINT, Signal);
 #if !defined(_WIN32)
   signal(SIGQUIT, Signal);
@@ -104,6 +126,18 @@ void ProcessArguments(int argc, const char* argv[])
         printf("Not enough argument.\n");
         goto print_usage;
       }
+    } else if (!strcmp(argv[i], "-b") || !strcmp(argv[i], "--batch")) {
+      if (++i < argc) {
+        g_batch_path = argv[i];
+      } else {
+        printf("Not enough argument.\n");
+        goto print_usage;
+      }
+    } else if (!strcmp(argv[i], "-w") || !strcmp(argv[i], "--window")) {
+      if (++i == argc || !from_string<long>(g_window_ms, argv[i], std::dec)) {
+        printf("Bad or missing window.\n");
+        goto print_usage;
+      }
     } else if (i == (argc - 1)) {
       g_base_address = argv[i];
     }
@@ -117,7 +151,8 @@ void ProcessArguments(int argc, const char* argv[])
   return;
 
 print_usage:
-  printf("Usage: am_client [ -i ip ] [ -p port ] base_address", argv[0]);
+  printf("Usage: am_client [ -i ip ] [ -p port ] [ -b file ] base_address",
+      argv[0]);
   printf("\nOptions:");
   printf("\n  -h,--help                "
       "Display this information.");
@@ -125,17 +160,88 @@ print_usage:
       "Use TCP or UDP protocol. Default = tcp.");
   printf("\n  -i,--ip <ip>             "
       "Set Asset Manager's host address. Default = 127.0.0.1");
+  printf("\n  -b,--batch <file|->      "
+      "Run the commands of a file or stdin without prompting.");
+  printf("\n  -w,--window <ms>         "
+      "Bundle the UDP messages of a batch sent within this window.");
+  printf("\n                           Default = 5, 0 to disable.");
   printf("\n");
   exit(0);
 }
 
-void ProcessInput(am::AssetManagerClient& am, const std::string& input)
+// Appends the argument of OSC type @a type parsed from @a arg to @a msg.
+bool AppendArgument(tnyosc::Message& msg, char type, const std::string& arg)
 {
-  boost::char_separator<char> sep(" ");
-  boost::tokenizer< boost::char_separator<char> > tok(input, sep);
-  boost::tokenizer< boost::char_separator<char> >::iterator it = tok.begin();
+  switch (type) {
+    case 'i': {
+      int32_t v;
+      if (!from_string<int32_t>(v, arg, std::dec)) return false;
+      msg.append(v);
+      return true;
+    }
+    case 'h': {
+      long long v;
+      if (!from_string<long long>(v, arg, std::dec)) return false;
+      msg.append((int64_t)v);
+      return true;
+    }
+    case 'f': {
+      float v;
+      if (!from_string<float>(v, arg, std::dec)) return false;
+      msg.append(v);
+      return true;
+    }
+    case 'd': {
+      double v;
+      if (!from_string<double>(v, arg, std::dec)) return false;
+      msg.append(v);
+      return true;
+    }
+    case 't': {
+      unsigned long long v;
+      if (!from_string<unsigned long long>(v, arg, std::dec)) return false;
+      msg.append_time((uint64_t)v);
+      return true;
+    }
+    case 's':
+      msg.append(arg);
+      return true;
+    case 'c':
+      if (arg.size() != 1) return false;
+      msg.append(arg[0]);
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Sends the open bundle, if any. Batch mode keeps bundling the following
+// messages.
+void SendBundle(am::AssetManagerClient& am)
+{
+  if (g_line && g_window_ms > 0) {
+    am.StartBundle();
+  } else {
+    am.EndBundle();
+  }
+}
+
+// Reports an error, with the line number in batch mode.
+std::ostream& Error()
+{
+  if (g_line) std::cerr << "line " << g_line << ": ";
+  return std::cerr;
+}
+
+bool ProcessInput(am::AssetManagerClient& am, const std::string& input)
+{
+  boost::char_separator<char> sep(" \t\r");
+  Tokenizer tok(input, sep);
+  Tokenizer::iterator it = tok.begin();
   for (; it != tok.end(); ++it) {
-    if (!it->compare("load")) {
+    if ((*it)[0] == '#') {
+      break; // comment
+    } else if (!it->compare("load")) {
       am.Load();
     } else if (!it->compare("unload")) {
       am.Unload();
@@ -177,6 +283,43 @@ void ProcessInput(am::AssetManagerClient& am, const std::string& input)
       } else {
         goto bad_argument;
       }
+    } else if (!it->compare("tcp") || !it->compare("udp")) {
+      bool udp = !it->compare("udp");
+      if (++it == tok.end()) goto missing_argument;
+      if ((*it)[0] != '/') goto bad_argument;
+      tnyosc::Message msg(g_base_address + *it);
+      if (++it == tok.end()) goto missing_argument;
+      // "-" stands for no arguments
+      std::string types = it->compare("-") ? *it : std::string();
+      for (std::size_t i = 0; i < types.size(); ++i) {
+        switch (types[i]) {
+          case 'T': msg.append_true(); break;
+          case 'F': msg.append_false(); break;
+          case 'N': msg.append_null(); break;
+          case 'I': msg.append_impulse(); break;
+          default:
+            if (++it == tok.end()) goto missing_argument;
+            if (!AppendArgument(msg, types[i], *it)) goto bad_argument;
+        }
+      }
+      if (udp) {
+        am.SendMessageUDP(msg);
+      } else {
+        am.SendMessageTCP(msg);
+      }
+    } else if (!it->compare("flush")) {
+      SendBundle(am);
+      am.BlockUntilQueuesAreEmpty();
+    } else if (!it->compare("sleep")) {
+      long ms;
+      if (++it == tok.end()) {
+        goto missing_argument;
+      } else if (from_string<long>(ms, *it, std::dec) && ms >= 0) {
+        SendBundle(am);
+        boost::this_thread::sleep(boost::posix_time::milliseconds(ms));
+      } else {
+        goto bad_argument;
+      }
     } else if (!it->compare("help")) {
       std::cout << "load" << std::endl;
       std::cout << "unload" << std::endl;
@@ -184,19 +327,67 @@ void ProcessInput(am::AssetManagerClient& am, const std::string& input)
       std::cout << "system_volume  0-1" << std::endl;
       std::cout << "mute           true|1|false|0" << std::endl;
       std::cout << "volume         0-1" << std::endl;
+      std::cout << "tcp|udp        url types|- arguments..." << std::endl;
+      std::cout << "               types: i h f d s c t T F N I" << std::endl;
+      std::cout << "flush          send pending messages and wait" << std::endl;
+      std::cout << "sleep          milliseconds" << std::endl;
     } else {
-      std::cerr << "Unknown command: " << *it << "\n";
-      break;
+      Error() << "Unknown command: " << *it << "\n";
+      return false;
     }
   }
 
-  return;
+  return true;
 
 bad_argument:
-  std::cerr << "Bad argument: " << *it << "\n";
-  return;
+  Error() << "Bad argument: " << *it << "\n";
+  return false;
 missing_argument:
-  std::cerr << "Missing argument \n";
+  Error() << "Missing argument \n";
+  return false;
+}
+
+int RunBatch(am::AssetManagerClient& am, std::istream& in)
+{
+  using namespace boost::posix_time;
+
+  // Buffer stdin so that in_avail tells whether more input is ready
+  std::ios::sync_with_stdio(false);
+
+  // UDP messages are bundled until the window elapses or the input runs dry,
+  // so a burst of commands goes out in a few datagrams without delaying the
+  // last ones.
+  bool bundling = g_window_ms > 0;
+  ptime window_end(neg_infin);
+  long commands = 0;
+  long errors = 0;
+  ptime start = microsec_clock::universal_time();
+  std::string input;
+  while (true) {
+    if (bundling && in.rdbuf()->in_avail() <= 0) {
+      am.EndBundle();
+      window_end = ptime(neg_infin);
+    }
+    if (!std::getline(in, input)) break;
+    ++g_line;
+    if (bundling) {
+      ptime now = microsec_clock::universal_time();
+      if (now >= window_end) {
+        am.StartBundle(); // sends the previous bundle, if any
+        window_end = now + milliseconds(g_window_ms);
+      }
+    }
+    if (!ProcessInput(am, input)) errors++;
+    commands++;
+  }
+  am.EndBundle();
+  am.BlockUntilQueuesAreEmpty();
+
+  double seconds = (microsec_clock::universal_time() - start)
+    .total_microseconds() / 1e6;
+  std::cerr << commands << " lines, " << errors << " errors in " << seconds
+    << " s\n";
+  return errors ? 1 : 0;
 }
 
 void Signal(int what)
@@ -0,0 +1,436 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// am_loadgen: synthetic load for AssetManagerClient. Moves N sound objects
+// at M Hz with SendObjectsUDP, sends TCP cues at a given rate and reports
+// every second what the client achieved. With --sink, a local sink takes the
+// place of Asset Manager and counts what arrives. With --projects, the objects
+// are spread over several projects sharing the client and its bundles.
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/smart_ptr/detail/atomic_count.hpp>
+#include <boost/thread/thread.hpp>
+
+#if !defined(_WIN32)
+#include <arpa/inet.h>
+#include <sys/resource.h>
+#endif
+
+#include "asset_manager_client.hpp"
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+using namespace boost::posix_time;
+
+// global variables
+std::string g_host_address = "127.0.0.1";
+long g_tcp_port = 15002;
+long g_udp_port = 15003;
+long g_objects = 64;
+long g_projects = 1;
+double g_rate = 60.0;
+double g_cue_rate = 1.0;
+double g_duration = 10.0;
+bool g_gains = false;
+bool g_sink = false;
+
+void ProcessArguments(int argc, const char* argv[]);
+
+// Counts the messages of an OSC packet, looking into bundles.
+long CountMessages(const char* packet, std::size_t size)
+{
+  if (size < 16 || memcmp(packet, "#bundle", 8) != 0) return 1;
+  long count = 0;
+  std::size_t offset = 16;
+  while (offset + 4 <= size) {
+    int32_t n;
+    memcpy(&n, packet + offset, 4);
+    n = ntohl(n);
+    offset += 4;
+    if (n <= 0 || offset + n > size) break;
+    count += CountMessages(packet + offset, n);
+    offset += n;
+  }
+  return count;
+}
+
+// Receives in place of Asset Manager on the loopback interface.
+class LocalSink {
+ public:
+  LocalSink(long tcp_port, long udp_port)
+  : acceptor_(io_service_, tcp::endpoint(tcp::v4(), tcp_port))
+  , socket_(io_service_, udp::endpoint(udp::v4(), udp_port))
+  , udp_packets_(0)
+  , udp_messages_(0)
+  , tcp_messages_(0)
+  {
+    boost::asio::socket_base::receive_buffer_size option(4 * 1024 * 1024);
+    boost::system::error_code error;
+    socket_.set_option(option, error);
+    StartReceive();
+    StartAccept();
+    thread_ = boost::thread(
+        boost::bind(&boost::asio::io_service::run, &io_service_));
+  }
+
+  ~LocalSink() {
+    io_service_.stop();
+    thread_.join();
+    for (std::size_t i = 0; i < connections_.size(); ++i) {
+      delete connections_[i];
+    }
+  }
+
+  long udp_packets() const { return udp_packets_; }
+  long udp_messages() const { return udp_messages_; }
+  long tcp_messages() const { return tcp_messages_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(LocalSink);
+
+  struct Connection {
+    Connection(boost::asio::io_service& io_service) : socket(io_service) {}
+    tcp::socket socket;
+    char size[4];
+    std::vector<char> frame;
+  };
+
+  void StartReceive() {
+    socket_.async_receive_from(boost::asio::buffer(buf_, sizeof(buf_)),
+        sender_, boost::bind(&LocalSink::HandleReceive, this,
+          boost::asio::placeholders::error,
+          boost::asio::placeholders::bytes_transferred));
+  }
+
+  void HandleReceive(const boost::system::error_code& error,
+      std::size_t size) {
+    if (!error) {
+      ++udp_packets_;
+      long messages = CountMessages(buf_, size);
+      while (messages--) ++udp_messages_;
+    }
+    StartReceive();
+  }
+
+  void StartAccept() {
+    Connection* connection = new Connection(io_service_);
+    connections_.push_back(connection);
+    acceptor_.async_accept(connection->socket,
+        boost::bind(&LocalSink::HandleAccept, this, connection,
+          boost::asio::placeholders::error));
+  }
+
+  void HandleAccept(Connection* connection,
+      const boost::system::error_code& error) {
+    if (!error) StartReadSize(connection);
+    StartAccept();
+  }
+
+  void StartReadSize(Connection* connection) {
+    boost::asio::async_read(connection->socket,
+        boost::asio::buffer(connection->size, 4),
+        boost::bind(&LocalSink::HandleReadSize, this, connection,
+          boost::asio::placeholders::error));
+  }
+
+  void HandleReadSize(Connection* connection,
+      const boost::system::error_code& error) {
+    if (error) return;
+    int32_t n;
+    memcpy(&n, connection->size, 4);
+    n = ntohl(n);
+    if (n <= 0) return;
+    connection->frame.resize(n);
+    boost::asio::async_read(connection->socket,
+        boost::asio::buffer(connection->frame),
+        boost::bind(&LocalSink::HandleReadFrame, this, connection,
+          boost::asio::placeholders::error));
+  }
+
+  void HandleReadFrame(Connection* connection,
+      const boost::system::error_code& error) {
+    if (error) return;
+    long messages = CountMessages(&connection->frame[0],
+        connection->frame.size());
+    while (messages--) ++tcp_messages_;
+    StartReadSize(connection);
+  }
+
+  boost::asio::io_service io_service_;
+  tcp::acceptor acceptor_;
+  udp::socket socket_;
+  udp::endpoint sender_;
+  char buf_[65536];
+  std::vector<Connection*> connections_;
+  boost::thread thread_;
+  boost::detail::atomic_count udp_packets_;
+  boost::detail::atomic_count udp_messages_;
+  boost::detail::atomic_count tcp_messages_;
+};
+
+// Process CPU time in seconds, including every thread.
+double CpuSeconds()
+{
+#if defined(_WIN32)
+  return 0.0;
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1e6 +
+    usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1e6;
+#endif
+}
+
+// Totals reported once per second.
+struct Sample {
+  long object_messages;
+  long cues;
+  std::size_t udp_packets;
+  std::size_t tcp_messages;
+  std::size_t errors;
+  std::size_t dropped;
+  long sink_udp_packets;
+  long sink_udp_messages;
+  long sink_tcp_messages;
+  double cpu;
+  ptime time;
+};
+
+Sample TakeSample(am::AssetManagerClient& am, const LocalSink* sink,
+    long object_messages, long cues)
+{
+  Sample sample;
+  sample.object_messages = object_messages;
+  sample.cues = cues;
+  sample.udp_packets = 0;
+  sample.tcp_messages = 0;
+  sample.errors = 0;
+  std::vector<am::AssetManagerClient::DestinationStatistics> destinations =
+    am.GetDestinationStatistics();
+  for (std::size_t i = 0; i < destinations.size(); ++i) {
+    sample.udp_packets += destinations[i].udp_packets_sent;
+    sample.tcp_messages += destinations[i].tcp_messages_sent;
+    sample.errors += destinations[i].udp_errors + destinations[i].tcp_errors;
+  }
+  sample.dropped = am.GetMemoryStatistics().dropped_messages;
+  sample.sink_udp_packets = sink ? sink->udp_packets() : 0;
+  sample.sink_udp_messages = sink ? sink->udp_messages() : 0;
+  sample.sink_tcp_messages = sink ? sink->tcp_messages() : 0;
+  sample.cpu = CpuSeconds();
+  sample.time = microsec_clock::universal_time();
+  return sample;
+}
+
+void PrintSample(am::AssetManagerClient& am, const Sample& from,
+    const Sample& to, bool sink)
+{
+  double seconds = (to.time - from.time).total_microseconds() / 1e6;
+  if (seconds <= 0) return;
+  am::AssetManagerClient::MemoryStatistics memory = am.GetMemoryStatistics();
+  printf("objects %8.0f msg/s  udp %7.0f pkt/s  tcp %5.0f msg/s  "
+      "queued %4lu (peak %lu)  dropped %lu  errors %lu  cpu %5.1f%%",
+      (to.object_messages - from.object_messages) / seconds,
+      (to.udp_packets - from.udp_packets) / seconds,
+      (to.tcp_messages - from.tcp_messages) / seconds,
+      (unsigned long)memory.slots_in_use,
+      (unsigned long)memory.peak_slots_in_use,
+      (unsigned long)(to.dropped - from.dropped),
+      (unsigned long)(to.errors - from.errors),
+      100.0 * (to.cpu - from.cpu) / seconds);
+  if (sink) {
+    printf("  sink %7.0f pkt/s %8.0f msg/s",
+        (to.sink_udp_packets - from.sink_udp_packets) / seconds,
+        (to.sink_udp_messages - from.sink_udp_messages +
+         to.sink_tcp_messages - from.sink_tcp_messages) / seconds);
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+int main(int argc, const char* argv[])
+{
+  ProcessArguments(argc, argv);
+
+  LocalSink* sink = NULL;
+  try {
+    if (g_sink) sink = new LocalSink(g_tcp_port, g_udp_port);
+  } catch (std::exception& e) {
+    std::cerr << "am_loadgen: cannot start the sink: " << e.what() << "\n";
+    return 1;
+  }
+
+  am::AssetManagerClient am("/loadgen", g_host_address, g_tcp_port,
+      g_udp_port);
+
+  // Project k owns the objects [begin[k], begin[k + 1])
+  std::vector<am::Project> projects;
+  std::vector<long> begin;
+  for (long k = 0; k < g_projects; ++k) {
+    projects.push_back(g_projects == 1 ? am.OpenProject("/loadgen") :
+        am.OpenProject("/loadgen" + boost::lexical_cast<std::string>(k)));
+    begin.push_back(k * g_objects / g_projects);
+  }
+  begin.push_back(g_objects);
+
+  std::vector<int> ids(g_objects);
+  std::vector<float> x(g_objects), y(g_objects), z(g_objects, 0.0f);
+  std::vector<float> gains(g_objects, 1.0f);
+  for (long i = 0; i < g_objects; ++i) ids[i] = (int)i;
+
+  long object_messages = 0;
+  long cues = 0;
+  Sample first = TakeSample(am, sink, 0, 0);
+  Sample last = first;
+  ptime start = first.time;
+  ptime end = start + microseconds((long long)(g_duration * 1e6));
+  for (long tick = 0; ; ++tick) {
+    ptime due = start + microseconds((long long)(tick * 1e6 / g_rate));
+    if (due >= end) break;
+    ptime now = microsec_clock::universal_time();
+    if (due > now) boost::this_thread::sleep(due - now);
+
+    // Objects circle around the listener, each at its own phase
+    double t = tick / g_rate;
+    for (long i = 0; i < g_objects; ++i) {
+      double phase = t + 2 * M_PI * i / g_objects;
+      x[i] = (float)cos(phase);
+      y[i] = (float)sin(phase);
+    }
+    // One bundle per frame, shared by all projects
+    am.StartBundle();
+    for (long k = 0; k < g_projects; ++k) {
+      long n = begin[k + 1] - begin[k];
+      if (n == 0) continue;
+      long i = begin[k];
+      projects[k].SendObjectsUDP("/object", &ids[i], &x[i], &y[i], &z[i], n,
+          g_gains ? &gains[i] : NULL);
+    }
+    am.EndBundle();
+    object_messages += g_objects * (g_gains ? 2 : 1);
+
+    while (cues < (long)(t * g_cue_rate)) {
+      projects[cues % g_projects].SendCustomTCP("/cue", "i", (int)cues);
+      cues++;
+    }
+
+    if (microsec_clock::universal_time() - last.time >= seconds(1)) {
+      Sample sample = TakeSample(am, sink, object_messages, cues);
+      PrintSample(am, last, sample, sink != NULL);
+      last = sample;
+    }
+  }
+  am.BlockUntilQueuesAreEmpty();
+  // Give the sink a moment to read what is still in flight
+  if (sink) boost::this_thread::sleep(milliseconds(200));
+
+  Sample total = TakeSample(am, sink, object_messages, cues);
+  printf("total: ");
+  PrintSample(am, first, total, sink != NULL);
+  if (sink) {
+    printf("sent %ld object messages and %ld cues, sink received %ld UDP "
+        "and %ld TCP messages\n", object_messages, cues,
+        total.sink_udp_messages, total.sink_tcp_messages);
+  }
+  delete sink;
+  return 0;
+}
+
+void ProcessArguments(int argc, const char* argv[])
+{
+  try {
+    for (int i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+        goto print_usage;
+      } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--sink")) {
+        g_sink = true;
+      } else if (!strcmp(argv[i], "-g") || !strcmp(argv[i], "--gains")) {
+        g_gains = true;
+      } else if (i + 1 == argc) {
+        printf("Not enough argument.\n");
+        goto print_usage;
+      } else if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--ip")) {
+        g_host_address = argv[++i];
+      } else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--tcp-port")) {
+        g_tcp_port = boost::lexical_cast<long>(argv[++i]);
+      } else if (!strcmp(argv[i], "-u") || !strcmp(argv[i], "--udp-port")) {
+        g_udp_port = boost::lexical_cast<long>(argv[++i]);
+      } else if (!strcmp(argv[i], "-n") || !strcmp(argv[i], "--objects")) {
+        g_objects = boost::lexical_cast<long>(argv[++i]);
+      } else if (!strcmp(argv[i], "-p") || !strcmp(argv[i], "--projects")) {
+        g_projects = boost::lexical_cast<long>(argv[++i]);
+      } else if (!strcmp(argv[i], "-r") || !strcmp(argv[i], "--rate")) {
+        g_rate = boost::lexical_cast<double>(argv[++i]);
+      } else if (!strcmp(argv[i], "-c") || !strcmp(argv[i], "--cues")) {
+        g_cue_rate = boost::lexical_cast<double>(argv[++i]);
+      } else if (!strcmp(argv[i], "-d") || !strcmp(argv[i], "--duration")) {
+        g_duration = boost::lexical_cast<double>(argv[++i]);
+      } else {
+        printf("Unrecognized option: %s\n", argv[i]);
+        goto print_usage;
+      }
+    }
+  } catch (boost::bad_lexical_cast&) {
+    printf("Bad argument.\n");
+    goto print_usage;
+  }
+  if (g_objects <= 0 || g_projects <= 0 || g_rate <= 0 || g_cue_rate < 0) {
+    goto print_usage;
+  }
+  return;
+
+print_usage:
+  printf("Usage: am_loadgen [ options ]");
+  printf("\nOptions:");
+  printf("\n  -h,--help                "
+      "Display this information.");
+  printf("\n  -i,--ip <ip>             "
+      "Set Asset Manager's host address. Default = 127.0.0.1");
+  printf("\n  -t,--tcp-port <port>     "
+      "Set Asset Manager's TCP port. Default = 15002");
+  printf("\n  -u,--udp-port <port>     "
+      "Set Asset Manager's UDP port. Default = 15003");
+  printf("\n  -n,--objects <count>     "
+      "Number of sound objects. Default = 64");
+  printf("\n  -p,--projects <count>    "
+      "Spread the objects over this many projects. Default = 1");
+  printf("\n  -r,--rate <hz>           "
+      "Position updates per second. Default = 60");
+  printf("\n  -g,--gains               "
+      "Send a gain along with every position.");
+  printf("\n  -c,--cues <per second>   "
+      "TCP cues per second. Default = 1");
+  printf("\n  -d,--duration <seconds>  "
+      "Length of the run. Default = 10");
+  printf("\n  -s,--sink                "
+      "Receive on the local ports in place of Asset Manager. The CPU usage"
+      "\n                           then includes the sink.");
+  printf("\n");
+  exit(0);
+}
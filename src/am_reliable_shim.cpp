@@ -0,0 +1,145 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// am_reliable_shim: receive side of reliable UDP for servers that do not
+// implement it. Listens for the datagrams of AssetManagerClient, acknowledges
+// reliable messages, drops duplicates and forwards every packet, unwrapped,
+// to Asset Manager. Regular packets are forwarded as is, so clients can send
+// all their UDP traffic through the shim.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/lexical_cast.hpp>
+
+#include "reliable_udp.hpp"
+
+using boost::asio::ip::udp;
+
+// global variables
+int g_listen_port = 15013;
+std::string g_host_address = "127.0.0.1";
+std::string g_host_port = "15003";
+double g_loss = 0.0;
+
+void ProcessArguments(int argc, const char* argv[]);
+
+// Simulate a lossy network by dropping datagrams at random
+bool Lost()
+{
+  return g_loss > 0.0 && rand() < g_loss * RAND_MAX;
+}
+
+int main(int argc, const char* argv[])
+{
+  ProcessArguments(argc, argv);
+
+  try {
+    boost::asio::io_service io_service;
+    udp::resolver resolver(io_service);
+    udp::endpoint destination = *resolver.resolve(
+        udp::resolver::query(udp::v4(), g_host_address, g_host_port));
+
+    udp::socket socket(io_service, udp::endpoint(udp::v4(), g_listen_port));
+    udp::socket forward(io_service, udp::endpoint(udp::v4(), 0));
+    std::cout << "Forwarding port " << g_listen_port << " to " << destination
+      << "\n";
+
+    std::map<udp::endpoint, am::ReliableReceiver> receivers;
+    char buf[65536];
+    char ack[am::RELIABLE_ACK_SIZE];
+    while (true) {
+      udp::endpoint sender;
+      boost::system::error_code error;
+      std::size_t size = socket.receive_from(boost::asio::buffer(buf), sender,
+          0, error);
+      if (error || Lost()) continue;
+
+      const char* packet = buf;
+      std::size_t packet_size = size;
+      am::ReliableReceiver::Result result = receivers[sender].Receive(buf,
+          size, &packet, &packet_size, ack);
+      if (result == am::ReliableReceiver::NEW_MESSAGE ||
+          result == am::ReliableReceiver::DUPLICATE) {
+        if (!Lost()) {
+          socket.send_to(boost::asio::buffer(ack), sender, 0, error);
+        }
+      }
+      if (result == am::ReliableReceiver::NEW_MESSAGE ||
+          result == am::ReliableReceiver::NOT_RELIABLE) {
+        forward.send_to(boost::asio::buffer(packet, packet_size), destination,
+            0, error);
+      }
+    }
+  } catch (std::exception& e) {
+    std::cerr << "am_reliable_shim: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}
+
+void ProcessArguments(int argc, const char* argv[])
+{
+  try {
+    for (int i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+        goto print_usage;
+      } else if (i + 1 == argc) {
+        printf("Not enough argument.\n");
+        goto print_usage;
+      } else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--listen")) {
+        g_listen_port = boost::lexical_cast<int>(argv[++i]);
+      } else if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--ip")) {
+        g_host_address = argv[++i];
+      } else if (!strcmp(argv[i], "-p") || !strcmp(argv[i], "--port")) {
+        g_host_port = argv[++i];
+      } else if (!strcmp(argv[i], "--loss")) {
+        g_loss = boost::lexical_cast<double>(argv[++i]);
+      } else {
+        printf("Unrecognized option: %s\n", argv[i]);
+        goto print_usage;
+      }
+    }
+  } catch (boost::bad_lexical_cast&) {
+    printf("Bad argument.\n");
+    goto print_usage;
+  }
+  return;
+
+print_usage:
+  printf("Usage: am_reliable_shim [ -l port ] [ -i ip ] [ -p port ]");
+  printf("\nOptions:");
+  printf("\n  -h,--help                "
+      "Display this information.");
+  printf("\n  -l,--listen <port>       "
+      "Port to receive the clients' UDP messages on. Default = 15013");
+  printf("\n  -i,--ip <ip>             "
+      "Set Asset Manager's host address. Default = 127.0.0.1");
+  printf("\n  -p,--port <port>         "
+      "Set Asset Manager's UDP port. Default = 15003");
+  printf("\n  --loss <probability>     "
+      "Drop datagrams and acks at random, for testing. Default = 0");
+  printf("\n");
+  exit(0);
+}
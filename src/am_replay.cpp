@@ -0,0 +1,177 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// am_replay: send a traffic log recorded with
+// AssetManagerClient::StartRecording to a host again, either at the pace it
+// was recorded at (optionally sped up) or as fast as possible.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+#include "traffic_log.hpp"
+
+using namespace boost::posix_time;
+
+// global variables
+std::string g_host_address = "127.0.0.1";
+long g_tcp_port = 15002;
+long g_udp_port = 15003;
+bool g_fast = false;
+double g_speed = 1.0;
+long g_loops = 1;
+std::string g_log_path;
+
+// In fast mode the queues are drained every so many packets so that a large
+// log does not end up in memory all at once.
+const long FAST_BATCH = 4096;
+
+void ProcessArguments(int argc, const char* argv[]);
+
+int main(int argc, const char* argv[])
+{
+  ProcessArguments(argc, argv);
+
+  am::TrafficReader reader;
+  if (!reader.Open(g_log_path)) {
+    std::cerr << "am_replay: cannot read traffic log " << g_log_path << "\n";
+    return 1;
+  }
+
+  am::AssetManagerClient am("", g_host_address, g_tcp_port, g_udp_port);
+  long packets = 0;
+  long long bytes = 0;
+  long failed = 0;
+  ptime start = microsec_clock::universal_time();
+  for (long loop = 0; loop < g_loops; ++loop) {
+    reader.Rewind();
+    ptime loop_start = microsec_clock::universal_time();
+    boost::uint64_t first_us = 0;
+    am::TrafficRecord record;
+    const char* packet;
+    while (reader.Next(&record, &packet)) {
+      if (!first_us) first_us = record.time_us;
+      if (!g_fast) {
+        ptime due = loop_start + microseconds(
+            (long long)((record.time_us - first_us) / g_speed));
+        time_duration wait = due - microsec_clock::universal_time();
+        if (wait.is_positive()) boost::this_thread::sleep(wait);
+      }
+      bool sent;
+      switch (record.transport) {
+        case am::TRAFFIC_TCP:
+          // Recorded TCP messages include their blobs and may exceed any
+          // buffer of the client, so the packet is written from the mapped
+          // log, which outlives the client
+          sent = am.SendPacketTCP(am::Blob(packet, record.size));
+          break;
+        case am::TRAFFIC_UDP:
+          sent = am.SendPacketUDP(packet, record.size);
+          break;
+        case am::TRAFFIC_RELIABLE_UDP:
+          sent = am.SendPacketReliableUDP(packet, record.size);
+          break;
+        default:
+          continue;
+      }
+      if (!sent) {
+        failed++;
+        continue;
+      }
+      bytes += record.size;
+      if (++packets % FAST_BATCH == 0 && g_fast) {
+        am.BlockUntilQueuesAreEmpty();
+      }
+    }
+  }
+  am.BlockUntilQueuesAreEmpty();
+
+  double seconds = (microsec_clock::universal_time() - start)
+    .total_microseconds() / 1e6;
+  printf("Replayed %ld packets (%lld bytes) in %.3f s", packets, bytes,
+      seconds);
+  if (seconds > 0) printf(", %.0f packets/s", packets / seconds);
+  printf("\n");
+  if (failed) printf("Failed to send %ld packets\n", failed);
+  return failed ? 1 : 0;
+}
+
+void ProcessArguments(int argc, const char* argv[])
+{
+  try {
+    for (int i = 1; i < argc; ++i) {
+      if (!strcmp(argv[i], "-h") || !strcmp(argv[i], "--help")) {
+        goto print_usage;
+      } else if (!strcmp(argv[i], "-f") || !strcmp(argv[i], "--fast")) {
+        g_fast = true;
+      } else if (i + 1 == argc) {
+        if (argv[i][0] == '-') {
+          printf("Missing value or traffic log after %s\n", argv[i]);
+          goto print_usage;
+        }
+        g_log_path = argv[i];
+      } else if (!strcmp(argv[i], "-i") || !strcmp(argv[i], "--ip")) {
+        g_host_address = argv[++i];
+      } else if (!strcmp(argv[i], "-t") || !strcmp(argv[i], "--tcp-port")) {
+        g_tcp_port = boost::lexical_cast<long>(argv[++i]);
+      } else if (!strcmp(argv[i], "-u") || !strcmp(argv[i], "--udp-port")) {
+        g_udp_port = boost::lexical_cast<long>(argv[++i]);
+      } else if (!strcmp(argv[i], "-s") || !strcmp(argv[i], "--speed")) {
+        g_speed = boost::lexical_cast<double>(argv[++i]);
+      } else if (!strcmp(argv[i], "-l") || !strcmp(argv[i], "--loop")) {
+        g_loops = boost::lexical_cast<long>(argv[++i]);
+      } else {
+        printf("Unrecognized option: %s\n", argv[i]);
+        goto print_usage;
+      }
+    }
+  } catch (boost::bad_lexical_cast&) {
+    printf("Bad argument.\n");
+    goto print_usage;
+  }
+  if (g_log_path.empty() || g_speed <= 0) goto print_usage;
+  return;
+
+print_usage:
+  printf("Usage: am_replay [ options ] traffic_log");
+  printf("\nOptions:");
+  printf("\n  -h,--help                "
+      "Display this information.");
+  printf("\n  -i,--ip <ip>             "
+      "Set Asset Manager's host address. Default = 127.0.0.1");
+  printf("\n  -t,--tcp-port <port>     "
+      "Set Asset Manager's TCP port. Default = 15002");
+  printf("\n  -u,--udp-port <port>     "
+      "Set Asset Manager's UDP port. Default = 15003");
+  printf("\n  -f,--fast                "
+      "Send as fast as possible instead of at the recorded pace.");
+  printf("\n  -s,--speed <factor>      "
+      "Speed up (> 1) or slow down (< 1) the recorded pace. Default = 1");
+  printf("\n  -l,--loop <count>        "
+      "Replay the log this many times. Default = 1");
+  printf("\n");
+  exit(0);
+}
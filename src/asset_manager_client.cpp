@@ -19,6 +19,7 @@
 // THE SOFTWARE.
 #include "asset_manager_client.hpp"
 
+#include <algorithm>
 #include <vector>
 #include <iterator>
 #include <iostream>
@@ -29,11 +30,14 @@
 #include <boost/shared_ptr.hpp>
 
 #include "tnyosc.hpp"
+#include "address_table.hpp"
+#include "message_buffer.hpp"
+#include "osc_packer.hpp"
+#include "reliable_udp.hpp"
 #include "tcp_client.hpp"
+#include "traffic_log.hpp"
 #include "udp_client.hpp"
 
-#include "oscpack.h"
-
 namespace asio = boost::asio;
 using namespace am;
 
@@ -43,156 +47,635 @@ AssetManagerClient::AssetManagerClient(const std::string& base_address,
     long tcp_port,
     long udp_port)
 : base_address_(base_address)
+, project_(this, base_address)
+, options_(0)
+, addresses_(new AddressTable())
+, start_bundle_(false)
+, udp_bundle_(NULL)
+, recorder_(NULL)
+{
+  Init(std::vector<std::string>(1, host), tcp_port, udp_port);
+}
+
+AssetManagerClient::AssetManagerClient(const std::string& base_address,
+    const std::vector<std::string>& hosts,
+    long tcp_port,
+    long udp_port)
+: base_address_(base_address)
+, project_(this, base_address)
 , options_(0)
+, addresses_(new AddressTable())
 , start_bundle_(false)
+, udp_bundle_(NULL)
+, recorder_(NULL)
 {
-  tcp_client_ = new TCPClient(host, tcp_port);
-  udp_client_ = new UDPClient(host, udp_port);
+  Init(hosts, tcp_port, udp_port);
+}
+
+void AssetManagerClient::Init(const std::vector<std::string>& hosts,
+    long tcp_port, long udp_port)
+{
+  pool_ = new MessageBufferPool(MAX_MESSAGE_SIZE, MAX_TCP_MESSAGE_SIZE);
+  tcp_client_ = new TCPClient(hosts, tcp_port);
+  udp_client_ = new UDPClient(hosts, udp_port);
+  // UDP messages held by a barrier are released as TCP writes complete
+  tcp_client_->SetWrittenHandler(
+      boost::bind(&UDPClient::Release, udp_client_, _1));
 }
 
 AssetManagerClient::~AssetManagerClient()
 {
   delete tcp_client_;
   delete udp_client_;
+  // release the open bundle, if any, before the pool goes away
+  if (udp_bundle_) intrusive_ptr_release(udp_bundle_);
+  delete pool_;
+  delete addresses_;
+  delete recorder_;
+}
+
+void AssetManagerClient::SetMemoryLimit(std::size_t bytes)
+{
+  pool_->SetMemoryLimit(bytes);
+}
+
+AssetManagerClient::MemoryStatistics
+AssetManagerClient::GetMemoryStatistics() const
+{
+  MessageBufferPool::Statistics pool_stats = pool_->GetStatistics();
+  MemoryStatistics stats;
+  stats.slot_size = pool_stats.slot_size;
+  stats.large_slot_size = pool_stats.large_slot_size;
+  stats.slots_total = pool_stats.slots_total;
+  stats.slots_in_use = pool_stats.slots_in_use;
+  stats.peak_slots_in_use = pool_stats.peak_slots_in_use;
+  stats.bytes_reserved = pool_stats.bytes_reserved;
+  stats.memory_limit = pool_stats.memory_limit;
+  stats.dropped_messages = pool_stats.failed_allocations;
+  return stats;
+}
+
+bool AssetManagerClient::StartRecording(const std::string& path)
+{
+  StopRecording();
+  TrafficRecorder* recorder = new TrafficRecorder();
+  if (!recorder->Open(path)) {
+    delete recorder;
+    return false;
+  }
+  recorder_ = recorder;
+  return true;
+}
+
+void AssetManagerClient::StopRecording()
+{
+  delete recorder_;
+  recorder_ = NULL;
+}
+
+std::vector<AssetManagerClient::DestinationStatistics>
+AssetManagerClient::GetDestinationStatistics() const
+{
+  std::vector<DestinationStatistics> destinations;
+  for (std::size_t i = 0; i < udp_client_->host_count(); ++i) {
+    TCPClient::Statistics tcp_stats = tcp_client_->GetStatistics(i);
+    UDPClient::Statistics udp_stats = udp_client_->GetStatistics(i);
+    DestinationStatistics stats;
+    stats.host = udp_client_->host(i);
+    stats.resolved = udp_stats.resolved;
+    stats.tcp_connected = tcp_stats.connected;
+    stats.tcp_messages_sent = tcp_stats.messages_sent;
+    stats.tcp_bytes_sent = tcp_stats.bytes_sent;
+    stats.tcp_errors = tcp_stats.errors;
+    stats.udp_packets_sent = udp_stats.messages_sent;
+    stats.udp_bytes_sent = udp_stats.bytes_sent;
+    stats.udp_errors = udp_stats.errors;
+    stats.reliable_sent = udp_stats.reliable_sent;
+    stats.reliable_acked = udp_stats.reliable_acked;
+    stats.retransmissions = udp_stats.retransmissions;
+    stats.reliable_failed = udp_stats.reliable_failed;
+    destinations.push_back(stats);
+  }
+  return destinations;
+}
+
+AssetManagerClient::QueueStatistics
+AssetManagerClient::GetQueueStatistics(Priority priority) const
+{
+  QueueStatistics stats;
+  stats.tcp_queued = 0;
+  stats.tcp_peak_queued = 0;
+  stats.tcp_sent = 0;
+  for (std::size_t i = 0; i < tcp_client_->host_count(); ++i) {
+    const am::QueueStatistics& queue =
+      tcp_client_->GetStatistics(i).queues[priority];
+    stats.tcp_queued = std::max(stats.tcp_queued, queue.queued);
+    stats.tcp_peak_queued = std::max(stats.tcp_peak_queued,
+        queue.peak_queued);
+    stats.tcp_sent += queue.sent;
+  }
+  am::QueueStatistics udp_queue = udp_client_->GetQueueStatistics(priority);
+  stats.udp_queued = udp_queue.queued;
+  stats.udp_peak_queued = udp_queue.peak_queued;
+  stats.udp_sent = udp_queue.sent;
+  return stats;
+}
+
+void AssetManagerClient::SetMulticastOptions(const MulticastOptions& options)
+{
+  udp_client_->SetMulticastOptions(options.ttl, options.loopback,
+      options.interface_address);
+}
+
+void AssetManagerClient::SetUDPBatching(unsigned int latency_budget_us)
+{
+  udp_client_->SetBatching(pool_, latency_budget_us, MAX_MESSAGE_SIZE);
+}
+
+void AssetManagerClient::SetTCPThreadOptions(const ThreadOptions& options)
+{
+  tcp_client_->SetThreadOptions(options);
+}
+
+void AssetManagerClient::SetUDPThreadOptions(const ThreadOptions& options)
+{
+  udp_client_->SetThreadOptions(options);
 }
 
 void AssetManagerClient::SetOption(Option option)
 {
-  options_ ^= option;
+  // The original options still toggle. The later ones are only ever added,
+  // so setting one again neither clears it nor rebuilds the UDP backend.
+  const int toggled = CORE_USE_UDP | ARRAY_USE_OSC_ARRAY;
+  int added = option & ~toggled & ~options_;
+  options_ ^= option & toggled;
+  options_ |= added;
+  if (added & (UDP_USE_IO_URING | IO_URING_SQPOLL)) {
+    udp_client_->SetIoUring((options_ & UDP_USE_IO_URING) != 0,
+        (options_ & IO_URING_SQPOLL) != 0);
+  }
+  if (added & UDP_INLINE) {
+    udp_client_->SetInline(true);
+  }
 }
 
 void AssetManagerClient::SetSystemMute(bool mute)
 {
-  tnyosc::Message msg("/AM/Mute");
+  tnyosc::MessageBuilder msg("/AM/Mute");
   msg.append(mute ? 1 : 0);
-  SendCoreMessage(msg.byte_array());
+  SendCoreMessage(msg);
 }
 
 void AssetManagerClient::SetSystemVolume(float volume)
 {
   if (0.0f <= volume && volume <= 1.0f) {
-    tnyosc::Message msg("/AM/Volume");
+    tnyosc::MessageBuilder msg("/AM/Volume");
     msg.append(20*log10(volume));
-    SendCoreMessage(msg.byte_array());
+    SendCoreMessage(msg);
   }
 }
 
 void AssetManagerClient::Load()
 {
-  tnyosc::Message msg("/AM/Load");
-  msg.append(base_address_);
-  SendCoreMessage(msg.byte_array());
+  project_.Load();
 }
 
 void AssetManagerClient::Unload()
 {
-  tnyosc::Message msg("/AM/Unload");
-  msg.append(base_address_);
-  SendCoreMessage(msg.byte_array());
+  project_.Unload();
 }
 
-
 void AssetManagerClient::SetMute(bool mute)
 {
-  tnyosc::Message msg("/AM/Project/Mute");
-  msg.append(base_address_);
-  msg.append(mute ? 1 : 0);
-  SendCoreMessage(msg.byte_array());
+  project_.SetMute(mute);
 }
 
 void AssetManagerClient::SetVolume(float volume)
 {
-  if (0.0f <= volume && volume <= 1.0f) {
-    tnyosc::Message msg("/AM/Project/Volume");
-    msg.append(base_address_);
-    msg.append(20*log10(volume));
-    SendCoreMessage(msg.byte_array());
-  }
+  project_.SetVolume(volume);
 }
 
-void AssetManagerClient::SendCoreMessage(const std::vector<char>& msg)
+void AssetManagerClient::SendCoreMessage(const tnyosc::MessageBuilder& msg)
 {
-  if (options_ & CORE_USE_UDP) {
-    if (start_bundle_)
-      AppendBundle(udp_bundle_, msg);
-    else
-      udp_client_->Send(msg);
+  PacketEncoder encoder(msg.data(), msg.size());
+  if (options_ & CORE_USE_RELIABLE_UDP) {
+    SendReliableUDP(encoder, PRIORITY_URGENT);
+  } else if (options_ & CORE_USE_UDP) {
+    SendUDP(encoder, PRIORITY_URGENT);
   } else {
-    tcp_client_->Send(msg);
+    SendTCP(encoder, PRIORITY_URGENT);
   }
 }
 
+void AssetManagerClient::SentTCP()
+{
+  if (options_ & ORDERED) OrderingBarrier();
+}
+
+void AssetManagerClient::OrderingBarrier()
+{
+  udp_client_->SetBarrier(tcp_client_->last_sequence());
+}
+
 void AssetManagerClient::SendCustomTCP(const std::string& url,
     const char* format, ...)
 {
-  std::vector<char> buf(MAX_MESSAGE_SIZE);
-  std::string address(base_address_);
-  address.append(url);
   va_list ap;
   va_start(ap, format);
-  int32_t size = voscpack((uint8_t*)&buf[0], address.c_str(), format, ap);
+  SendFormatted(&AssetManagerClient::SendTCP, base_address_, url, format, ap);
   va_end(ap);
-  if (size > 0) {
-    buf.resize(size);
-    tcp_client_->Send(buf);
-  }
 }
 
 void AssetManagerClient::SendCustomUDP(const std::string& url,
     const char* format, ...)
 {
-  std::vector<char> buf(MAX_MESSAGE_SIZE);
-  std::string address(base_address_);
-  address.append(url);
   va_list ap;
   va_start(ap, format);
-  int32_t size = voscpack((uint8_t*)&buf[0], address.c_str(), format, ap);
+  SendFormatted(&AssetManagerClient::SendUDP, base_address_, url, format, ap);
   va_end(ap);
-  if (size > 0) {
-    buf.resize(size);
-    if (start_bundle_)
-      AppendBundle(udp_bundle_, buf);
-    else
-      udp_client_->Send(buf);
+}
+
+void AssetManagerClient::SendCustomUrgentTCP(const std::string& url,
+    const char* format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  SendFormatted(&AssetManagerClient::SendTCP, base_address_, url,
+      format, ap, PRIORITY_URGENT);
+  va_end(ap);
+}
+
+void AssetManagerClient::SendCustomUrgentUDP(const std::string& url,
+    const char* format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  SendFormatted(&AssetManagerClient::SendUDP, base_address_, url,
+      format, ap, PRIORITY_URGENT);
+  va_end(ap);
+}
+
+AddressHandle AssetManagerClient::InternAddress(const std::string& url)
+{
+  return project_.InternAddress(url);
+}
+
+void AssetManagerClient::SendCustomTCP(const AddressHandle& address,
+    const char* format, ...)
+{
+  PaddedAddress padded;
+  if (!addresses_->Lookup(address.index_, &padded)) return;
+  va_list ap;
+  va_start(ap, format);
+  FormatEncoder encoder(padded, format, ap);
+  SendTCP(encoder);
+  va_end(ap);
+}
+
+void AssetManagerClient::SendCustomUDP(const AddressHandle& address,
+    const char* format, ...)
+{
+  PaddedAddress padded;
+  if (!addresses_->Lookup(address.index_, &padded)) return;
+  va_list ap;
+  va_start(ap, format);
+  FormatEncoder encoder(padded, format, ap);
+  SendUDP(encoder);
+  va_end(ap);
+}
+
+void AssetManagerClient::SendCustomReliableUDP(const std::string& url,
+    const char* format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  SendFormatted(&AssetManagerClient::SendReliableUDP, base_address_, url,
+      format, ap);
+  va_end(ap);
+}
+
+void AssetManagerClient::SendCustomReliableUDP(const AddressHandle& address,
+    const char* format, ...)
+{
+  PaddedAddress padded;
+  if (!addresses_->Lookup(address.index_, &padded)) return;
+  va_list ap;
+  va_start(ap, format);
+  FormatEncoder encoder(padded, format, ap);
+  SendReliableUDP(encoder);
+  va_end(ap);
+}
+
+bool AssetManagerClient::SendPacketTCP(const char* data, std::size_t size)
+{
+  PacketEncoder encoder(data, size);
+  return SendTCP(encoder);
+}
+
+bool AssetManagerClient::SendPacketUDP(const char* data, std::size_t size)
+{
+  PacketEncoder encoder(data, size);
+  return SendUDP(encoder);
+}
+
+bool AssetManagerClient::SendPacketTCP(const Blob& packet)
+{
+  PacketEncoder encoder(GetBlobData(packet));
+  return SendTCP(encoder);
+}
+
+bool AssetManagerClient::SendPacketUDP(const Blob& packet)
+{
+  PacketEncoder encoder(GetBlobData(packet));
+  return SendUDP(encoder);
+}
+
+bool AssetManagerClient::SendMessageTCP(const tnyosc::Message& message)
+{
+  return SendPacketTCP(message.data(), message.size());
+}
+
+bool AssetManagerClient::SendMessageUDP(const tnyosc::Message& message)
+{
+  return SendPacketUDP(message.data(), message.size());
+}
+
+bool AssetManagerClient::SendMessageTCP(const tnyosc::MessageBuilder& message)
+{
+  return SendPacketTCP(message.data(), message.size());
+}
+
+bool AssetManagerClient::SendMessageUDP(const tnyosc::MessageBuilder& message)
+{
+  return SendPacketUDP(message.data(), message.size());
+}
+
+bool AssetManagerClient::SendBundleTCP(const tnyosc::Bundle& bundle)
+{
+  return SendPacketTCP(bundle.data(), bundle.size());
+}
+
+bool AssetManagerClient::SendBundleUDP(const tnyosc::Bundle& bundle)
+{
+  return SendPacketUDP(bundle.data(), bundle.size());
+}
+
+#if __cplusplus >= 201103L
+namespace {
+
+void DeletePacket(void* packet)
+{
+  delete static_cast<std::vector<char>*>(packet);
+}
+
+// Moves the bytes of @a packet to the heap and wraps them in a blob that
+// deletes them once sent.
+Blob AdoptPacket(std::vector<char>& packet)
+{
+  std::vector<char>* bytes = new std::vector<char>;
+  bytes->swap(packet);
+  return Blob(bytes->data(), bytes->size(), DeletePacket, bytes);
+}
+
+} // namespace
+
+bool AssetManagerClient::SendPacketTCP(std::vector<char>&& packet)
+{
+  return SendPacketTCP(AdoptPacket(packet));
+}
+
+bool AssetManagerClient::SendPacketUDP(std::vector<char>&& packet)
+{
+  return SendPacketUDP(AdoptPacket(packet));
+}
+
+bool AssetManagerClient::SendBundleTCP(tnyosc::Bundle&& bundle)
+{
+  std::vector<char> packet;
+  bundle.swap(packet);
+  return SendPacketTCP(AdoptPacket(packet));
+}
+
+bool AssetManagerClient::SendBundleUDP(tnyosc::Bundle&& bundle)
+{
+  std::vector<char> packet;
+  bundle.swap(packet);
+  return SendPacketUDP(AdoptPacket(packet));
+}
+#endif
+
+bool AssetManagerClient::SendPacketReliableUDP(const char* data,
+    std::size_t size)
+{
+  PacketEncoder encoder(data, size);
+  return SendReliableUDP(encoder);
+}
+
+void AssetManagerClient::SendFloatArrayTCP(const std::string& url,
+    const float* values, std::size_t count)
+{
+  std::string address(base_address_);
+  address.append(url);
+  ArrayEncoder encoder(address.c_str(), 'f', values, count,
+      (options_ & ARRAY_USE_OSC_ARRAY) != 0);
+  SendTCP(encoder);
+}
+
+void AssetManagerClient::SendFloatArrayUDP(const std::string& url,
+    const float* values, std::size_t count)
+{
+  std::string address(base_address_);
+  address.append(url);
+  ArrayEncoder encoder(address.c_str(), 'f', values, count,
+      (options_ & ARRAY_USE_OSC_ARRAY) != 0);
+  SendUDP(encoder);
+}
+
+void AssetManagerClient::SendIntArrayTCP(const std::string& url,
+    const int* values, std::size_t count)
+{
+  std::string address(base_address_);
+  address.append(url);
+  ArrayEncoder encoder(address.c_str(), 'i', values, count,
+      (options_ & ARRAY_USE_OSC_ARRAY) != 0);
+  SendTCP(encoder);
+}
+
+void AssetManagerClient::SendIntArrayUDP(const std::string& url,
+    const int* values, std::size_t count)
+{
+  std::string address(base_address_);
+  address.append(url);
+  ArrayEncoder encoder(address.c_str(), 'i', values, count,
+      (options_ & ARRAY_USE_OSC_ARRAY) != 0);
+  SendUDP(encoder);
+}
+
+void AssetManagerClient::SendObjectsUDP(const std::string& url,
+    const int* ids, const float* x, const float* y, const float* z,
+    std::size_t count, const float* gains)
+{
+  SendObjects(base_address_ + url + "/", ids, x, y, z, count, gains);
+}
+
+void AssetManagerClient::SendFormatted(SendFunction send,
+    const std::string& base_address, const std::string& url,
+    const char* format, va_list ap, Priority priority)
+{
+  std::string address(base_address);
+  address.append(url);
+  FormatEncoder encoder(address.c_str(), format, ap);
+  (this->*send)(encoder, priority);
+}
+
+void AssetManagerClient::SendObjects(const std::string& prefix,
+    const int* ids, const float* x, const float* y, const float* z,
+    std::size_t count, const float* gains)
+{
+  ObjectEncoder position(prefix.data(), prefix.size(), "/pos");
+  ObjectEncoder gain(prefix.data(), prefix.size(), "/gain");
+
+  ImplicitBundle bundle(this);
+  for (std::size_t i = 0; i < count; ++i) {
+    float xyz[3] = { x[i], y[i], z[i] };
+    position.set_object(ids[i], xyz, 3);
+    bundle.Send(position);
+    if (gains) {
+      gain.set_object(ids[i], &gains[i], 1);
+      bundle.Send(gain);
+    }
+  }
+}
+
+AddressHandle AssetManagerClient::Intern(const std::string& address)
+{
+  return AddressHandle(addresses_->Intern(address));
+}
+
+bool AssetManagerClient::SendTCP(MessageEncoder& encoder, Priority priority)
+{
+  MessageBufferPtr buf = pool_->Acquire();
+  if (!buf) return false;
+  int32_t size = encoder.Encode(*buf, MAX_TCP_FRAME_SIZE);
+  if (size == 0) {
+    // TCP is not limited to a datagram; retry with a large buffer
+    buf = pool_->AcquireLarge();
+    if (!buf) return false;
+    size = encoder.Encode(*buf, MAX_TCP_FRAME_SIZE);
+  }
+  if (size <= 0) return false;
+  if (recorder_) recorder_->Record(TRAFFIC_TCP, *buf);
+  buf->set_priority(priority);
+  tcp_client_->Send(buf);
+  SentTCP();
+  return true;
+}
+
+bool AssetManagerClient::SendUDP(MessageEncoder& encoder, Priority priority)
+{
+  // Urgent messages do not wait for the bundle to be sent
+  if (priority == PRIORITY_BULK && start_bundle_ && NewBundle()) {
+    // Encode straight into the bundle. If the bundle is full, send it and
+    // retry with an empty one before falling back to a standalone message.
+    int32_t size = PackBundleElement(encoder);
+    if (size == 0 && udp_bundle_->total_size() > 16) {
+      FlushBundle();
+      if (NewBundle()) size = PackBundleElement(encoder);
+    }
+    if (size > 0) return true;
+    if (size < 0) return false;
   }
+  MessageBufferPtr buf = pool_->Acquire();
+  if (!buf) return false;
+  int32_t size = encoder.Encode(*buf, MAX_MESSAGE_SIZE);
+  if (size <= 0) return false;
+  if (recorder_) recorder_->Record(TRAFFIC_UDP, *buf);
+  buf->set_priority(priority);
+  udp_client_->Send(buf);
+  return true;
+}
+
+bool AssetManagerClient::SendReliableUDP(MessageEncoder& encoder,
+    Priority priority)
+{
+  // The header is written in front of the message by UDPClient
+  MessageBufferPtr buf = pool_->Acquire();
+  if (!buf || !buf->Append(RELIABLE_HEADER_SIZE)) return false;
+  int32_t size = encoder.Encode(*buf, MAX_MESSAGE_SIZE - RELIABLE_HEADER_SIZE);
+  if (size <= 0) return false;
+  if (recorder_) {
+    recorder_->Record(TRAFFIC_RELIABLE_UDP, *buf, RELIABLE_HEADER_SIZE);
+  }
+  buf->set_priority(priority);
+  udp_client_->SendReliable(buf);
+  return true;
 }
 
 void AssetManagerClient::StartBundle()
 {
   if (start_bundle_) EndBundle();
-  NewBundle(udp_bundle_);
   start_bundle_ = true;
 }
 
 void AssetManagerClient::EndBundle()
 {
-  if (udp_bundle_.size() > 16) {
-    udp_client_->Send(udp_bundle_);
-    udp_bundle_.clear();
-  }
+  FlushBundle();
   start_bundle_ = false;
 }
 
-void AssetManagerClient::NewBundle(std::vector<char>& bundle)
+AssetManagerClient::ImplicitBundle::ImplicitBundle(AssetManagerClient* client)
+: client_(client)
+, bundling_(client->start_bundle_)
 {
-  static std::string id = "#bundle";
-  bundle.resize(16);
-  std::copy(id.begin(), id.end(), bundle.begin());
-  bundle[15] = 1;
+  client_->start_bundle_ = true;
 }
 
-void AssetManagerClient::AppendBundle(std::vector<char>& bundle,
-    const std::vector<char>& message)
+AssetManagerClient::ImplicitBundle::~ImplicitBundle()
 {
-  if (bundle.size() + message.size() > MAX_MESSAGE_SIZE) {
-    udp_client_->Send(bundle);
-    NewBundle(bundle);
-  }
-  if (message.size()) {
-    int32_t a = htonl(message.size());
-    bundle.insert(bundle.end(), (char*)&a, (char*)&a+4);
-    bundle.insert(bundle.end(), message.begin(), message.end());
+  if (!bundling_) client_->EndBundle();
+}
+
+bool AssetManagerClient::NewBundle()
+{
+  if (udp_bundle_) return true;
+
+  // The bundle buffer is acquired lazily and may be refused by the memory cap
+  MessageBufferPtr bundle = pool_->Acquire();
+  if (!bundle) return false;
+  // The writer only starts the bundle: PackBundleElement encodes elements in
+  // place, and their size counts spliced blobs that are not in the buffer
+  tnyosc::BundleWriter writer(bundle->data(), bundle->capacity());
+  bundle->Resize(writer.size());
+  udp_bundle_ = bundle.detach();
+  return true;
+}
+
+void AssetManagerClient::FlushBundle()
+{
+  if (!udp_bundle_) return;
+  // hand the bundle over to the UDP client; an empty bundle is not sent
+  MessageBufferPtr bundle(udp_bundle_, false);
+  udp_bundle_ = NULL;
+  if (bundle->size() <= 16) return;
+  if (recorder_) recorder_->Record(TRAFFIC_UDP, *bundle);
+  udp_client_->Send(bundle);
+}
+
+int AssetManagerClient::PackBundleElement(MessageEncoder& encoder)
+{
+  // The datagram limit applies to the bundle including its blobs
+  std::size_t used = udp_bundle_->total_size() + 4;
+  if (used >= MAX_MESSAGE_SIZE) return 0;
+  std::size_t offset = udp_bundle_->size();
+  if (!udp_bundle_->Append(4)) return 0;
+  int32_t size = encoder.Encode(*udp_bundle_, MAX_MESSAGE_SIZE - used);
+  if (size > 0) {
+    int32_t a = htonl(size);
+    memcpy(udp_bundle_->data() + offset, &a, 4);
+  } else {
+    udp_bundle_->Resize(offset);
   }
+  return size;
 }
 
 void AssetManagerClient::BlockUntilQueuesAreEmpty()
@@ -201,3 +684,117 @@ void AssetManagerClient::BlockUntilQueuesAreEmpty()
   udp_client_->BlockUntilQueueIsEmpty();
 }
 
+void AssetManagerClient::AsyncFlush(AsyncOperation* operation)
+{
+  // The TCP queue first, then whatever the UDP queue holds by then
+  operation->client_ = this;
+  Completion done = { &AssetManagerClient::FlushedTCP, operation };
+  tcp_client_->AsyncFlush(done);
+}
+
+void AssetManagerClient::AsyncWaitConnected(AsyncOperation* operation)
+{
+  Completion done = { &AssetManagerClient::Completed, operation };
+  tcp_client_->AsyncWaitConnected(done);
+}
+
+void AssetManagerClient::FlushedTCP(void* operation, bool)
+{
+  AsyncOperation* op = static_cast<AsyncOperation*>(operation);
+  Completion done = { &AssetManagerClient::Completed, operation };
+  op->client_->udp_client_->AsyncFlush(done);
+}
+
+void AssetManagerClient::Completed(void* operation, bool success)
+{
+  // The operation may be reused or destroyed by its completion function
+  AsyncOperation* op = static_cast<AsyncOperation*>(operation);
+  op->success_ = success;
+  op->function_(op, op->context_);
+}
+
+//-----------------------------------------------------------------------------
+Project AssetManagerClient::OpenProject(const std::string& base_address)
+{
+  return Project(this, base_address);
+}
+
+void Project::Load()
+{
+  if (!client_) return;
+  tnyosc::MessageBuilder msg("/AM/Load");
+  msg.append(base_address_);
+  client_->SendCoreMessage(msg);
+}
+
+void Project::Unload()
+{
+  if (!client_) return;
+  tnyosc::MessageBuilder msg("/AM/Unload");
+  msg.append(base_address_);
+  client_->SendCoreMessage(msg);
+}
+
+void Project::SetMute(bool mute)
+{
+  if (!client_) return;
+  tnyosc::MessageBuilder msg("/AM/Project/Mute");
+  msg.append(base_address_);
+  msg.append(mute ? 1 : 0);
+  client_->SendCoreMessage(msg);
+}
+
+void Project::SetVolume(float volume)
+{
+  if (client_ && 0.0f <= volume && volume <= 1.0f) {
+    tnyosc::MessageBuilder msg("/AM/Project/Volume");
+    msg.append(base_address_);
+    msg.append(20*log10(volume));
+    client_->SendCoreMessage(msg);
+  }
+}
+
+void Project::SendCustomTCP(const std::string& url, const char* format, ...)
+{
+  if (!client_) return;
+  va_list ap;
+  va_start(ap, format);
+  client_->SendFormatted(&AssetManagerClient::SendTCP, base_address_, url,
+      format, ap);
+  va_end(ap);
+}
+
+void Project::SendCustomUDP(const std::string& url, const char* format, ...)
+{
+  if (!client_) return;
+  va_list ap;
+  va_start(ap, format);
+  client_->SendFormatted(&AssetManagerClient::SendUDP, base_address_, url,
+      format, ap);
+  va_end(ap);
+}
+
+void Project::SendCustomReliableUDP(const std::string& url,
+    const char* format, ...)
+{
+  if (!client_) return;
+  va_list ap;
+  va_start(ap, format);
+  client_->SendFormatted(&AssetManagerClient::SendReliableUDP, base_address_,
+      url, format, ap);
+  va_end(ap);
+}
+
+void Project::SendObjectsUDP(const std::string& url, const int* ids,
+    const float* x, const float* y, const float* z, std::size_t count,
+    const float* gains)
+{
+  if (!client_) return;
+  client_->SendObjects(base_address_ + url + "/", ids, x, y, z, count, gains);
+}
+
+AddressHandle Project::InternAddress(const std::string& url)
+{
+  if (!client_) return AddressHandle();
+  return client_->Intern(base_address_ + url);
+}
@@ -0,0 +1,195 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "byte_swap.hpp"
+
+#include <cstring>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <boost/cstdint.hpp> // uint32_t for Windows
+using boost::uint32_t;
+#else
+#include <arpa/inet.h>
+#include <stdint.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64)
+#define AM_HAVE_SSE2 1
+#include <emmintrin.h>
+#endif
+
+// The AVX2 kernel is compiled with a target attribute and selected at run time
+// so the library still runs on CPUs without AVX2.
+#if defined(AM_HAVE_SSE2) && defined(__GNUC__) && \
+  (defined(__x86_64__) || defined(__i386__))
+#define AM_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#define AM_HAVE_NEON 1
+#include <arm_neon.h>
+#endif
+
+using namespace am;
+
+namespace {
+
+typedef void (*SwapKernel)(char* dst, const char* src, std::size_t count);
+
+void SwapScalar(char* dst, const char* src, std::size_t count)
+{
+  for (std::size_t i = 0; i < count; ++i) {
+    uint32_t v;
+    memcpy(&v, src + 4 * i, 4);
+    v = htonl(v);
+    memcpy(dst + 4 * i, &v, 4);
+  }
+}
+
+bool IsBigEndianHost()
+{
+  const uint32_t one = 1;
+  return *(const char*)&one == 0;
+}
+
+void CopyNoSwap(char* dst, const char* src, std::size_t count)
+{
+  memcpy(dst, src, 4 * count);
+}
+
+#if defined(AM_HAVE_SSE2)
+inline __m128i Swap128(__m128i v)
+{
+  // swap the 16-bit halves of each word, then the bytes of each half
+  v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, 0xB1), 0xB1);
+  return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+
+void SwapSSE2(char* dst, const char* src, std::size_t count)
+{
+  std::size_t i = 0;
+  for (; i + 8 <= count; i += 8) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(src + 4 * i));
+    __m128i b = _mm_loadu_si128((const __m128i*)(src + 4 * i + 16));
+    _mm_storeu_si128((__m128i*)(dst + 4 * i), Swap128(a));
+    _mm_storeu_si128((__m128i*)(dst + 4 * i + 16), Swap128(b));
+  }
+  for (; i + 4 <= count; i += 4) {
+    __m128i a = _mm_loadu_si128((const __m128i*)(src + 4 * i));
+    _mm_storeu_si128((__m128i*)(dst + 4 * i), Swap128(a));
+  }
+  SwapScalar(dst + 4 * i, src + 4 * i, count - i);
+}
+#endif
+
+#if defined(AM_HAVE_AVX2)
+__attribute__((target("avx2")))
+void SwapAVX2(char* dst, const char* src, std::size_t count)
+{
+  const __m256i mask = _mm256_setr_epi8(
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+      3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+  std::size_t i = 0;
+  for (; i + 16 <= count; i += 16) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(src + 4 * i));
+    __m256i b = _mm256_loadu_si256((const __m256i*)(src + 4 * i + 32));
+    _mm256_storeu_si256((__m256i*)(dst + 4 * i), _mm256_shuffle_epi8(a, mask));
+    _mm256_storeu_si256((__m256i*)(dst + 4 * i + 32),
+        _mm256_shuffle_epi8(b, mask));
+  }
+  for (; i + 8 <= count; i += 8) {
+    __m256i a = _mm256_loadu_si256((const __m256i*)(src + 4 * i));
+    _mm256_storeu_si256((__m256i*)(dst + 4 * i), _mm256_shuffle_epi8(a, mask));
+  }
+  SwapSSE2(dst + 4 * i, src + 4 * i, count - i);
+}
+#endif
+
+#if defined(AM_HAVE_NEON)
+void SwapNEON(char* dst, const char* src, std::size_t count)
+{
+  std::size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    uint8x16_t v = vld1q_u8((const uint8_t*)(src + 4 * i));
+    vst1q_u8((uint8_t*)(dst + 4 * i), vrev32q_u8(v));
+  }
+  SwapScalar(dst + 4 * i, src + 4 * i, count - i);
+}
+#endif
+
+struct Kernel {
+  SwapKernel function;
+  const char* name;
+};
+
+Kernel SelectKernel()
+{
+  Kernel kernel = { SwapScalar, "scalar" };
+  if (IsBigEndianHost()) {
+    kernel.function = CopyNoSwap;
+    kernel.name = "memcpy";
+    return kernel;
+  }
+#if defined(AM_HAVE_SSE2)
+  kernel.function = SwapSSE2;
+  kernel.name = "sse2";
+#endif
+#if defined(AM_HAVE_AVX2)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    kernel.function = SwapAVX2;
+    kernel.name = "avx2";
+  }
+#endif
+#if defined(AM_HAVE_NEON)
+  kernel.function = SwapNEON;
+  kernel.name = "neon";
+#endif
+  return kernel;
+}
+
+const Kernel& GetKernel()
+{
+  static const Kernel kernel = SelectKernel();
+  return kernel;
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+void am::CopyToBigEndian32(void* dst, const void* src, std::size_t count)
+{
+  GetKernel().function((char*)dst, (const char*)src, count);
+}
+
+void am::CopyToBigEndian32Scalar(void* dst, const void* src, std::size_t count)
+{
+  if (IsBigEndianHost()) {
+    CopyNoSwap((char*)dst, (const char*)src, count);
+  } else {
+    SwapScalar((char*)dst, (const char*)src, count);
+  }
+}
+
+const char* am::ByteSwapKernelName()
+{
+  return GetKernel().name;
+}
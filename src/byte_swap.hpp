@@ -0,0 +1,43 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _BYTE_SWAP_HPP_
+#define _BYTE_SWAP_HPP_
+
+#include <cstddef>
+
+namespace am {
+
+/// Copy @a count 32-bit words from @a src to @a dst converting them from host
+/// to network (big-endian) byte order. Used to encode float and int32 arrays.
+/// Neither pointer needs to be aligned and the ranges must not overlap.
+///
+/// The fastest kernel available on the running CPU is selected on the first
+/// call: AVX2 or SSE2 on x86, NEON on ARM, and a scalar loop otherwise.
+void CopyToBigEndian32(void* dst, const void* src, std::size_t count);
+
+/// Scalar reference implementation of @a CopyToBigEndian32.
+void CopyToBigEndian32Scalar(void* dst, const void* src, std::size_t count);
+
+/// Name of the kernel used by @a CopyToBigEndian32, e.g. "avx2".
+const char* ByteSwapKernelName();
+
+} // namespace am
+
+#endif // _BYTE_SWAP_HPP_
@@ -0,0 +1,254 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "io_uring_sender.hpp"
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+using namespace am;
+
+namespace {
+
+// Completions polled before falling back to waiting in the kernel when the
+// submission queue is polled by a kernel thread.
+const int SQPOLL_SPINS = 4096;
+
+// Idle time in milliseconds before the submission queue thread sleeps.
+const unsigned SQPOLL_IDLE_MS = 50;
+
+template <typename T>
+T* At(void* base, unsigned offset)
+{
+  return reinterpret_cast<T*>(static_cast<char*>(base) + offset);
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+IoUringSender::IoUringSender()
+: ring_fd_(-1)
+, sqpoll_(false)
+, entries_(0)
+, sq_ring_(MAP_FAILED)
+, sq_ring_size_(0)
+, cq_ring_(MAP_FAILED)
+, cq_ring_size_(0)
+, sqes_(MAP_FAILED)
+, sqes_size_(0)
+{
+}
+
+IoUringSender::~IoUringSender()
+{
+  Close();
+}
+
+bool IoUringSender::Init(int fd, unsigned entries, bool sqpoll)
+{
+  Close();
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  if (sqpoll) {
+    params.flags = IORING_SETUP_SQPOLL;
+    params.sq_thread_idle = SQPOLL_IDLE_MS;
+  }
+  ring_fd_ = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring_fd_ < 0) return false;
+  sqpoll_ = sqpoll;
+  entries_ = params.sq_entries;
+
+  sq_ring_size_ = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  cq_ring_size_ = params.cq_off.cqes +
+    params.cq_entries * sizeof(struct io_uring_cqe);
+  bool single_mmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+  if (single_mmap && cq_ring_size_ > sq_ring_size_) {
+    sq_ring_size_ = cq_ring_size_;
+  }
+  sq_ring_ = mmap(NULL, sq_ring_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQ_RING);
+  if (sq_ring_ == MAP_FAILED) {
+    Close();
+    return false;
+  }
+  if (single_mmap) {
+    cq_ring_ = sq_ring_;
+  } else {
+    cq_ring_ = mmap(NULL, cq_ring_size_, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_CQ_RING);
+    if (cq_ring_ == MAP_FAILED) {
+      Close();
+      return false;
+    }
+  }
+  sqes_size_ = params.sq_entries * sizeof(struct io_uring_sqe);
+  sqes_ = mmap(NULL, sqes_size_, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring_fd_, IORING_OFF_SQES);
+  if (sqes_ == MAP_FAILED) {
+    Close();
+    return false;
+  }
+
+  sq_head_ = At<unsigned>(sq_ring_, params.sq_off.head);
+  sq_tail_ = At<unsigned>(sq_ring_, params.sq_off.tail);
+  sq_mask_ = At<unsigned>(sq_ring_, params.sq_off.ring_mask);
+  sq_flags_ = At<unsigned>(sq_ring_, params.sq_off.flags);
+  sq_array_ = At<unsigned>(sq_ring_, params.sq_off.array);
+  cq_head_ = At<unsigned>(cq_ring_, params.cq_off.head);
+  cq_tail_ = At<unsigned>(cq_ring_, params.cq_off.tail);
+  cq_mask_ = At<unsigned>(cq_ring_, params.cq_off.ring_mask);
+  cqes_ = At<void>(cq_ring_, params.cq_off.cqes);
+
+  // Every request refers to the socket as fixed file 0
+  if (syscall(__NR_io_uring_register, ring_fd_, IORING_REGISTER_FILES, &fd,
+        1) < 0) {
+    Close();
+    return false;
+  }
+  return true;
+}
+
+void IoUringSender::Close()
+{
+  if (sqes_ != MAP_FAILED) munmap(sqes_, sqes_size_);
+  if (cq_ring_ != MAP_FAILED && cq_ring_ != sq_ring_) {
+    munmap(cq_ring_, cq_ring_size_);
+  }
+  if (sq_ring_ != MAP_FAILED) munmap(sq_ring_, sq_ring_size_);
+  if (ring_fd_ >= 0) close(ring_fd_);
+  sqes_ = cq_ring_ = sq_ring_ = MAP_FAILED;
+  ring_fd_ = -1;
+}
+
+int IoUringSender::Enter(unsigned to_submit, unsigned min_complete,
+    unsigned flags)
+{
+  int ret;
+  do {
+    ret = (int)syscall(__NR_io_uring_enter, ring_fd_, to_submit, min_complete,
+        flags, NULL, 0);
+  } while (ret < 0 && errno == EINTR);
+  return ret;
+}
+
+void IoUringSender::Reap(struct mmsghdr* msgs, unsigned* completed,
+    unsigned* sent, int* error)
+{
+  const struct io_uring_cqe* cqes =
+    static_cast<const struct io_uring_cqe*>(cqes_);
+  unsigned head = *cq_head_;
+  unsigned cq_tail = __atomic_load_n(cq_tail_, __ATOMIC_ACQUIRE);
+  for (; head != cq_tail; ++head, ++*completed) {
+    const struct io_uring_cqe* cqe = &cqes[head & *cq_mask_];
+    unsigned i = (unsigned)cqe->user_data;
+    if (cqe->res >= 0) {
+      msgs[i].msg_len = cqe->res;
+    } else if (i < *sent) {
+      *sent = i;
+      *error = -cqe->res;
+    }
+  }
+  __atomic_store_n(cq_head_, head, __ATOMIC_RELEASE);
+}
+
+int IoUringSender::SendBatch(struct mmsghdr* msgs, unsigned count)
+{
+  if (count == 0) return 0;
+
+  // Queue one sendmsg per datagram. The requests are linked so that they run
+  // in order and a failure cancels the rest of the batch, as with sendmmsg.
+  struct io_uring_sqe* sqes = static_cast<struct io_uring_sqe*>(sqes_);
+  unsigned tail = *sq_tail_;
+  for (unsigned i = 0; i < count; ++i, ++tail) {
+    unsigned index = tail & *sq_mask_;
+    struct io_uring_sqe* sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = 0;
+    sqe->flags = IOSQE_FIXED_FILE | (i + 1 < count ? IOSQE_IO_LINK : 0);
+    sqe->addr = (unsigned long)&msgs[i].msg_hdr;
+    sqe->len = 1;
+    sqe->msg_flags = MSG_DONTWAIT;
+    sqe->user_data = i;
+    sq_array_[index] = index;
+  }
+  __atomic_store_n(sq_tail_, tail, __ATOMIC_RELEASE);
+
+  unsigned completed = 0;
+  unsigned sent = count;
+  int error = 0;
+  bool failed = false;
+  if (sqpoll_) {
+    // The kernel thread picks the requests up unless it went to sleep
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (__atomic_load_n(sq_flags_, __ATOMIC_RELAXED) & IORING_SQ_NEED_WAKEUP) {
+      failed = Enter(0, 0, IORING_ENTER_SQ_WAKEUP) < 0;
+    }
+  } else {
+    // Non-blocking sends complete during the submission
+    failed = Enter(count, count, IORING_ENTER_GETEVENTS) < 0;
+  }
+
+  int spins = 0;
+  while (!failed) {
+    Reap(msgs, &completed, &sent, &error);
+    if (completed == count) break;
+    if (!sqpoll_ || ++spins > SQPOLL_SPINS) {
+      failed = Enter(0, 1, IORING_ENTER_GETEVENTS) < 0;
+    }
+  }
+
+  if (failed) {
+    // The requests the kernel took still point at msgs and their iovecs,
+    // which belong to the caller, and at the ring; wait for them before the
+    // ring is closed. A polling thread that is awake takes the whole batch,
+    // and one that sleeps takes nothing more without a wake-up. Non-blocking
+    // sends complete quickly, and the completions are posted on the way back
+    // from a system call.
+    int ring_error = errno;
+    unsigned submitted;
+    while (true) {
+      submitted = __atomic_load_n(sq_head_, __ATOMIC_ACQUIRE) -
+        (tail - count);
+      Reap(msgs, &completed, &sent, &error);
+      if (completed >= submitted && (!sqpoll_ || submitted == count ||
+            (__atomic_load_n(sq_flags_, __ATOMIC_ACQUIRE) &
+             IORING_SQ_NEED_WAKEUP))) {
+        break;
+      }
+      usleep(100);
+    }
+    Close();
+    if (sent > submitted) sent = submitted;
+    if (error == 0) error = ring_error;
+  }
+
+  if (sent == 0) {
+    errno = error;
+    return -1;
+  }
+  if (failed) errno = error;
+  return (int)sent;
+}
@@ -0,0 +1,104 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _IO_URING_SENDER_HPP_
+#define _IO_URING_SENDER_HPP_
+
+#include <cstddef>
+
+#include <sys/socket.h>
+
+#include "disallow_copy_and_assign.hpp"
+
+namespace am {
+
+/// Sends batches of datagrams through an io_uring submission queue instead of
+/// sendmmsg. Only built on Linux with the AMCLIENT_IO_URING CMake option. The
+/// ring is driven with raw system calls so there is no dependency on
+/// liburing.
+///
+/// The socket is registered with the ring so the kernel does not look up the
+/// descriptor for every datagram. With @a sqpoll, a kernel thread polls the
+/// submission queue and a batch is usually sent without any system call; the
+/// caller spins briefly for the completions instead of sleeping in the
+/// kernel.
+class IoUringSender {
+ public:
+  IoUringSender();
+  ~IoUringSender();
+
+  /// Set up a ring for batches of up to @a entries datagrams on socket @a
+  /// fd. Returns false, leaving the sender unusable, if the kernel does not
+  /// support io_uring or refuses the setup (e.g. SQPOLL without the required
+  /// privileges).
+  bool Init(int fd, unsigned entries, bool sqpoll);
+
+  /// Tear down the ring.
+  void Close();
+
+  bool ready() const { return ring_fd_ >= 0; }
+
+  /// Same contract as sendmmsg(fd, msgs, count, MSG_DONTWAIT): datagrams
+  /// are sent in order and the call stops at the first failure. Returns the
+  /// number of datagrams sent, each with its msg_len set, or -1 with errno
+  /// set if the first datagram failed. @a count must not exceed the entries
+  /// passed to @a Init.
+  ///
+  /// If the ring itself fails, the call first waits for the completions of
+  /// the requests the kernel already took, which refer to @a msgs, then
+  /// closes the ring and @a ready returns false afterwards. The return value
+  /// still counts exactly the datagrams sent: the ones the kernel never took
+  /// are not, and -1 means that none was, so the caller sends the rest of
+  /// the batch another way without duplicates. errno is set to the error of
+  /// the ring.
+  int SendBatch(struct mmsghdr* msgs, unsigned count);
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(IoUringSender);
+
+  int Enter(unsigned to_submit, unsigned min_complete, unsigned flags);
+  /// Move the completions posted so far into @a msgs; see @a SendBatch.
+  void Reap(struct mmsghdr* msgs, unsigned* completed, unsigned* sent,
+      int* error);
+
+  int ring_fd_;
+  bool sqpoll_;
+  unsigned entries_;
+
+  void* sq_ring_;
+  std::size_t sq_ring_size_;
+  void* cq_ring_;
+  std::size_t cq_ring_size_;
+  void* sqes_;
+  std::size_t sqes_size_;
+
+  unsigned* sq_head_;
+  unsigned* sq_tail_;
+  unsigned* sq_mask_;
+  unsigned* sq_flags_;
+  unsigned* sq_array_;
+  unsigned* cq_head_;
+  unsigned* cq_tail_;
+  unsigned* cq_mask_;
+  void* cqes_;
+};
+
+} // namespace am
+
+#endif // _IO_URING_SENDER_HPP_
@@ -0,0 +1,314 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "message_buffer.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <new>
+
+#include <boost/thread/lock_guard.hpp>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#include <boost/cstdint.hpp> // int32_t for Windows
+using boost::int32_t;
+#else
+#include <arpa/inet.h>
+#include <stdint.h>
+#endif
+
+using namespace am;
+
+//-----------------------------------------------------------------------------
+MessageBuffer::MessageBuffer(MessageBufferPool* pool, int slot_class,
+    char* storage, std::size_t capacity)
+: storage_(storage)
+, capacity_(capacity)
+, size_(0)
+, blob_bytes_(0)
+, blob_count_(0)
+, sequence_(0)
+, priority_(PRIORITY_BULK)
+, refs_(0)
+, pool_(pool)
+, slot_class_(slot_class)
+{
+}
+
+void MessageBuffer::Resize(std::size_t size)
+{
+  assert(size <= capacity_);
+  size_ = size;
+}
+
+char* MessageBuffer::Append(std::size_t n)
+{
+  if (capacity_ - size_ < n) return NULL;
+  char* p = data() + size_;
+  size_ += n;
+  return p;
+}
+
+bool MessageBuffer::Append(const char* bytes, std::size_t n)
+{
+  char* p = Append(n);
+  if (p && n) memcpy(p, bytes, n);
+  return p != NULL;
+}
+
+bool MessageBuffer::AttachBlob(std::size_t offset, BlobData* blob)
+{
+  if (blob_count_ == MAX_BLOBS) return false;
+  intrusive_ptr_add_ref(blob);
+  blobs_[blob_count_].offset = offset;
+  blobs_[blob_count_].blob = blob;
+  blob_count_++;
+  blob_bytes_ += blob->size();
+  return true;
+}
+
+void MessageBuffer::WriteSizePrefix()
+{
+  int32_t frame_size = htonl(total_size());
+  memcpy(data() - 4, &frame_size, 4);
+}
+
+void MessageBuffer::Clear()
+{
+  for (std::size_t i = 0; i < blob_count_; ++i) {
+    intrusive_ptr_release(blobs_[i].blob);
+  }
+  blob_count_ = 0;
+  blob_bytes_ = 0;
+  size_ = 0;
+  sequence_ = 0;
+  priority_ = PRIORITY_BULK;
+}
+
+//-----------------------------------------------------------------------------
+GatherBuffers::GatherBuffers(const MessageBuffer& msg, bool framed)
+: count_(0)
+{
+  const char* begin = framed ? msg.data() - 4 : msg.data();
+  for (std::size_t i = 0; i < msg.blob_count(); ++i) {
+    const char* end = msg.data() + msg.blob_offset(i);
+    buffers_[count_++] = boost::asio::const_buffer(begin, end - begin);
+    buffers_[count_++] = boost::asio::const_buffer(msg.blob(i)->data(),
+        msg.blob(i)->size());
+    begin = end;
+  }
+  buffers_[count_++] = boost::asio::const_buffer(begin,
+      msg.data() + msg.size() - begin);
+}
+
+//-----------------------------------------------------------------------------
+void am::intrusive_ptr_add_ref(BlobData* blob)
+{
+  ++blob->refs_;
+}
+
+void am::intrusive_ptr_release(BlobData* blob)
+{
+  if (--blob->refs_ == 0) {
+    if (blob->release_) blob->release_(blob->context_);
+    delete blob;
+  }
+}
+
+am::BlobData* am::GetBlobData(const Blob& blob)
+{
+  return blob.data_;
+}
+
+Blob::Blob(const void* data, std::size_t size, ReleaseFunction release,
+    void* context)
+: data_(new BlobData(data, size, release, context))
+{
+  intrusive_ptr_add_ref(data_);
+}
+
+Blob::Blob(const Blob& other)
+: data_(other.data_)
+{
+  intrusive_ptr_add_ref(data_);
+}
+
+Blob& Blob::operator=(const Blob& other)
+{
+  intrusive_ptr_add_ref(other.data_);
+  intrusive_ptr_release(data_);
+  data_ = other.data_;
+  return *this;
+}
+
+Blob::~Blob()
+{
+  intrusive_ptr_release(data_);
+}
+
+const void* Blob::data() const
+{
+  return data_->data();
+}
+
+std::size_t Blob::size() const
+{
+  return data_->size();
+}
+
+void am::intrusive_ptr_add_ref(MessageBuffer* buffer)
+{
+  ++buffer->refs_;
+}
+
+void am::intrusive_ptr_release(MessageBuffer* buffer)
+{
+  if (--buffer->refs_ == 0) {
+    buffer->pool_->Release(buffer);
+  }
+}
+
+//-----------------------------------------------------------------------------
+MessageBufferPool::MessageBufferPool(std::size_t slot_size,
+    std::size_t large_slot_size, std::size_t memory_limit)
+{
+  // Each slot holds the MessageBuffer followed by its storage, rounded up so
+  // that the next MessageBuffer is suitably aligned.
+  const std::size_t align = sizeof(void*) * 2;
+  const std::size_t sizes[2] = { slot_size, large_slot_size };
+  const std::size_t slots_per_slab[2] = {
+    SLOTS_PER_SLAB, LARGE_SLOTS_PER_SLAB
+  };
+  for (int i = REGULAR; i <= LARGE; ++i) {
+    std::size_t stride =
+      sizeof(MessageBuffer) + MessageBuffer::HEADROOM + sizes[i];
+    classes_[i].size = sizes[i];
+    classes_[i].stride = (stride + align - 1) / align * align;
+    classes_[i].slots_per_slab = slots_per_slab[i];
+    classes_[i].slots_total = 0;
+  }
+
+  stats_.slot_size = classes_[REGULAR].stride;
+  stats_.large_slot_size = large_slot_size ? classes_[LARGE].stride : 0;
+  stats_.slots_total = 0;
+  stats_.slots_in_use = 0;
+  stats_.peak_slots_in_use = 0;
+  stats_.bytes_reserved = 0;
+  stats_.memory_limit = memory_limit;
+  stats_.failed_allocations = 0;
+}
+
+MessageBufferPool::~MessageBufferPool()
+{
+  for (int i = REGULAR; i <= LARGE; ++i) {
+    for (std::size_t j = 0; j < classes_[i].free.size(); ++j) {
+      classes_[i].free[j]->~MessageBuffer();
+    }
+  }
+  for (std::size_t i = 0; i < slabs_.size(); ++i) {
+    delete [] slabs_[i];
+  }
+}
+
+MessageBufferPtr MessageBufferPool::Acquire()
+{
+  return Acquire(REGULAR);
+}
+
+MessageBufferPtr MessageBufferPool::AcquireLarge()
+{
+  if (classes_[LARGE].size == 0) return MessageBufferPtr();
+  return Acquire(LARGE);
+}
+
+MessageBufferPtr MessageBufferPool::Acquire(const char* bytes, std::size_t size)
+{
+  MessageBufferPtr buffer;
+  if (size <= classes_[REGULAR].size) {
+    buffer = Acquire(REGULAR);
+  } else if (size <= classes_[LARGE].size) {
+    buffer = Acquire(LARGE);
+  }
+  if (buffer) buffer->Append(bytes, size);
+  return buffer;
+}
+
+MessageBufferPtr MessageBufferPool::Acquire(int slot_class)
+{
+  SlotClass& c = classes_[slot_class];
+  MessageBuffer* buffer = NULL;
+  {
+    boost::lock_guard<boost::mutex> lock(mutex_);
+    if (c.free.empty() && !AllocateSlab(slot_class)) {
+      stats_.failed_allocations++;
+      return MessageBufferPtr();
+    }
+    buffer = c.free.back();
+    c.free.pop_back();
+    if (++stats_.slots_in_use > stats_.peak_slots_in_use) {
+      stats_.peak_slots_in_use = stats_.slots_in_use;
+    }
+  }
+  return MessageBufferPtr(buffer);
+}
+
+void MessageBufferPool::SetMemoryLimit(std::size_t memory_limit)
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  stats_.memory_limit = memory_limit;
+}
+
+MessageBufferPool::Statistics MessageBufferPool::GetStatistics()
+{
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  return stats_;
+}
+
+bool MessageBufferPool::AllocateSlab(int slot_class)
+{
+  SlotClass& c = classes_[slot_class];
+  std::size_t slab_size = c.stride * c.slots_per_slab;
+  if (stats_.memory_limit &&
+      stats_.bytes_reserved + slab_size > stats_.memory_limit) {
+    return false;
+  }
+
+  char* slab = new char[slab_size];
+  slabs_.push_back(slab);
+  // The free list can hold every slot so releasing never allocates.
+  c.free.reserve(c.slots_total + c.slots_per_slab);
+  for (std::size_t i = c.slots_per_slab; i > 0; --i) {
+    char* slot = slab + (i - 1) * c.stride;
+    c.free.push_back(new (slot) MessageBuffer(this, slot_class,
+          slot + sizeof(MessageBuffer), c.size));
+  }
+  c.slots_total += c.slots_per_slab;
+  stats_.slots_total += c.slots_per_slab;
+  stats_.bytes_reserved += slab_size;
+  return true;
+}
+
+void MessageBufferPool::Release(MessageBuffer* buffer)
+{
+  buffer->Clear();
+  boost::lock_guard<boost::mutex> lock(mutex_);
+  classes_[buffer->slot_class_].free.push_back(buffer);
+  stats_.slots_in_use--;
+}
@@ -0,0 +1,362 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _MESSAGE_BUFFER_HPP_
+#define _MESSAGE_BUFFER_HPP_
+
+#include <cstddef>
+#include <vector>
+
+#include <boost/asio/buffer.hpp>
+#include <boost/circular_buffer.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/smart_ptr/detail/atomic_count.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "asset_manager_client.hpp" // am::Blob
+#include "disallow_copy_and_assign.hpp"
+
+namespace am {
+
+class MessageBufferPool;
+
+/// Shared state of an am::Blob: a reference to caller memory and the function
+/// to call once the last reference is released.
+class BlobData {
+ public:
+  BlobData(const void* data, std::size_t size, Blob::ReleaseFunction release,
+      void* context)
+  : data_((const char*)data), size_(size), release_(release),
+    context_(context), refs_(0) {}
+
+  const char* data() const { return data_; }
+  std::size_t size() const { return size_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(BlobData);
+  friend void intrusive_ptr_add_ref(BlobData* blob);
+  friend void intrusive_ptr_release(BlobData* blob);
+
+  const char* data_;
+  std::size_t size_;
+  Blob::ReleaseFunction release_;
+  void* context_;
+  boost::detail::atomic_count refs_;
+};
+
+void intrusive_ptr_add_ref(BlobData* blob);
+void intrusive_ptr_release(BlobData* blob);
+
+/// Returns the shared state of @a blob.
+BlobData* GetBlobData(const Blob& blob);
+
+/// Reference-counted storage for a single encoded message or bundle.
+///
+/// Encoders write the message once into @a data and the same buffer is then
+/// shared by the sockets, the bundles and the TCP resend window. Four bytes of
+/// headroom are reserved in front of the message so that the TCP length prefix
+/// can be written in place with @a WriteSizePrefix.
+///
+/// Buffers live in fixed-size slots of a MessageBufferPool slab and never
+/// grow past @a capacity.
+///
+/// Besides the bytes at @a data, a buffer may reference up to @a MAX_BLOBS
+/// blobs in caller memory, each spliced in after a given offset of @a data.
+/// Such a message is sent with a scatter-gather write (see GatherBuffers) and
+/// its size on the wire is @a total_size.
+class MessageBuffer {
+ public:
+  enum {
+    /// Bytes reserved in front of the message for the TCP length prefix.
+    HEADROOM = 4,
+    /// Maximum number of blobs referenced by a single buffer.
+    MAX_BLOBS = 4
+  };
+
+  char* data() { return storage_ + HEADROOM; }
+  const char* data() const { return storage_ + HEADROOM; }
+  std::size_t size() const { return size_; }
+  bool empty() const { return size_ == 0; }
+
+  /// Number of message bytes that can be written at @a data.
+  std::size_t capacity() const { return capacity_; }
+
+  /// Size of the message on the wire including referenced blobs.
+  std::size_t total_size() const { return size_ + blob_bytes_; }
+
+  /// Splice @a blob into the message after the first @a offset bytes of @a
+  /// data. Offsets must be attached in increasing order. Returns false if the
+  /// buffer already references @a MAX_BLOBS blobs.
+  bool AttachBlob(std::size_t offset, BlobData* blob);
+  std::size_t blob_count() const { return blob_count_; }
+  std::size_t blob_offset(std::size_t i) const { return blobs_[i].offset; }
+  const BlobData* blob(std::size_t i) const { return blobs_[i].blob; }
+
+  /// Position of a TCP message in the TCP stream, or for a UDP message the
+  /// position of the TCP message that must be written before it. See
+  /// TCPClient::Send and UDPClient::SetBarrier.
+  boost::uint64_t sequence() const { return sequence_; }
+  void set_sequence(boost::uint64_t sequence) { sequence_ = sequence; }
+
+  /// Queue class of the message in the transports, PRIORITY_BULK unless set.
+  Priority priority() const { return priority_; }
+  void set_priority(Priority priority) { priority_ = priority; }
+
+  /// Set the message size. @a size must not exceed @a capacity.
+  void Resize(std::size_t size);
+
+  /// Grow the message by @a n bytes and return a pointer to the new bytes, or
+  /// NULL if the buffer does not have room for them.
+  char* Append(std::size_t n);
+
+  /// Append @a n bytes copied from @a bytes. Returns false if they do not fit.
+  bool Append(const char* bytes, std::size_t n);
+
+  /// Write @a total_size as a big-endian 32-bit integer into the 4 bytes of
+  /// headroom right before @a data. The message itself is unchanged; send it
+  /// with GatherBuffers(buffer, true) to include the prefix. Writing the
+  /// prefix is idempotent so a buffer shared by several sockets can be framed
+  /// by each of them.
+  void WriteSizePrefix();
+
+  /// Clear the message and release referenced blobs.
+  void Clear();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MessageBuffer);
+  friend class MessageBufferPool;
+  friend void intrusive_ptr_add_ref(MessageBuffer* buffer);
+  friend void intrusive_ptr_release(MessageBuffer* buffer);
+
+  MessageBuffer(MessageBufferPool* pool, int slot_class, char* storage,
+      std::size_t capacity);
+  ~MessageBuffer() {}
+
+  struct BlobSplice {
+    std::size_t offset;
+    BlobData* blob;
+  };
+
+  char* storage_;
+  std::size_t capacity_;
+  std::size_t size_;
+  std::size_t blob_bytes_;
+  std::size_t blob_count_;
+  BlobSplice blobs_[MAX_BLOBS];
+  boost::uint64_t sequence_;
+  Priority priority_;
+  boost::detail::atomic_count refs_;
+  MessageBufferPool* pool_;
+  int slot_class_;
+};
+
+typedef boost::intrusive_ptr<MessageBuffer> MessageBufferPtr;
+
+void intrusive_ptr_add_ref(MessageBuffer* buffer);
+void intrusive_ptr_release(MessageBuffer* buffer);
+
+/// Scatter-gather view of a MessageBuffer for the socket write calls. It
+/// models the Boost.Asio ConstBufferSequence concept without allocating.
+class GatherBuffers {
+ public:
+  typedef boost::asio::const_buffer value_type;
+  typedef const boost::asio::const_buffer* const_iterator;
+
+  /// @param[in] msg          Message to send.
+  /// @param[in] framed       Include the TCP length prefix written by
+  ///                         MessageBuffer::WriteSizePrefix.
+  GatherBuffers(const MessageBuffer& msg, bool framed);
+
+  const_iterator begin() const { return buffers_; }
+  const_iterator end() const { return buffers_ + count_; }
+
+ private:
+  boost::asio::const_buffer buffers_[2 * MessageBuffer::MAX_BLOBS + 1];
+  std::size_t count_;
+};
+
+/// Slab allocator for @a MessageBuffer.
+///
+/// Memory is reserved in slabs of fixed-size slots, each holding one buffer
+/// plus headroom. There are two slot sizes: datagram-sized slots for regular
+/// messages and bundles, and optional large slots for TCP messages that do not
+/// fit in a datagram. Released buffers go back to a free list, so once the
+/// pool reached its working size no message storage touches the global
+/// allocator. Optionally, the total size of the slabs is capped and @a Acquire
+/// returns a null pointer when the cap is reached. Buffers return to the pool
+/// automatically when the last reference is released, which may happen on any
+/// thread. The pool must outlive every buffer acquired from it.
+class MessageBufferPool {
+ public:
+  enum {
+    /// Number of datagram-sized slots reserved at once.
+    SLOTS_PER_SLAB = 64,
+    /// Number of large slots reserved at once.
+    LARGE_SLOTS_PER_SLAB = 4
+  };
+
+  /// Snapshot of the pool usage.
+  struct Statistics {
+    std::size_t slot_size;          ///< Bytes per slot including headroom.
+    std::size_t large_slot_size;    ///< Bytes per large slot, 0 if none.
+    std::size_t slots_total;        ///< Slots reserved in all slabs.
+    std::size_t slots_in_use;       ///< Slots currently referenced.
+    std::size_t peak_slots_in_use;  ///< Highest value of slots_in_use.
+    std::size_t bytes_reserved;     ///< Memory held by all slabs.
+    std::size_t memory_limit;       ///< Cap on bytes_reserved, 0 if none.
+    std::size_t failed_allocations; ///< Acquire calls refused by the cap.
+  };
+
+  /// @param[in] slot_size       Message capacity of each regular buffer.
+  /// @param[in] large_slot_size Message capacity of each large buffer, or 0
+  ///                            to disable large buffers.
+  /// @param[in] memory_limit    Cap on the memory reserved for slabs in
+  ///                            bytes, or 0 for no cap.
+  MessageBufferPool(std::size_t slot_size, std::size_t large_slot_size=0,
+      std::size_t memory_limit=0);
+  ~MessageBufferPool();
+
+  /// Returns an empty datagram-sized buffer, or a null pointer if the memory
+  /// cap is reached.
+  MessageBufferPtr Acquire();
+
+  /// Returns an empty large buffer, or a null pointer if large buffers are
+  /// disabled or the memory cap is reached.
+  MessageBufferPtr AcquireLarge();
+
+  /// Returns a buffer containing a copy of @a size bytes at @a bytes, or a
+  /// null pointer if the bytes do not fit in a slot or the cap is reached.
+  MessageBufferPtr Acquire(const char* bytes, std::size_t size);
+
+  /// Change the cap on the slab memory. Slabs already reserved are kept even
+  /// if they exceed the new cap.
+  void SetMemoryLimit(std::size_t memory_limit);
+
+  Statistics GetStatistics();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(MessageBufferPool);
+  friend void intrusive_ptr_release(MessageBuffer* buffer);
+
+  enum { REGULAR, LARGE };
+
+  struct SlotClass {
+    std::size_t size;
+    std::size_t stride;
+    std::size_t slots_per_slab;
+    std::size_t slots_total;
+    std::vector<MessageBuffer*> free;
+  };
+
+  MessageBufferPtr Acquire(int slot_class);
+  bool AllocateSlab(int slot_class);
+  void Release(MessageBuffer* buffer);
+
+  boost::mutex mutex_;
+  SlotClass classes_[2];
+  std::vector<char*> slabs_;
+  Statistics stats_;
+};
+
+/// FIFO of message buffers used by the transport queues. It is backed by a
+/// ring that only grows, so queuing does not allocate once the ring reached
+/// the working size of the queue.
+class MessageQueue {
+ public:
+  MessageQueue() : ring_(INITIAL_CAPACITY) {}
+
+  void push_back(const MessageBufferPtr& msg) {
+    Reserve();
+    ring_.push_back(msg);
+  }
+  void push_front(const MessageBufferPtr& msg) {
+    Reserve();
+    ring_.push_front(msg);
+  }
+  void pop_front() { ring_.pop_front(); }
+  const MessageBufferPtr& front() const { return ring_.front(); }
+  const MessageBufferPtr& operator[](std::size_t i) const { return ring_[i]; }
+  bool empty() const { return ring_.empty(); }
+  std::size_t size() const { return ring_.size(); }
+  void clear() { ring_.clear(); }
+
+ private:
+  enum { INITIAL_CAPACITY = 64 };
+
+  void Reserve() {
+    if (ring_.full()) ring_.set_capacity(ring_.capacity() * 2);
+  }
+
+  boost::circular_buffer<MessageBufferPtr> ring_;
+};
+
+/// One MessageQueue per priority class. Messages keep their order within a
+/// class and @a next tells which class the transport serves next, so urgent
+/// messages overtake bulk ones at message boundaries.
+class PriorityQueue {
+ public:
+  MessageQueue& lane(int priority) { return lanes_[priority]; }
+  const MessageQueue& lane(int priority) const { return lanes_[priority]; }
+
+  void push_back(const MessageBufferPtr& msg) {
+    lanes_[msg->priority()].push_back(msg);
+  }
+  void push_front(const MessageBufferPtr& msg) {
+    lanes_[msg->priority()].push_front(msg);
+  }
+
+  /// Most urgent class with a queued message, PRIORITY_COUNT if none.
+  int next() const {
+    int i = 0;
+    while (i < PRIORITY_COUNT && lanes_[i].empty()) i++;
+    return i;
+  }
+
+  bool empty() const { return next() == PRIORITY_COUNT; }
+  void clear() {
+    for (int i = 0; i < PRIORITY_COUNT; ++i) lanes_[i].clear();
+  }
+
+  /// Lowest sequence number of the queued messages, 0 if none.
+  boost::uint64_t min_sequence() const {
+    boost::uint64_t sequence = 0;
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+      if (!lanes_[i].empty() &&
+          (sequence == 0 || lanes_[i].front()->sequence() < sequence)) {
+        sequence = lanes_[i].front()->sequence();
+      }
+    }
+    return sequence;
+  }
+
+ private:
+  MessageQueue lanes_[PRIORITY_COUNT];
+};
+
+/// Usage of the queue of one priority class of a transport.
+struct QueueStatistics {
+  std::size_t queued;       ///< Messages waiting to be written.
+  std::size_t peak_queued;  ///< Highest value of queued.
+  std::size_t sent;         ///< Messages written.
+};
+
+} // namespace am
+
+#endif // _MESSAGE_BUFFER_HPP_
@@ -0,0 +1,323 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "osc_packer.hpp"
+
+#include "tnyosc.hpp" // htonf, htond, htonll
+#include "byte_swap.hpp"
+#include "message_buffer.hpp"
+
+using namespace am;
+
+//-----------------------------------------------------------------------------
+char* OscWriter::Reserve(std::size_t len)
+{
+  if (overflow_ || capacity_ - size_ < len) {
+    overflow_ = true;
+    return NULL;
+  }
+  char* p = buf_ + size_;
+  size_ += len;
+  return p;
+}
+
+void OscWriter::WriteBytes(const void* bytes, std::size_t len)
+{
+  char* p = Reserve(len);
+  if (p) memcpy(p, bytes, len);
+}
+
+void OscWriter::WriteString(const char* str, std::size_t len)
+{
+  std::size_t pad = 4 - len % 4;
+  char* p = Reserve(len + pad);
+  if (p) {
+    memcpy(p, str, len);
+    memset(p + len, '\0', pad);
+  }
+}
+
+void OscWriter::WriteInt32(int32_t v)
+{
+  int32_t a = htonl(v);
+  WriteBytes(&a, 4);
+}
+
+void OscWriter::WriteInt64(int64_t v)
+{
+  int64_t a = htonll(v);
+  WriteBytes(&a, 8);
+}
+
+void OscWriter::WriteFloat(float v)
+{
+  int32_t a = tnyosc::htonf(v);
+  WriteBytes(&a, 4);
+}
+
+void OscWriter::WriteDouble(double v)
+{
+  int64_t a = tnyosc::htond(v);
+  WriteBytes(&a, 8);
+}
+
+//-----------------------------------------------------------------------------
+namespace {
+
+// Encodes a message whose address is either null-terminated or, if @a
+// padded is true, already padded to @a address_len bytes.
+int32_t PackMessage(MessageBuffer& buffer, std::size_t max_size,
+    const char* address, std::size_t address_len, bool padded,
+    const char* format, va_list ap)
+{
+  // Validate the format before writing anything
+  for (const char* f = format; *f != '\0'; ++f) {
+    switch (*f) {
+      case 'i': case 'h': case 'f': case 'd': case 's': case 'c':
+      case 'T': case 'F': case 'N': case 'I':
+      case 't': case 'r': case 'm': case 'b':
+        break;
+      default:  // unknown type
+        return -1;
+    }
+  }
+
+  std::size_t start = buffer.size();
+  OscWriter writer(buffer.data() + start, buffer.capacity() - start);
+  if (padded) {
+    writer.WriteBytes(address, address_len);
+  } else {
+    writer.WriteString(address, address_len);
+  }
+
+  // Type tag string: ',' followed by the format
+  std::size_t format_len = strlen(format);
+  char* tags = writer.Reserve(1 + format_len + (4 - (1 + format_len) % 4));
+  if (tags) {
+    tags[0] = ',';
+    memcpy(tags + 1, format, format_len);
+    memset(tags + 1 + format_len, '\0', 4 - (1 + format_len) % 4);
+  }
+
+  // Blobs to splice in after the given offsets once the message fits
+  struct {
+    std::size_t offset;
+    BlobData* blob;
+  } splices[MessageBuffer::MAX_BLOBS];
+  std::size_t num_splices = 0;
+  std::size_t blob_bytes = 0;
+
+  for (; *format != '\0' && !writer.overflow(); ++format) {
+    switch (*format) {
+      case 'i': // 32-bit integer
+        writer.WriteInt32(va_arg(ap, int32_t));
+        break;
+      case 'h': // 64-bit integer
+        writer.WriteInt64(va_arg(ap, int64_t));
+        break;
+      case 'f': // 32-bit float
+        writer.WriteFloat((float)va_arg(ap, double));
+        break;
+      case 'd': // 64-bit float
+        writer.WriteDouble(va_arg(ap, double));
+        break;
+      case 's': { // string (array of character)
+        const char* str = va_arg(ap, const char*);
+        writer.WriteString(str, strlen(str));
+        break;
+      }
+      case 'c': { // ascii character
+        char* p = writer.Reserve(4);
+        if (p) {
+          p[0] = (char)va_arg(ap, int);
+          memset(p + 1, 0, 3);
+        }
+        break;
+      }
+      case 't': // timetag
+        writer.WriteInt64((int64_t)va_arg(ap, uint64_t));
+        break;
+      case 'r': // 32-bit RGBA color
+      case 'm': // MIDI
+        writer.WriteInt32((int32_t)va_arg(ap, uint32_t));
+        break;
+      case 'b': { // blob
+        const Blob* blob = va_arg(ap, const Blob*);
+        BlobData* data = blob ? GetBlobData(*blob) : NULL;
+        std::size_t size = data ? data->size() : 0;
+        writer.WriteInt32((int32_t)size);
+        if (size >= BLOB_COPY_THRESHOLD &&
+            buffer.blob_count() + num_splices < MessageBuffer::MAX_BLOBS) {
+          splices[num_splices].offset = start + writer.size();
+          splices[num_splices].blob = data;
+          num_splices++;
+          blob_bytes += size;
+        } else if (size) {
+          writer.WriteBytes(data->data(), size);
+        }
+        char* pad = writer.Reserve((4 - size % 4) % 4);
+        if (pad) memset(pad, 0, (4 - size % 4) % 4);
+        break;
+      }
+      default:  // T, F, N and I carry no data
+        break;
+    }
+  }
+
+  std::size_t size = writer.size() + blob_bytes;
+  if (writer.overflow() || size > max_size) return 0;
+
+  buffer.Resize(start + writer.size());
+  for (std::size_t i = 0; i < num_splices; ++i) {
+    buffer.AttachBlob(splices[i].offset, splices[i].blob);
+  }
+  return (int32_t)size;
+}
+
+} // namespace
+
+int32_t am::PackMessage(MessageBuffer& buffer, std::size_t max_size,
+    const char* address, const char* format, va_list ap)
+{
+  // Make sure the address starts with '/'
+  if (!address || address[0] != '/') return -1;
+  return ::PackMessage(buffer, max_size, address, strlen(address), false,
+      format, ap);
+}
+
+int32_t am::PackMessage(MessageBuffer& buffer, std::size_t max_size,
+    const PaddedAddress& address, const char* format, va_list ap)
+{
+  if (!address.data || address.data[0] != '/') return -1;
+  return ::PackMessage(buffer, max_size, address.data, address.size, true,
+      format, ap);
+}
+
+int32_t am::PackArrayMessage(char* buf, std::size_t capacity,
+    const char* address, char type, const void* values, std::size_t count,
+    bool osc_array)
+{
+  if (!address || address[0] != '/') return -1;
+  if (type != 'f' && type != 'i') return -1;
+
+  OscWriter writer(buf, capacity);
+  writer.WriteString(address, strlen(address));
+
+  // Type tag string: ',' followed by count tags, optionally within [ ]
+  std::size_t tags_len = 1 + count + (osc_array ? 2 : 0);
+  char* tags = writer.Reserve(tags_len + (4 - tags_len % 4));
+  if (tags) {
+    char* p = tags;
+    *p++ = ',';
+    if (osc_array) *p++ = '[';
+    memset(p, type, count);
+    p += count;
+    if (osc_array) *p++ = ']';
+    memset(p, '\0', 4 - tags_len % 4);
+  }
+
+  char* data = writer.Reserve(4 * count);
+  if (data) CopyToBigEndian32(data, values, count);
+
+  return writer.overflow() ? 0 : (int32_t)writer.size();
+}
+
+int32_t am::PackObjectMessage(char* buf, std::size_t capacity,
+    const char* prefix, std::size_t prefix_len, int id, const char* suffix,
+    char type, const void* values, std::size_t count)
+{
+  // Format the id backwards into a small buffer
+  char digits[12];
+  char* d = digits + sizeof(digits);
+  unsigned int n = id < 0 ? 0u - (unsigned int)id : (unsigned int)id;
+  do {
+    *--d = (char)('0' + n % 10);
+    n /= 10;
+  } while (n);
+  if (id < 0) *--d = '-';
+  std::size_t digits_len = digits + sizeof(digits) - d;
+  std::size_t suffix_len = strlen(suffix);
+
+  OscWriter writer(buf, capacity);
+  std::size_t address_len = prefix_len + digits_len + suffix_len;
+  char* address = writer.Reserve(address_len + (4 - address_len % 4));
+  if (address) {
+    memcpy(address, prefix, prefix_len);
+    memcpy(address + prefix_len, d, digits_len);
+    memcpy(address + prefix_len + digits_len, suffix, suffix_len);
+    memset(address + address_len, '\0', 4 - address_len % 4);
+  }
+
+  std::size_t tags_len = 1 + count;
+  char* tags = writer.Reserve(tags_len + (4 - tags_len % 4));
+  if (tags) {
+    tags[0] = ',';
+    memset(tags + 1, type, count);
+    memset(tags + tags_len, '\0', 4 - tags_len % 4);
+  }
+
+  char* data = writer.Reserve(4 * count);
+  if (data) CopyToBigEndian32(data, values, count);
+
+  return writer.overflow() ? 0 : (int32_t)writer.size();
+}
+
+//-----------------------------------------------------------------------------
+int32_t ArrayEncoder::Encode(MessageBuffer& buffer, std::size_t max_size)
+{
+  std::size_t start = buffer.size();
+  std::size_t capacity = buffer.capacity() - start;
+  int32_t size = PackArrayMessage(buffer.data() + start,
+      capacity < max_size ? capacity : max_size,
+      address_, type_, values_, count_, osc_array_);
+  if (size > 0) buffer.Resize(start + size);
+  return size;
+}
+
+int32_t ObjectEncoder::Encode(MessageBuffer& buffer, std::size_t max_size)
+{
+  std::size_t start = buffer.size();
+  std::size_t capacity = buffer.capacity() - start;
+  int32_t size = PackObjectMessage(buffer.data() + start,
+      capacity < max_size ? capacity : max_size,
+      prefix_, prefix_len_, id_, suffix_, type_, values_, count_);
+  if (size > 0) buffer.Resize(start + size);
+  return size;
+}
+
+PacketEncoder::PacketEncoder(BlobData* blob)
+: data_(blob->data()), size_(blob->size()), blob_(blob)
+{
+}
+
+int32_t PacketEncoder::Encode(MessageBuffer& buffer, std::size_t max_size)
+{
+  // Only padded messages and bundles are sent
+  if (size_ == 0 || size_ % 4 != 0 || (data_[0] != '/' && data_[0] != '#')) {
+    return -1;
+  }
+  if (size_ > max_size) return 0;
+  if (blob_ && size_ >= BLOB_COPY_THRESHOLD &&
+      buffer.blob_count() < MessageBuffer::MAX_BLOBS) {
+    buffer.AttachBlob(buffer.size(), blob_);
+  } else if (!buffer.Append(data_, size_)) {
+    return 0;
+  }
+  return (int32_t)size_;
+}
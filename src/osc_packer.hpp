@@ -0,0 +1,230 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _OSC_PACKER_HPP_
+#define _OSC_PACKER_HPP_
+
+#include <cstdarg>
+#include <cstddef>
+#include <cstring>
+
+#if defined(_WIN32)
+#include <boost/cstdint.hpp> // int32_t for Windows
+using boost::int32_t;
+using boost::int64_t;
+using boost::uint32_t;
+using boost::uint64_t;
+#else
+#include <stdint.h>
+#endif
+
+namespace am {
+
+class BlobData;
+class MessageBuffer;
+
+/// Writes Open Sound Control data into a caller-supplied buffer of fixed
+/// capacity. Writes past the capacity are dropped and flagged with @a
+/// overflow so a message can be encoded straight into the tail of a bundle.
+class OscWriter {
+ public:
+  OscWriter(char* buf, std::size_t capacity)
+  : buf_(buf), capacity_(capacity), size_(0), overflow_(false) {}
+
+  /// Write @a len bytes of @a str followed by 1 to 4 null bytes.
+  void WriteString(const char* str, std::size_t len);
+  void WriteInt32(int32_t v);
+  void WriteInt64(int64_t v);
+  void WriteFloat(float v);
+  void WriteDouble(double v);
+  void WriteBytes(const void* bytes, std::size_t len);
+
+  /// Reserve @a len bytes and return a pointer to them, or NULL on overflow.
+  char* Reserve(std::size_t len);
+
+  std::size_t size() const { return size_; }
+  bool overflow() const { return overflow_; }
+
+ private:
+  char* buf_;
+  std::size_t capacity_;
+  std::size_t size_;
+  bool overflow_;
+};
+
+/// An OSC address already followed by its 1 to 4 null padding bytes, as
+/// stored by AddressTable.
+struct PaddedAddress {
+  const char* data;
+  std::size_t size; ///< Multiple of 4 including the padding.
+};
+
+/// Blobs smaller than this are copied into the message rather than sent from
+/// the caller's memory, as the copy is cheaper than an extra gather entry.
+const std::size_t BLOB_COPY_THRESHOLD = 256;
+
+/// Bounded replacement for voscpack. Appends a message with the address @a
+/// address and the arguments in @a ap described by @a format (see
+/// AssetManagerClient::SendCustomTCP for the supported types) to @a buffer.
+/// Blobs of at least BLOB_COPY_THRESHOLD bytes are attached to @a buffer
+/// instead of being copied.
+///
+/// @return Size of the message on the wire in bytes, 0 if it does not fit in
+///         @a buffer or is larger than @a max_size, or -1 if @a address or @a
+///         format is invalid. @a buffer is unchanged unless the size is
+///         positive.
+int32_t PackMessage(MessageBuffer& buffer, std::size_t max_size,
+    const char* address, const char* format, va_list ap);
+
+/// Same as above, except that the address is copied as is.
+int32_t PackMessage(MessageBuffer& buffer, std::size_t max_size,
+    const PaddedAddress& address, const char* format, va_list ap);
+
+/// Encodes a message whose arguments are @a count 32-bit values of type @a
+/// type ('f' or 'i'). The values are written either as @a count arguments or,
+/// if @a osc_array is true, as a single OSC array ("[fff...]"). The values are
+/// byte-swapped in bulk with @a CopyToBigEndian32.
+///
+/// @return Size of the message in bytes, 0 if it does not fit in @a capacity
+///         or -1 if @a address or @a type is invalid.
+int32_t PackArrayMessage(char* buf, std::size_t capacity,
+    const char* address, char type, const void* values, std::size_t count,
+    bool osc_array);
+
+/// Encodes a message with the address @a prefix, the decimal @a id and @a
+/// suffix (e.g. "/project/object/" 12 "/pos") and @a count arguments of type
+/// @a type ('f' or 'i').
+///
+/// @return Size of the message in bytes, or 0 if it does not fit in @a
+///         capacity.
+int32_t PackObjectMessage(char* buf, std::size_t capacity,
+    const char* prefix, std::size_t prefix_len, int id, const char* suffix,
+    char type, const void* values, std::size_t count);
+
+/// Interface used by AssetManagerClient to encode a message into whichever
+/// buffer it ends up in, i.e. the tail of an open bundle or a standalone
+/// buffer. @a Encode may be called more than once if the message does not fit
+/// in the first buffer.
+class MessageEncoder {
+ public:
+  virtual ~MessageEncoder() {}
+
+  /// Append the message to @a buffer.
+  ///
+  /// @return Size of the message on the wire in bytes, 0 if it does not fit in
+  ///         @a buffer or is larger than @a max_size, or -1 if the message is
+  ///         invalid. @a buffer is unchanged unless the size is positive.
+  virtual int32_t Encode(MessageBuffer& buffer, std::size_t max_size) = 0;
+};
+
+/// Encodes printf-like arguments with @a PackMessage.
+class FormatEncoder : public MessageEncoder {
+ public:
+  FormatEncoder(const char* address, const char* format, va_list ap)
+  : address_(address), format_(format) {
+    padded_.data = NULL;
+    padded_.size = 0;
+    va_copy(ap_, ap);
+  }
+  FormatEncoder(const PaddedAddress& address, const char* format, va_list ap)
+  : address_(NULL), padded_(address), format_(format) { va_copy(ap_, ap); }
+  ~FormatEncoder() { va_end(ap_); }
+
+  int32_t Encode(MessageBuffer& buffer, std::size_t max_size) {
+    va_list ap;
+    va_copy(ap, ap_);
+    int32_t size = address_ ?
+      PackMessage(buffer, max_size, address_, format_, ap) :
+      PackMessage(buffer, max_size, padded_, format_, ap);
+    va_end(ap);
+    return size;
+  }
+
+ private:
+  const char* address_;
+  PaddedAddress padded_;
+  const char* format_;
+  va_list ap_;
+};
+
+/// Encodes an array of 32-bit values with @a PackArrayMessage.
+class ArrayEncoder : public MessageEncoder {
+ public:
+  ArrayEncoder(const char* address, char type, const void* values,
+      std::size_t count, bool osc_array)
+  : address_(address), type_(type), values_(values), count_(count),
+    osc_array_(osc_array) {}
+
+  int32_t Encode(MessageBuffer& buffer, std::size_t max_size);
+
+ private:
+  const char* address_;
+  char type_;
+  const void* values_;
+  std::size_t count_;
+  bool osc_array_;
+};
+
+/// Copies an OSC packet that is already encoded, i.e. a message or a bundle
+/// built by the caller. A packet backed by a blob is attached to the buffer
+/// instead of being copied if it is at least BLOB_COPY_THRESHOLD bytes.
+class PacketEncoder : public MessageEncoder {
+ public:
+  PacketEncoder(const char* data, std::size_t size)
+  : data_(data), size_(size), blob_(NULL) {}
+  explicit PacketEncoder(BlobData* blob);
+
+  int32_t Encode(MessageBuffer& buffer, std::size_t max_size);
+
+ private:
+  const char* data_;
+  std::size_t size_;
+  BlobData* blob_;
+};
+
+/// Encodes per-object messages with @a PackObjectMessage. The encoder is
+/// reused for every object of a bulk update by calling @a set_object.
+class ObjectEncoder : public MessageEncoder {
+ public:
+  ObjectEncoder(const char* prefix, std::size_t prefix_len,
+      const char* suffix, char type='f')
+  : prefix_(prefix), prefix_len_(prefix_len), suffix_(suffix), type_(type),
+    id_(0), values_(NULL), count_(0) {}
+
+  void set_object(int id, const void* values, std::size_t count) {
+    id_ = id;
+    values_ = values;
+    count_ = count;
+  }
+
+  int32_t Encode(MessageBuffer& buffer, std::size_t max_size);
+
+ private:
+  const char* prefix_;
+  std::size_t prefix_len_;
+  const char* suffix_;
+  char type_;
+  int id_;
+  const void* values_;
+  std::size_t count_;
+};
+
+} // namespace am
+
+#endif // _OSC_PACKER_HPP_
@@ -0,0 +1,140 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "reliable_udp.hpp"
+
+#include <cstring>
+
+#if defined(_WIN32)
+#include <winsock2.h>
+#else
+#include <arpa/inet.h>
+#endif
+
+using namespace am;
+
+namespace {
+
+const char kReliableHeader[] = "/AM/Reliable\0\0\0\0,iib\0\0\0\0";
+const std::size_t kReliablePrefix = 24;
+const char kAckHeader[] = "/AM/Ack\0,ii\0";
+const std::size_t kAckPrefix = 12;
+
+void WriteUInt32(char* p, boost::uint32_t v)
+{
+  v = htonl(v);
+  memcpy(p, &v, 4);
+}
+
+boost::uint32_t ReadUInt32(const char* p)
+{
+  boost::uint32_t v;
+  memcpy(&v, p, 4);
+  return ntohl(v);
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+void am::WriteReliableHeader(char* header, boost::uint32_t session,
+    boost::uint32_t sequence, std::size_t packet_size)
+{
+  memcpy(header, kReliableHeader, kReliablePrefix);
+  WriteUInt32(header + kReliablePrefix, session);
+  WriteUInt32(header + kReliablePrefix + 4, sequence);
+  WriteUInt32(header + kReliablePrefix + 8, (boost::uint32_t)packet_size);
+}
+
+void am::WriteReliableAck(char* ack, boost::uint32_t session,
+    boost::uint32_t sequence)
+{
+  memcpy(ack, kAckHeader, kAckPrefix);
+  WriteUInt32(ack + kAckPrefix, session);
+  WriteUInt32(ack + kAckPrefix + 4, sequence);
+}
+
+bool am::ParseReliableAck(const char* data, std::size_t size,
+    boost::uint32_t* session, boost::uint32_t* sequence)
+{
+  if (size != RELIABLE_ACK_SIZE || memcmp(data, kAckHeader, kAckPrefix)) {
+    return false;
+  }
+  *session = ReadUInt32(data + kAckPrefix);
+  *sequence = ReadUInt32(data + kAckPrefix + 4);
+  return true;
+}
+
+//-----------------------------------------------------------------------------
+ReliableReceiver::ReliableReceiver()
+: has_session_(false)
+, session_(0)
+, next_expected_(1)
+, delivered_(0)
+, duplicates_(0)
+{
+}
+
+ReliableReceiver::Result ReliableReceiver::Receive(const char* data,
+    std::size_t size, const char** packet, std::size_t* packet_size,
+    char* ack)
+{
+  if (size < kReliablePrefix ||
+      memcmp(data, kReliableHeader, kReliablePrefix)) {
+    return NOT_RELIABLE;
+  }
+  if (size < RELIABLE_HEADER_SIZE) return INVALID;
+
+  boost::uint32_t session = ReadUInt32(data + kReliablePrefix);
+  boost::uint32_t sequence = ReadUInt32(data + kReliablePrefix + 4);
+  std::size_t length = ReadUInt32(data + kReliablePrefix + 8);
+  if (sequence == 0 || length > size - RELIABLE_HEADER_SIZE) return INVALID;
+
+  // A new session means the sender restarted
+  if (!has_session_ || session != session_) {
+    has_session_ = true;
+    session_ = session;
+    next_expected_ = 1;
+    received_.clear();
+  }
+
+  WriteReliableAck(ack, session, sequence);
+  if (sequence < next_expected_ || received_.count(sequence)) {
+    duplicates_++;
+    return DUPLICATE;
+  }
+
+  received_.insert(sequence);
+  while (!received_.empty() && *received_.begin() == next_expected_) {
+    received_.erase(received_.begin());
+    next_expected_++;
+  }
+  if (received_.size() > MAX_OUT_OF_ORDER) {
+    // skip the oldest gap
+    next_expected_ = *received_.begin();
+    while (!received_.empty() && *received_.begin() == next_expected_) {
+      received_.erase(received_.begin());
+      next_expected_++;
+    }
+  }
+
+  *packet = data + RELIABLE_HEADER_SIZE;
+  *packet_size = length;
+  delivered_++;
+  return NEW_MESSAGE;
+}
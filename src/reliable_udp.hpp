@@ -0,0 +1,109 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _RELIABLE_UDP_HPP_
+#define _RELIABLE_UDP_HPP_
+
+#include <cstddef>
+#include <set>
+
+#include <boost/cstdint.hpp>
+
+namespace am {
+
+/// Reliable datagrams.
+///
+/// A reliable message is an Open Sound Control message wrapping the original
+/// packet:
+///
+///   /AM/Reliable ,iib <session> <sequence> <packet>
+///
+/// where @a session identifies the sending client instance and @a sequence
+/// numbers its reliable messages from 1. The receiver answers every reliable
+/// message, including duplicates, with
+///
+///   /AM/Ack ,ii <session> <sequence>
+///
+/// sent back to the source address of the datagram. The sender retransmits
+/// unacknowledged messages with an exponential backoff and gives up after a
+/// bounded number of attempts. Messages are delivered as they arrive, so a
+/// lost datagram does not hold back the following ones, and duplicates are
+/// discarded by the receiver.
+
+/// Size of the header in front of the wrapped packet.
+const std::size_t RELIABLE_HEADER_SIZE = 36;
+
+/// Size of an acknowledgement.
+const std::size_t RELIABLE_ACK_SIZE = 20;
+
+/// Write the header of a reliable message wrapping @a packet_size bytes.
+void WriteReliableHeader(char* header, boost::uint32_t session,
+    boost::uint32_t sequence, std::size_t packet_size);
+
+/// Write an acknowledgement of RELIABLE_ACK_SIZE bytes.
+void WriteReliableAck(char* ack, boost::uint32_t session,
+    boost::uint32_t sequence);
+
+/// Returns true if @a data is an acknowledgement and sets @a session and @a
+/// sequence.
+bool ParseReliableAck(const char* data, std::size_t size,
+    boost::uint32_t* session, boost::uint32_t* sequence);
+
+/// Receive side of reliable datagrams for a single sender. Servers (or the
+/// am_reliable_shim in front of them) keep one per source address.
+class ReliableReceiver {
+ public:
+  enum Result {
+    NOT_RELIABLE,   ///< Regular packet, to be processed as is.
+    NEW_MESSAGE,    ///< First copy of a reliable message; deliver and ack.
+    DUPLICATE,      ///< Message already delivered; ack only.
+    INVALID         ///< Malformed reliable message; ignore.
+  };
+
+  ReliableReceiver();
+
+  /// Process a datagram. For NEW_MESSAGE, @a packet and @a packet_size are
+  /// set to the wrapped packet. For NEW_MESSAGE and DUPLICATE, @a ack is
+  /// filled with RELIABLE_ACK_SIZE bytes to send back to the sender.
+  Result Receive(const char* data, std::size_t size, const char** packet,
+      std::size_t* packet_size, char* ack);
+
+  std::size_t delivered() const { return delivered_; }
+  std::size_t duplicates() const { return duplicates_; }
+
+ private:
+  enum {
+    /// Out of order sequence numbers remembered before the oldest gap is
+    /// assumed to be a message the sender gave up on.
+    MAX_OUT_OF_ORDER = 1024
+  };
+
+  bool has_session_;
+  boost::uint32_t session_;
+  /// Every sequence number below this one was received.
+  boost::uint32_t next_expected_;
+  /// Sequence numbers received beyond @a next_expected_.
+  std::set<boost::uint32_t> received_;
+  std::size_t delivered_;
+  std::size_t duplicates_;
+};
+
+} // namespace am
+
+#endif // _RELIABLE_UDP_HPP_
@@ -0,0 +1,172 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "asset_manager_client.hpp"
+
+#include "osc_packer.hpp"
+
+using namespace am;
+
+namespace {
+
+// Index of the lowest set bit of @a word, which must not be 0
+inline int LowestBit(unsigned int word)
+{
+#if defined(__GNUC__)
+  return __builtin_ctz(word);
+#else
+  int bit = 0;
+  while (!(word & 1u)) {
+    word >>= 1;
+    bit++;
+  }
+  return bit;
+#endif
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+SceneState::SceneState(const Project& project, const std::string& url)
+: project_(project)
+, prefix_(project.base_address() + url + "/")
+, refresh_period_(0)
+, refresh_cursor_(0)
+{
+}
+
+std::size_t SceneState::AddObject(int id)
+{
+  std::size_t index = ids_.size();
+  if (index % WORD_BITS == 0) {
+    for (int p = 0; p < PARAMETER_COUNT; ++p) dirty_[p].push_back(0);
+  }
+  ids_.push_back(id);
+  x_.push_back(0.0f);
+  y_.push_back(0.0f);
+  z_.push_back(0.0f);
+  gain_.push_back(1.0f);
+  mute_.push_back(0);
+  for (int p = 0; p < PARAMETER_COUNT; ++p) MarkDirty(p, index);
+  return index;
+}
+
+void SceneState::SetPosition(std::size_t index, float x, float y, float z)
+{
+  if (x_[index] == x && y_[index] == y && z_[index] == z) return;
+  x_[index] = x;
+  y_[index] = y;
+  z_[index] = z;
+  MarkDirty(POSITION, index);
+}
+
+void SceneState::SetGain(std::size_t index, float gain)
+{
+  if (gain_[index] == gain) return;
+  gain_[index] = gain;
+  MarkDirty(GAIN, index);
+}
+
+void SceneState::SetMute(std::size_t index, bool mute)
+{
+  if (mute_[index] == (mute ? 1 : 0)) return;
+  mute_[index] = mute ? 1 : 0;
+  MarkDirty(MUTE, index);
+}
+
+void SceneState::MarkAllDirty()
+{
+  std::size_t words = dirty_[POSITION].size();
+  if (words == 0) return;
+  // Bits past the last object stay clear
+  unsigned int last = ids_.size() % WORD_BITS ?
+    (1u << ids_.size() % WORD_BITS) - 1 : ~0u;
+  for (int p = 0; p < PARAMETER_COUNT; ++p) {
+    for (std::size_t w = 0; w + 1 < words; ++w) dirty_[p][w] = ~0u;
+    dirty_[p][words - 1] = last;
+  }
+}
+
+void SceneState::SetRefreshPeriod(std::size_t flushes)
+{
+  refresh_period_ = flushes;
+}
+
+void SceneState::Refresh()
+{
+  std::size_t count = ids_.size();
+  std::size_t slice = (count + refresh_period_ - 1) / refresh_period_;
+  for (std::size_t i = 0; i < slice; ++i) {
+    if (refresh_cursor_ >= count) refresh_cursor_ = 0;
+    for (int p = 0; p < PARAMETER_COUNT; ++p) MarkDirty(p, refresh_cursor_);
+    refresh_cursor_++;
+  }
+}
+
+std::size_t SceneState::Flush()
+{
+  AssetManagerClient* client = project_.client_;
+  if (!client || ids_.empty()) return 0;
+  if (refresh_period_) Refresh();
+
+  ObjectEncoder position(prefix_.data(), prefix_.size(), "/pos");
+  ObjectEncoder gain(prefix_.data(), prefix_.size(), "/gain");
+  ObjectEncoder mute(prefix_.data(), prefix_.size(), "/mute", 'i');
+
+  // A bit is cleared once its message was accepted, so that a message
+  // dropped e.g. by the memory limit is sent again by the next Flush
+  AssetManagerClient::ImplicitBundle bundle(client);
+  std::size_t sent = 0;
+  std::size_t words = dirty_[POSITION].size();
+  for (std::size_t w = 0; w < words; ++w) {
+    unsigned int positions = dirty_[POSITION][w];
+    unsigned int gains = dirty_[GAIN][w];
+    unsigned int mutes = dirty_[MUTE][w];
+    unsigned int any = positions | gains | mutes;
+    while (any) {
+      int bit = LowestBit(any);
+      unsigned int mask = 1u << bit;
+      any &= any - 1;
+      std::size_t i = w * WORD_BITS + bit;
+      if (positions & mask) {
+        float xyz[3] = { x_[i], y_[i], z_[i] };
+        position.set_object(ids_[i], xyz, 3);
+        if (bundle.Send(position)) {
+          dirty_[POSITION][w] &= ~mask;
+          sent++;
+        }
+      }
+      if (gains & mask) {
+        gain.set_object(ids_[i], &gain_[i], 1);
+        if (bundle.Send(gain)) {
+          dirty_[GAIN][w] &= ~mask;
+          sent++;
+        }
+      }
+      if (mutes & mask) {
+        mute.set_object(ids_[i], &mute_[i], 1);
+        if (bundle.Send(mute)) {
+          dirty_[MUTE][w] &= ~mask;
+          sent++;
+        }
+      }
+    }
+  }
+  return sent;
+}
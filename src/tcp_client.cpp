@@ -19,6 +19,7 @@
 // THE SOFTWARE.
 #include "tcp_client.hpp"
 
+#include <algorithm>
 #include <iostream>
 
 #if defined(_WIN32)
@@ -31,17 +32,31 @@ using namespace am;
 namespace asio = boost::asio;
 
 //-----------------------------------------------------------------------------
-TCPClient::AsyncTCPClient::AsyncTCPClient(asio::io_service& io_service,
-    boost::condition_variable& cond, boost::mutex& mut)
-: io_service_(io_service)
+TCPClient::AsyncTCPClient::AsyncTCPClient(TCPClient& owner,
+    asio::io_service& io_service, boost::condition_variable& cond,
+    boost::mutex& mut)
+: owner_(owner)
+, io_service_(io_service)
 , socket_(io_service)
 , connected_(false)
 , connecting_(false)
 , write_in_progress_(false)
 , msg_to_send_(false)
+, writing_lane_(PRIORITY_BULK)
 , write_progress_cond_(cond)
 , write_progress_mut_(mut)
+, queued_seq_(0)
+, completed_seq_(0)
 {
+  stats_.messages_sent = 0;
+  stats_.bytes_sent = 0;
+  stats_.errors = 0;
+  stats_.connected = false;
+  for (int i = 0; i < PRIORITY_COUNT; ++i) {
+    stats_.queues[i].queued = 0;
+    stats_.queues[i].peak_queued = 0;
+    stats_.queues[i].sent = 0;
+  }
 }
 
 TCPClient::AsyncTCPClient::~AsyncTCPClient()
@@ -61,7 +76,15 @@ void TCPClient::AsyncTCPClient::Connect(
   }
 }
 
-void TCPClient::AsyncTCPClient::Send(const std::vector<char>& msg)
+void TCPClient::AsyncTCPClient::EnsureConnecting()
+{
+  if (endpoint_iterator_ != asio::ip::tcp::resolver::iterator() &&
+      !connected_ && !connecting_) {
+    DoConnect();
+  }
+}
+
+void TCPClient::AsyncTCPClient::Send(const MessageBufferPtr& msg)
 {
   msg_to_send_ = true;
   io_service_.post(boost::bind(&AsyncTCPClient::DoSend, this, msg));
@@ -72,6 +95,64 @@ void TCPClient::AsyncTCPClient::Close()
   io_service_.post(boost::bind(&AsyncTCPClient::DoClose, this));
 }
 
+TCPClient::Statistics TCPClient::AsyncTCPClient::GetStatistics() const
+{
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  return stats_;
+}
+
+void TCPClient::AsyncTCPClient::SetConnected(bool connected)
+{
+  connected_ = connected;
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  stats_.connected = connected;
+}
+
+void TCPClient::AsyncTCPClient::CountError()
+{
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  stats_.errors++;
+}
+
+void TCPClient::AsyncTCPClient::Complete(boost::uint64_t sequence)
+{
+  if (sequence <= completed_seq_) return;
+  completed_seq_ = sequence;
+  owner_.HandleCompleted();
+}
+
+void TCPClient::AsyncTCPClient::ClearQueue()
+{
+  // dropped messages count as completed so nothing waits for them forever
+  write_msgs_.clear();
+  {
+    boost::lock_guard<boost::mutex> lock(stats_mut_);
+    for (int i = 0; i < PRIORITY_COUNT; ++i) stats_.queues[i].queued = 0;
+  }
+  Complete(queued_seq_);
+}
+
+void TCPClient::AsyncTCPClient::Enqueue(const MessageBufferPtr& msg,
+    bool front)
+{
+  if (front) {
+    write_msgs_.push_front(msg);
+  } else {
+    write_msgs_.push_back(msg);
+  }
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  QueueStatistics& queue = stats_.queues[msg->priority()];
+  if (++queue.queued > queue.peak_queued) queue.peak_queued = queue.queued;
+}
+
+boost::uint64_t TCPClient::AsyncTCPClient::WrittenThrough() const
+{
+  // Urgent messages may be written ahead of earlier bulk messages, so the
+  // stream is only complete up to the oldest message still queued
+  boost::uint64_t oldest = write_msgs_.min_sequence();
+  return oldest ? oldest - 1 : queued_seq_;
+}
+
 void TCPClient::AsyncTCPClient::DoConnect()
 {
   connecting_ = true;
@@ -94,31 +175,32 @@ void TCPClient::AsyncTCPClient::HandleConnect(
           boost::bind(&AsyncTCPClient::HandleConnect, this,
             asio::placeholders::error, ++endpoint_iterator));
     } else {
-      connected_ = false;
+      SetConnected(false);
+      CountError();
       {
         boost::lock_guard<boost::mutex> lock(write_progress_mut_);
         connecting_ = false;
       }
-      write_msgs_.clear();
+      ClearQueue();
       write_progress_cond_.notify_all();
+      owner_.HandleConnectDone();
     }
   } else if (connecting_) {
-    connected_ = true;
+    SetConnected(true);
     connecting_ = false;
-    if (!write_in_progress_ && (!write_msgs_.empty() || !prev_.msg_.empty())) {
-      if (!prev_.msg_.empty()) {
+    owner_.HandleConnectDone();
+    if (!write_in_progress_ && (!write_msgs_.empty() || prev_.msg_)) {
+      if (prev_.msg_) {
         using namespace boost::posix_time;
         time_duration td = second_clock::local_time() -  prev_.time_;
         if (td.seconds() < TIMEOUT_SECONDS) {
-          write_msgs_.push_front(prev_.msg_);
+          Enqueue(prev_.msg_, true);
         }
       }
 
       if (!write_msgs_.empty()) {
         write_in_progress_ = true;
-        socket_.async_write_some(asio::buffer(write_msgs_.front()),
-            boost::bind(&AsyncTCPClient::HandleWrite, this,
-              asio::placeholders::error));
+        StartWrite();
       }
     }
   } else {
@@ -130,39 +212,69 @@ void TCPClient::AsyncTCPClient::HandleConnect(
   }
 }
 
-void TCPClient::AsyncTCPClient::DoSend(const std::vector<char> msg)
+void TCPClient::AsyncTCPClient::DoSend(MessageBufferPtr msg)
 {
+  if (endpoint_iterator_ == asio::ip::tcp::resolver::iterator()) {
+    // the host did not resolve; there is nothing to connect to
+    {
+      boost::lock_guard<boost::mutex> lock(write_progress_mut_);
+      msg_to_send_ = false;
+    }
+    write_progress_cond_.notify_all();
+    Complete(msg->sequence());
+    return;
+  }
+
   if (!connected_ && !connecting_) {
     DoConnect();
   }
 
-  // construct a message with prefixed length
-  std::vector<char> prefixed_msg(msg.size() + 4);
-  int32_t frame_size = htonl(msg.size());
-  memcpy(&prefixed_msg[0], &frame_size, 4);
-  std::copy(msg.begin(), msg.end(), prefixed_msg.begin() + 4);
+  // prefix the message length in the headroom of the buffer
+  msg->WriteSizePrefix();
 
-  write_msgs_.push_back(prefixed_msg);
+  queued_seq_ = msg->sequence();
+  Enqueue(msg, false);
   if (!write_in_progress_ && !connecting_) {
     write_in_progress_ = true;
-    socket_.async_write_some(asio::buffer(write_msgs_.front()),
-        boost::bind(&AsyncTCPClient::HandleWrite, this,
-          asio::placeholders::error));
+    StartWrite();
   }
   msg_to_send_ = false;
 }
 
+void TCPClient::AsyncTCPClient::StartWrite()
+{
+  // pick the class at each message boundary so urgent messages go first
+  writing_lane_ = write_msgs_.next();
+  const MessageBufferPtr& msg = write_msgs_.lane(writing_lane_).front();
+  asio::async_write(socket_, GatherBuffers(*msg, true),
+      boost::bind(&AsyncTCPClient::HandleWrite, this,
+        asio::placeholders::error));
+}
+
 void TCPClient::AsyncTCPClient::HandleWrite(
     const boost::system::error_code& error)
 {
   if (!error) {
+    MessageQueue& lane = write_msgs_.lane(writing_lane_);
+    {
+      boost::lock_guard<boost::mutex> lock(stats_mut_);
+      stats_.messages_sent++;
+      stats_.bytes_sent += lane.front()->total_size() + 4;
+      stats_.queues[writing_lane_].queued--;
+      stats_.queues[writing_lane_].sent++;
+    }
     prev_.time_ = boost::posix_time::second_clock::local_time();
-    prev_.msg_ = write_msgs_.front();
-    write_msgs_.pop_front();
+    // a message with blobs is not kept for a resend, as it would keep the
+    // caller's blobs from being released until the next write
+    if (lane.front()->blob_count()) {
+      prev_.msg_.reset();
+    } else {
+      prev_.msg_ = lane.front();
+    }
+    lane.pop_front();
+    Complete(WrittenThrough());
     if (!write_msgs_.empty()) {
-      socket_.async_write_some(asio::buffer(write_msgs_.front()),
-          boost::bind(&AsyncTCPClient::HandleWrite, this,
-            asio::placeholders::error));
+      StartWrite();
     } else {
       {
         boost::lock_guard<boost::mutex> lock(write_progress_mut_);
@@ -171,11 +283,12 @@ void TCPClient::AsyncTCPClient::HandleWrite(
       write_progress_cond_.notify_all();
     }
   } else {
+    CountError();
     // when the error is EPIPE, there is a chance that the server was
     // temporarily dropped but is still online. Close the socket and try
     // reconnecting to the server.
     if (error == boost::system::errc::broken_pipe) {
-      connected_ = false;
+      SetConnected(false);
       connecting_ = false;
       write_in_progress_ = false;
       socket_.close();
@@ -193,41 +306,128 @@ void TCPClient::AsyncTCPClient::HandleWrite(
 
 void TCPClient::AsyncTCPClient::DoClose()
 {
-  connected_ = false;
+  SetConnected(false);
   connecting_ = false;
   write_in_progress_ = false;
   socket_.close();
-  prev_.msg_.clear();
-  write_msgs_.clear();
+  prev_.msg_.reset();
+  ClearQueue();
 }
 
 //-----------------------------------------------------------------------------
-TCPClient::TCPClient(const std::string& host, int port)
-: host_(host)
+TCPClient::TCPClient(const std::vector<std::string>& hosts, int port)
+: hosts_(hosts)
 , port_(port)
-, client_(io_service_, write_progress_cond_, write_progress_mut_)
+, sequence_(0)
+, written_seq_(0)
 , service_is_ready_(false)
 , thread_is_running_(false)
 {
+  for (std::size_t i = 0; i < hosts_.size(); ++i) {
+    clients_.push_back(new AsyncTCPClient(*this, io_service_,
+          write_progress_cond_, write_progress_mut_));
+  }
 }
 
 TCPClient::~TCPClient()
 {
   if (thread_is_running_) {
     if (service_is_ready_) {
-      client_.Close();
+      for (std::size_t i = 0; i < clients_.size(); ++i) clients_[i]->Close();
       io_service_.stop();
       thread_.join();
     } else {
       thread_.timed_join(boost::posix_time::seconds(0));
     }
   }
+  for (std::size_t i = 0; i < clients_.size(); ++i) delete clients_[i];
 }
 
-void TCPClient::Send(const std::vector<char>& msg)
+void TCPClient::Send(const MessageBufferPtr& msg)
 {
+  if (!msg) return;
   if (!thread_is_running_ && !RunThread()) return;
-  client_.Send(msg);
+  msg->set_sequence(++sequence_);
+  for (std::size_t i = 0; i < clients_.size(); ++i) clients_[i]->Send(msg);
+}
+
+void TCPClient::SetWrittenHandler(const WrittenHandler& handler)
+{
+  written_handler_ = handler;
+}
+
+void TCPClient::HandleCompleted()
+{
+  // A message is written once every connection is done with it
+  boost::uint64_t written = clients_[0]->completed_sequence();
+  for (std::size_t i = 1; i < clients_.size(); ++i) {
+    written = std::min(written, clients_[i]->completed_sequence());
+  }
+  if (written > written_seq_) {
+    written_seq_ = written;
+    if (written_handler_) written_handler_(written);
+
+    std::size_t done = 0;
+    while (done < flush_waiters_.size() &&
+        flush_waiters_[done].sequence <= written) {
+      io_service_.post(boost::bind(flush_waiters_[done].done, true));
+      done++;
+    }
+    flush_waiters_.erase(flush_waiters_.begin(),
+        flush_waiters_.begin() + done);
+  }
+}
+
+void TCPClient::HandleConnectDone()
+{
+  if (connect_waiters_.empty()) return;
+  bool connected = true;
+  for (std::size_t i = 0; i < clients_.size(); ++i) {
+    if (clients_[i]->Connecting()) return;
+    connected = connected && clients_[i]->Connected();
+  }
+  // Completions are posted so that they may start new waits
+  for (std::size_t i = 0; i < connect_waiters_.size(); ++i) {
+    io_service_.post(boost::bind(connect_waiters_[i], connected));
+  }
+  connect_waiters_.clear();
+}
+
+void TCPClient::AsyncFlush(const Completion& done)
+{
+  if (!thread_is_running_) {
+    done(true);
+    return;
+  }
+  io_service_.post(boost::bind(&TCPClient::DoFlush, this, sequence_, done));
+}
+
+void TCPClient::DoFlush(boost::uint64_t sequence, Completion done)
+{
+  if (sequence <= written_seq_) {
+    done(true);
+  } else {
+    FlushWaiter waiter = { sequence, done };
+    flush_waiters_.push_back(waiter);
+  }
+}
+
+void TCPClient::AsyncWaitConnected(const Completion& done)
+{
+  if (!thread_is_running_ && !RunThread()) {
+    done(false);
+    return;
+  }
+  io_service_.post(boost::bind(&TCPClient::DoWaitConnected, this, done));
+}
+
+void TCPClient::DoWaitConnected(Completion done)
+{
+  for (std::size_t i = 0; i < clients_.size(); ++i) {
+    clients_[i]->EnsureConnecting();
+  }
+  connect_waiters_.push_back(done);
+  HandleConnectDone();
 }
 
 void TCPClient::BlockUntilQueueIsEmpty()
@@ -236,13 +436,37 @@ void TCPClient::BlockUntilQueueIsEmpty()
   while (thread_is_running_ && !service_is_ready_);
 
   boost::unique_lock<boost::mutex> lock(write_progress_mut_);
-  while (client_.WriteInProgress() || 
-      client_.HaveMsgToSend() || 
-      client_.Connecting()) {
-    write_progress_cond_.wait(lock);
+  for (std::size_t i = 0; i < clients_.size(); ++i) {
+    AsyncTCPClient& client = *clients_[i];
+    while (client.WriteInProgress() ||
+        client.HaveMsgToSend() ||
+        client.Connecting()) {
+      write_progress_cond_.wait(lock);
+    }
   }
 }
 
+TCPClient::Statistics TCPClient::GetStatistics(std::size_t host) const
+{
+  return clients_[host]->GetStatistics();
+}
+
+void TCPClient::SetThreadOptions(const ThreadOptions& options)
+{
+  if (thread_is_running_) {
+    io_service_.post(boost::bind(&TCPClient::ApplyThreadOptions, this,
+          options));
+  } else {
+    thread_options_ = options;
+  }
+}
+
+void TCPClient::ApplyThreadOptions(ThreadOptions options)
+{
+  thread_options_ = options;
+  ConfigureThread(thread_options_, "am_tcp");
+}
+
 bool TCPClient::RunThread()
 {
   bool success = true;
@@ -263,15 +487,25 @@ void TCPClient::Run()
   std::stringstream port_string;
   port_string << port_;
 
+  ConfigureThread(thread_options_, "am_tcp");
+
   using asio::ip::tcp;
   try {
     tcp::resolver resolver(io_service_);
-    tcp::resolver::query query(host_, port_string.str());
-    asio::ip::tcp::resolver::iterator iterator = resolver.resolve(query);
-    client_.Connect(iterator);
+    for (std::size_t i = 0; i < hosts_.size(); ++i) {
+      // A host that does not resolve is skipped, the others are still served
+      try {
+        tcp::resolver::query query(hosts_[i], port_string.str());
+        asio::ip::tcp::resolver::iterator iterator = resolver.resolve(query);
+        clients_[i]->Connect(iterator);
+      } catch (std::exception& e) {
+        std::cerr << "TCPClient::Run(): " << hosts_[i] << " -> " << e.what()
+          << "\n";
+      }
+    }
     asio::io_service::work work(io_service_);
     service_is_ready_ = true;
-    io_service_.run();
+    RunIoService(io_service_, thread_options_.busy_poll_us);
   } catch (std::exception& e) {
     std::cerr << "TCPClient::Run(): exception -> " << e.what() << "\n";
   }
@@ -279,4 +513,3 @@ void TCPClient::Run()
   service_is_ready_ = false;
   thread_is_running_ = false;
 }
-
@@ -21,28 +21,56 @@
 #define _TCP_CLIENT_HPP_
 
 #include <string>
-#include <deque>
 #include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
+#include <boost/function.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 
+#include "completion.hpp"
 #include "disallow_copy_and_assign.hpp"
+#include "message_buffer.hpp"
+#include "thread_config.hpp"
 
 namespace am {
 
 /// Wrapper for boost::asio::tcp
+///
+/// Keeps one connection to each host of the list given to the constructor.
+/// All connections are served by the same I/O thread and share the buffers
+/// of the messages sent.
 class TCPClient {
  public:
-  TCPClient(const std::string& host, int port);
+  TCPClient(const std::vector<std::string>& hosts, int port);
   ~TCPClient();
 
-  /// Send a message. If a connection to the server does not exist, the
-  /// connection attemp is made before the message is sent.
-  void Send(const std::vector<char>& msg);
+  /// Send a message to every host. If a connection to a server does not
+  /// exist, the connection attemp is made before the message is sent. The
+  /// message is framed in place using the headroom of @a msg and is not
+  /// copied. A null buffer, e.g. one refused by the memory cap, is ignored.
+  ///
+  /// Each connection queues the message in the class of @a msg->priority()
+  /// and writes urgent messages before bulk ones, one whole message at a
+  /// time.
+  ///
+  /// Messages are numbered in the order they are sent, starting at 1; see
+  /// @a last_sequence and @a SetWrittenHandler.
+  void Send(const MessageBufferPtr& msg);
+
+  /// Sequence number of the last message passed to @a Send, 0 if none.
+  boost::uint64_t last_sequence() const { return sequence_; }
+
+  /// Called on the I/O thread with a sequence number once the message with
+  /// that number, and every message before it, has been written to every
+  /// connection or dropped (e.g. because the host is unreachable). An urgent
+  /// message written ahead of earlier bulk messages is reported once those
+  /// are written as well.
+  typedef boost::function<void (boost::uint64_t)> WrittenHandler;
+  void SetWrittenHandler(const WrittenHandler& handler);
 
   /// Can be used before exiting the program to make sure all messages are sent
   /// or at least processed before abruptly exiting the program. This is
@@ -50,6 +78,32 @@ class TCPClient {
   /// a call to Send does not gaurantee delivery.
   void BlockUntilQueueIsEmpty();
 
+  /// Asynchronous variant of @a BlockUntilQueueIsEmpty: calls @a done on the
+  /// I/O thread once every message sent so far has been written or dropped.
+  /// If no message was ever sent, @a done is called right away.
+  void AsyncFlush(const Completion& done);
+
+  /// Connect to the hosts that are not connected and call @a done on the I/O
+  /// thread once no connection attempt is in progress. Succeeds if every
+  /// host is connected.
+  void AsyncWaitConnected(const Completion& done);
+
+  /// Traffic sent to one host and state of its connection.
+  struct Statistics {
+    std::size_t messages_sent;
+    std::size_t bytes_sent;
+    std::size_t errors;       ///< Failed connection attempts and writes.
+    bool connected;
+    QueueStatistics queues[PRIORITY_COUNT];
+  };
+
+  std::size_t host_count() const { return hosts_.size(); }
+  Statistics GetStatistics(std::size_t host) const;
+
+  /// Configure the I/O thread (see ConfigureThread). Applied when the thread
+  /// starts, or right away by the thread if it is already running.
+  void SetThreadOptions(const ThreadOptions& options);
+
   enum {
     /// Used to determine timeout period that determines to resend a message in
     /// case the second message returns EPIPE so that the first message will be
@@ -64,26 +118,42 @@ class TCPClient {
   /// network IO events.
   class AsyncTCPClient {
    public:
-    AsyncTCPClient(boost::asio::io_service& io_service,
+    AsyncTCPClient(TCPClient& owner, boost::asio::io_service& io_service,
         boost::condition_variable& cond, boost::mutex& mut);
     ~AsyncTCPClient();
 
     void Connect(boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
-    void Send(const std::vector<char>& msg);
+    void Send(const MessageBufferPtr& msg);
     void Close();
     bool WriteInProgress() const { return write_in_progress_; }
     bool HaveMsgToSend() const { return msg_to_send_; }
     bool Connecting() const { return connecting_; }
+    bool Connected() const { return connected_; }
+    /// Start connecting unless connected, connecting or unresolved.
+    void EnsureConnecting();
+    Statistics GetStatistics() const;
+    /// Sequence number up to which messages were written or dropped.
+    boost::uint64_t completed_sequence() const { return completed_seq_; }
 
    private:
     void DoConnect();
     void HandleConnect(const boost::system::error_code& error,
         boost::asio::ip::tcp::resolver::iterator endpoint_iterator);
 
-    void DoSend(const std::vector<char> msg);
+    void DoSend(MessageBufferPtr msg);
+    void StartWrite();
     void HandleWrite(const boost::system::error_code& error);
     void DoClose();
-
+    void SetConnected(bool connected);
+    void CountError();
+    void Complete(boost::uint64_t sequence);
+    void ClearQueue();
+    /// Queue @a msg at the back of its class, or at the front to resend it.
+    void Enqueue(const MessageBufferPtr& msg, bool front);
+    /// Sequence number up to which no message is queued anymore.
+    boost::uint64_t WrittenThrough() const;
+
+    TCPClient& owner_;
     boost::asio::io_service& io_service_;
     boost::asio::ip::tcp::socket socket_;
     bool connected_;
@@ -92,28 +162,59 @@ class TCPClient {
     bool msg_to_send_;
     struct {
       boost::posix_time::ptime time_;
-      std::vector<char> msg_;
+      MessageBufferPtr msg_;
     } prev_;
-    std::deque< std::vector<char> > write_msgs_;
+    PriorityQueue write_msgs_;
+    /// Class of the message being written.
+    int writing_lane_;
     boost::condition_variable& write_progress_cond_;
     boost::mutex& write_progress_mut_;
     boost::asio::ip::tcp::resolver::iterator endpoint_iterator_;
+    Statistics stats_;
+    mutable boost::mutex stats_mut_;
+    boost::uint64_t queued_seq_;
+    boost::uint64_t completed_seq_;
+  };
+
+  /// Called on the I/O thread when a connection completed messages.
+  void HandleCompleted();
+
+  /// Called on the I/O thread when a connection attempt finished.
+  void HandleConnectDone();
+
+  void DoFlush(boost::uint64_t sequence, Completion done);
+  void DoWaitConnected(Completion done);
+
+  struct FlushWaiter {
+    boost::uint64_t sequence;
+    Completion done;
   };
 
   /// Thread is lazily created when Send funciton is called.
   bool RunThread();
 
-  /// Thread to run AsyncTCPClient. This function calls AsyncTCPClient's
-  /// Connect and io_serivce's run to start the AsyncTCPClient service.
+  void ApplyThreadOptions(ThreadOptions options);
+
+  /// Thread to run the AsyncTCPClients. This function calls
+  /// AsyncTCPClient's Connect for each host and io_service's run to start
+  /// the AsyncTCPClient service.
   /// When the server closes the connection or if there is any error in
   /// AsyncTCPClient, io_service stops and this function exists, setting
   /// thread_is_running_ variable to false.
   void Run();
 
-  std::string host_;
+  std::vector<std::string> hosts_;
   int port_;
   boost::asio::io_service io_service_;
-  AsyncTCPClient client_;
+  std::vector<AsyncTCPClient*> clients_;
+  boost::uint64_t sequence_;
+  boost::uint64_t written_seq_;
+  WrittenHandler written_handler_;
+  /// Flushes waiting for a message to be written, in sequence order.
+  std::vector<FlushWaiter> flush_waiters_;
+  std::vector<Completion> connect_waiters_;
+  /// Owned by the I/O thread while it is running.
+  ThreadOptions thread_options_;
   bool service_is_ready_;
   bool thread_is_running_;
   boost::thread thread_;
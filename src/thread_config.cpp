@@ -0,0 +1,105 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "thread_config.hpp"
+
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#if !defined(_WIN32)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+using namespace am;
+
+//-----------------------------------------------------------------------------
+void am::ConfigureThread(const ThreadOptions& options,
+    const char* default_name)
+{
+#if defined(_WIN32)
+  (void)options;
+  (void)default_name;
+#else
+  std::string name = options.name.empty() ? default_name : options.name;
+  // Linux limits names to 15 characters
+  name = name.substr(0, 15);
+#if defined(__linux__)
+  pthread_setname_np(pthread_self(), name.c_str());
+#elif defined(__APPLE__)
+  pthread_setname_np(name.c_str());
+#endif
+
+#if defined(__linux__)
+  if (options.cpu >= 0) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(options.cpu, &cpus);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (error) {
+      std::cerr << name << ": CPU affinity " << options.cpu << " -> "
+        << strerror(error) << "\n";
+    }
+  }
+#endif
+
+  // Without a policy or priority, the scheduling the thread inherited stays
+  if (options.policy != ThreadOptions::SCHEDULE_DEFAULT ||
+      options.priority != 0) {
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    int policy = SCHED_OTHER;
+    if (options.policy != ThreadOptions::SCHEDULE_DEFAULT) {
+      policy = options.policy == ThreadOptions::SCHEDULE_FIFO ?
+        SCHED_FIFO : SCHED_RR;
+    }
+    param.sched_priority = options.priority;
+    int error = pthread_setschedparam(pthread_self(), policy, &param);
+    if (error) {
+      std::cerr << name << ": scheduling policy -> " << strerror(error)
+        << "\n";
+    }
+  }
+#endif
+}
+
+void am::RunIoService(boost::asio::io_service& io_service,
+    const int& busy_poll_us)
+{
+  using namespace boost::posix_time;
+  ptime idle_since = microsec_clock::universal_time();
+  while (!io_service.stopped()) {
+    if (busy_poll_us > 0) {
+      if (io_service.poll() > 0) {
+        idle_since = microsec_clock::universal_time();
+        continue;
+      }
+      if (microsec_clock::universal_time() - idle_since <
+          microseconds(busy_poll_us)) {
+        continue;
+      }
+    }
+    // Sleep until the next handler is ready
+    io_service.run_one();
+    idle_since = microsec_clock::universal_time();
+  }
+}
@@ -0,0 +1,43 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _THREAD_CONFIG_HPP_
+#define _THREAD_CONFIG_HPP_
+
+#include <boost/asio/io_service.hpp>
+
+#include "thread_options.hpp"
+
+namespace am {
+
+/// Name the calling thread and set its CPU affinity and scheduling policy as
+/// given by @a options. @a default_name is used if @a options has no name.
+/// Settings that cannot be applied are reported on std::cerr.
+void ConfigureThread(const ThreadOptions& options, const char* default_name);
+
+/// Run @a io_service until it is stopped. While @a busy_poll_us is positive,
+/// the thread keeps polling for ready handlers for that many microseconds
+/// after the last one instead of sleeping in the kernel. @a busy_poll_us is
+/// read on every iteration so handlers may change it.
+void RunIoService(boost::asio::io_service& io_service,
+    const int& busy_poll_us);
+
+} // namespace am
+
+#endif // _THREAD_CONFIG_HPP_
@@ -0,0 +1,230 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#include "traffic_log.hpp"
+
+#include <cerrno>
+#include <cstddef>
+#include <cstring>
+#include <iostream>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "message_buffer.hpp"
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace am;
+
+namespace {
+
+std::size_t Padded(std::size_t size)
+{
+  return (size + 3) & ~(std::size_t)3;
+}
+
+} // namespace
+
+//-----------------------------------------------------------------------------
+TrafficRecorder::TrafficRecorder()
+: fd_(-1)
+, map_(NULL)
+, map_offset_(0)
+, map_size_(0)
+, size_(0)
+{
+}
+
+TrafficRecorder::~TrafficRecorder()
+{
+  Close();
+}
+
+bool TrafficRecorder::Open(const std::string& path)
+{
+  Close();
+#if defined(_WIN32)
+  std::cerr << "Traffic recording is not supported on this platform\n";
+  return false;
+#else
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0) {
+    std::cerr << "Cannot create " << path << ": " << strerror(errno) << "\n";
+    return false;
+  }
+  char* magic = Reserve(sizeof(TRAFFIC_LOG_MAGIC));
+  if (!magic) return false;
+  memcpy(magic, TRAFFIC_LOG_MAGIC, sizeof(TRAFFIC_LOG_MAGIC));
+  return true;
+#endif
+}
+
+void TrafficRecorder::Close()
+{
+#if !defined(_WIN32)
+  if (fd_ < 0) return;
+  if (map_) munmap(map_, map_size_);
+  // Drop the zeroed tail reserved by the last mapping
+  if (ftruncate(fd_, size_) != 0) {
+    std::cerr << "Cannot truncate traffic log: " << strerror(errno) << "\n";
+  }
+  close(fd_);
+  fd_ = -1;
+  map_ = NULL;
+  map_offset_ = 0;
+  map_size_ = 0;
+  size_ = 0;
+#endif
+}
+
+void TrafficRecorder::Record(TrafficTransport transport,
+    const MessageBuffer& msg, std::size_t skip)
+{
+  if (fd_ < 0 || msg.total_size() <= skip) return;
+  std::size_t size = msg.total_size() - skip;
+  char* p = Reserve(sizeof(TrafficRecord) + Padded(size));
+  if (!p) return;
+
+  TrafficRecord record;
+  record.time_us = (boost::posix_time::microsec_clock::universal_time() -
+      boost::posix_time::from_time_t(0)).total_microseconds();
+  record.size = (boost::uint32_t)size;
+  record.transport = TRAFFIC_END;
+  memset(record.reserved, 0, sizeof(record.reserved));
+  memcpy(p, &record, sizeof(record));
+
+  char* out = p + sizeof(record);
+  GatherBuffers buffers(msg, false);
+  for (GatherBuffers::const_iterator it = buffers.begin();
+      it != buffers.end(); ++it) {
+    const char* bytes = static_cast<const char*>(it->data());
+    std::size_t n = it->size();
+    std::size_t skipped = skip < n ? skip : n;
+    skip -= skipped;
+    memcpy(out, bytes + skipped, n - skipped);
+    out += n - skipped;
+  }
+  // The padding is already zero. The transport is written last so that a
+  // record cut short by a crash reads as the end of the log.
+  p[offsetof(TrafficRecord, transport)] = (char)transport;
+}
+
+char* TrafficRecorder::Reserve(std::size_t n)
+{
+#if defined(_WIN32)
+  return NULL;
+#else
+  if (size_ + n > map_offset_ + map_size_) {
+    if (map_) munmap(map_, map_size_);
+    map_ = NULL;
+    // Map from the page holding the end of the log
+    std::size_t page = (std::size_t)sysconf(_SC_PAGESIZE);
+    map_offset_ = size_ / page * page;
+    std::size_t needed = (std::size_t)(size_ - map_offset_) + n;
+    map_size_ = (needed + MAP_SIZE - 1) / MAP_SIZE * MAP_SIZE;
+    void* map = MAP_FAILED;
+    if (ftruncate(fd_, map_offset_ + map_size_) == 0) {
+      map = mmap(NULL, map_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_,
+          map_offset_);
+    }
+    if (map == MAP_FAILED) {
+      std::cerr << "Cannot extend traffic log: " << strerror(errno)
+        << ", recording stopped\n";
+      map_size_ = 0;
+      Close();
+      return NULL;
+    }
+    map_ = static_cast<char*>(map);
+  }
+  char* p = map_ + (size_ - map_offset_);
+  size_ += n;
+  return p;
+#endif
+}
+
+//-----------------------------------------------------------------------------
+TrafficReader::TrafficReader()
+: map_(NULL)
+, size_(0)
+, position_(0)
+{
+}
+
+TrafficReader::~TrafficReader()
+{
+  Close();
+}
+
+bool TrafficReader::Open(const std::string& path)
+{
+  Close();
+#if defined(_WIN32)
+  return false;
+#else
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+  struct stat st;
+  void* map = MAP_FAILED;
+  if (fstat(fd, &st) == 0 && st.st_size >= (off_t)sizeof(TRAFFIC_LOG_MAGIC)) {
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (map == MAP_FAILED) return false;
+  map_ = static_cast<const char*>(map);
+  size_ = st.st_size;
+  if (memcmp(map_, TRAFFIC_LOG_MAGIC, sizeof(TRAFFIC_LOG_MAGIC)) != 0) {
+    Close();
+    return false;
+  }
+  Rewind();
+  return true;
+#endif
+}
+
+void TrafficReader::Close()
+{
+#if !defined(_WIN32)
+  if (map_) munmap(const_cast<char*>(map_), size_);
+#endif
+  map_ = NULL;
+  size_ = 0;
+  position_ = 0;
+}
+
+bool TrafficReader::Next(TrafficRecord* record, const char** packet)
+{
+  if (!map_ || size_ - position_ < sizeof(TrafficRecord)) return false;
+  memcpy(record, map_ + position_, sizeof(TrafficRecord));
+  if (record->transport == TRAFFIC_END) return false;
+  std::size_t padded = Padded(record->size);
+  if (size_ - position_ - sizeof(TrafficRecord) < padded) return false;
+  *packet = map_ + position_ + sizeof(TrafficRecord);
+  position_ += sizeof(TrafficRecord) + padded;
+  return true;
+}
+
+void TrafficReader::Rewind()
+{
+  position_ = sizeof(TRAFFIC_LOG_MAGIC);
+}
@@ -0,0 +1,130 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+#ifndef _TRAFFIC_LOG_HPP_
+#define _TRAFFIC_LOG_HPP_
+
+#include <cstddef>
+#include <string>
+
+#include <boost/cstdint.hpp>
+
+#include "disallow_copy_and_assign.hpp"
+
+namespace am {
+
+class MessageBuffer;
+
+/// Traffic logs.
+///
+/// A traffic log is an append-only file of the packets sent by a client,
+/// written through a memory mapping so that recording costs a copy into the
+/// page cache and no system call per packet. The file starts with the 8
+/// bytes "AMTRAFIC" followed by records, each made of a TrafficRecord header
+/// in host byte order and the packet padded to a multiple of 4 bytes. The
+/// file is grown in large steps and the unused tail is zero; a record whose
+/// @a transport is 0 marks the end of the log, so a log left behind by a
+/// crashed process can still be read.
+
+const char TRAFFIC_LOG_MAGIC[8] = { 'A', 'M', 'T', 'R', 'A', 'F', 'I', 'C' };
+
+/// Transport a packet was sent with.
+enum TrafficTransport {
+  TRAFFIC_END = 0,
+  TRAFFIC_TCP = 1,
+  TRAFFIC_UDP = 2,
+  TRAFFIC_RELIABLE_UDP = 3  ///< Recorded without the reliable header.
+};
+
+struct TrafficRecord {
+  boost::uint64_t time_us;  ///< Microseconds since the Unix epoch.
+  boost::uint32_t size;     ///< Packet size before padding.
+  boost::uint8_t transport; ///< A TrafficTransport.
+  boost::uint8_t reserved[3];
+};
+
+/// Appends packets to a traffic log.
+class TrafficRecorder {
+ public:
+  enum {
+    /// The file is mapped and grown by this many bytes at a time.
+    MAP_SIZE = 16 * 1024 * 1024
+  };
+
+  TrafficRecorder();
+  ~TrafficRecorder();
+
+  /// Create or truncate the log at @a path. Returns false on failure.
+  bool Open(const std::string& path);
+
+  /// Truncate the file to the recorded size and close it.
+  void Close();
+
+  bool is_open() const { return fd_ >= 0; }
+
+  /// Append @a msg, including its blobs, leaving out the first @a skip
+  /// bytes. Not thread-safe.
+  void Record(TrafficTransport transport, const MessageBuffer& msg,
+      std::size_t skip=0);
+
+  /// Number of bytes written to the log.
+  boost::uint64_t size() const { return size_; }
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(TrafficRecorder);
+
+  /// Returns a pointer to @a n bytes at the end of the log, mapping the next
+  /// part of the file if needed, or NULL on failure.
+  char* Reserve(std::size_t n);
+
+  int fd_;
+  char* map_;
+  boost::uint64_t map_offset_;
+  std::size_t map_size_;
+  boost::uint64_t size_;
+};
+
+/// Reads a traffic log.
+class TrafficReader {
+ public:
+  TrafficReader();
+  ~TrafficReader();
+
+  /// Map the log at @a path. Returns false if it cannot be read or is not a
+  /// traffic log.
+  bool Open(const std::string& path);
+  void Close();
+
+  /// Read the next record. Returns false at the end of the log.
+  bool Next(TrafficRecord* record, const char** packet);
+
+  /// Read again from the first record.
+  void Rewind();
+
+ private:
+  DISALLOW_COPY_AND_ASSIGN(TrafficReader);
+
+  const char* map_;
+  std::size_t size_;
+  std::size_t position_;
+};
+
+} // namespace am
+
+#endif // _TRAFFIC_LOG_HPP_
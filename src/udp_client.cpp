@@ -19,23 +19,89 @@
 // THE SOFTWARE.
 #include "udp_client.hpp"
 
+#include <algorithm>
 #include <iostream>
 
+#include "reliable_udp.hpp"
+
+#if !defined(_WIN32)
+#include <errno.h>
+#include <string.h>
+#include <sys/socket.h>
+#endif
+
 using namespace am;
 
 namespace asio = boost::asio;
 
+namespace {
+
+// Session ids only need to differ between client instances talking to the
+// same receiver, so the clock mixed with the address of the client will do.
+boost::uint32_t NewSession(const void* client)
+{
+  boost::posix_time::ptime now =
+    boost::posix_time::microsec_clock::universal_time();
+  boost::uint64_t us = (now - boost::posix_time::from_time_t(0))
+    .total_microseconds();
+  boost::uint32_t session = (boost::uint32_t)(us ^ (us >> 32)) ^
+    (boost::uint32_t)(std::size_t)client;
+  return session ? session : 1;
+}
+
+// Size of a bundle with no elements: "#bundle" and the timetag
+const std::size_t BUNDLE_HEADER_SIZE = 16;
+
+} // namespace
+
 //-----------------------------------------------------------------------------
 UDPClient::AsyncUDPClient::AsyncUDPClient(asio::io_service& io_service,
+    std::size_t hosts, boost::uint32_t session,
     boost::condition_variable& cond, boost::mutex& mut)
 : write_in_progress_(false)
-, msg_to_send_(false)
+, writing_(false)
+, sends_posted_(0)
 , io_service_(io_service)
 , socket_(io_service_)
+, destinations_(hosts)
+, next_target_(0)
+, writing_lane_(PRIORITY_BULK)
+, released_seq_(0)
+, session_(session)
+, retransmit_timer_(io_service_)
+, timer_running_(false)
+, receiving_(false)
+, batch_pool_(NULL)
+, batch_budget_us_(0)
+, batch_max_size_(0)
+, batch_is_bundle_(false)
+, batch_writer_(NULL, 0)
+, batch_generation_(0)
+, batch_timer_(io_service_)
+, arrival_interval_us_(0)
+, arrival_size_(0)
 , write_progress_cond_(cond)
 , write_progress_mut_(mut)
 {
   socket_.open(asio::ip::udp::v4());
+  // retransmissions are written directly and must not block the I/O thread
+  socket_.non_blocking(true);
+  for (std::size_t i = 0; i < destinations_.size(); ++i) {
+    Statistics& stats = destinations_[i].stats;
+    stats.messages_sent = 0;
+    stats.bytes_sent = 0;
+    stats.errors = 0;
+    stats.resolved = false;
+    stats.reliable_sent = 0;
+    stats.reliable_acked = 0;
+    stats.retransmissions = 0;
+    stats.reliable_failed = 0;
+  }
+  for (int i = 0; i < PRIORITY_COUNT; ++i) {
+    queues_[i].queued = 0;
+    queues_[i].peak_queued = 0;
+    queues_[i].sent = 0;
+  }
 }
 
 UDPClient::AsyncUDPClient::~AsyncUDPClient()
@@ -43,63 +109,737 @@ UDPClient::AsyncUDPClient::~AsyncUDPClient()
   socket_.close();
 }
 
-void UDPClient::AsyncUDPClient::SetEndpoint(asio::ip::udp::endpoint& endpoint)
+void UDPClient::AsyncUDPClient::SetEndpoint(std::size_t host,
+    const asio::ip::udp::endpoint& endpoint)
 {
-  endpoint_ = endpoint;
+  destinations_[host].endpoint = endpoint;
+  {
+    boost::lock_guard<boost::mutex> lock(stats_mut_);
+    destinations_[host].stats.resolved = true;
+  }
+  targets_.push_back(host);
 }
 
-void UDPClient::AsyncUDPClient::Send(const std::vector<char>& msg)
+void UDPClient::AsyncUDPClient::Send(const MessageBufferPtr& msg)
 {
-  msg_to_send_ = true;
+  ++sends_posted_;
   io_service_.post(boost::bind(&AsyncUDPClient::DoSend, this, msg));
 }
 
-void UDPClient::AsyncUDPClient::DoSend(const std::vector<char> msg)
+bool UDPClient::AsyncUDPClient::SendInline(const MessageBufferPtr& msg)
+{
+#if defined(_WIN32)
+  return false;
+#else
+  {
+    // Anything queued, held, unacknowledged or on its way to the I/O thread
+    // must go out first. Only the caller's thread posts messages, so the I/O
+    // thread stays idle while the datagrams are written below.
+    boost::lock_guard<boost::mutex> lock(write_progress_mut_);
+    if (write_in_progress_ || sends_posted_ != 0 ||
+        msg->sequence() > released_seq_) {
+      return false;
+    }
+  }
+
+  const std::size_t max_iov = 2 * MessageBuffer::MAX_BLOBS + 1;
+  struct iovec iovs[max_iov];
+  struct msghdr hdr;
+  memset(&hdr, 0, sizeof(hdr));
+  GatherBuffers buffers(*msg, false);
+  for (GatherBuffers::const_iterator it = buffers.begin();
+      it != buffers.end(); ++it, ++hdr.msg_iovlen) {
+    iovs[hdr.msg_iovlen].iov_base = const_cast<void*>(it->data());
+    iovs[hdr.msg_iovlen].iov_len = it->size();
+  }
+  hdr.msg_iov = iovs;
+
+  for (std::size_t t = 0; t < targets_.size(); ++t) {
+    const asio::ip::udp::endpoint& endpoint =
+      destinations_[targets_[t]].endpoint;
+    hdr.msg_name = const_cast<void*>(static_cast<const void*>(
+          endpoint.data()));
+    hdr.msg_namelen = endpoint.size();
+    ssize_t sent;
+    do {
+      sent = sendmsg(socket_.native_handle(), &hdr, MSG_DONTWAIT);
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      // The socket buffer is full; the I/O thread sends the message to the
+      // remaining hosts once the socket is writable
+      ++sends_posted_;
+      io_service_.post(boost::bind(&AsyncUDPClient::DoSendFrom, this, msg,
+            t));
+      return true;
+    }
+    Account(targets_[t], sent < 0 ? 0 : sent, sent >= 0);
+  }
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  queues_[msg->priority()].sent++;
+  return true;
+#endif
+}
+
+void UDPClient::AsyncUDPClient::SendReliable(const MessageBufferPtr& msg,
+    boost::uint32_t sequence)
+{
+  ++sends_posted_;
+  io_service_.post(boost::bind(&AsyncUDPClient::DoSendReliable, this, msg,
+        sequence));
+}
+
+void UDPClient::AsyncUDPClient::SetMulticastOptions(int ttl, bool loopback,
+    const std::string& interface_address)
+{
+  io_service_.post(boost::bind(&AsyncUDPClient::DoSetMulticastOptions, this,
+        ttl, loopback, interface_address));
+}
+
+void UDPClient::AsyncUDPClient::DoSetMulticastOptions(int ttl, bool loopback,
+    std::string interface_address)
+{
+  boost::system::error_code error;
+  socket_.set_option(asio::ip::multicast::hops(ttl), error);
+  if (error) {
+    std::cerr << "UDPClient: multicast TTL -> " << error.message() << "\n";
+  }
+  socket_.set_option(asio::ip::multicast::enable_loopback(loopback), error);
+  if (error) {
+    std::cerr << "UDPClient: multicast loopback -> " << error.message()
+      << "\n";
+  }
+  if (!interface_address.empty()) {
+    asio::ip::address_v4 address =
+      asio::ip::address_v4::from_string(interface_address, error);
+    if (!error) {
+      socket_.set_option(asio::ip::multicast::outbound_interface(address),
+          error);
+    }
+    if (error) {
+      std::cerr << "UDPClient: multicast interface " << interface_address
+        << " -> " << error.message() << "\n";
+    }
+  }
+}
+
+void UDPClient::AsyncUDPClient::SetIoUring(bool enable, bool sqpoll)
+{
+  io_service_.post(boost::bind(&AsyncUDPClient::DoSetIoUring, this, enable,
+        sqpoll));
+}
+
+void UDPClient::AsyncUDPClient::DoSetIoUring(bool enable, bool sqpoll)
+{
+#if defined(AM_USE_IO_URING)
+  uring_.Close();
+  if (enable && !uring_.Init(socket_.native_handle(), MAX_BATCH, sqpoll)) {
+    std::cerr << "UDPClient: io_uring -> " << strerror(errno)
+      << ", using sendmmsg\n";
+  }
+#else
+  (void)enable;
+  (void)sqpoll;
+#endif
+}
+
+void UDPClient::AsyncUDPClient::SetBatching(MessageBufferPool* pool,
+    long budget_us, std::size_t max_size)
+{
+  io_service_.post(boost::bind(&AsyncUDPClient::DoSetBatching, this, pool,
+        budget_us, max_size));
+}
+
+void UDPClient::AsyncUDPClient::DoSetBatching(MessageBufferPool* pool,
+    long budget_us, std::size_t max_size)
+{
+  batch_pool_ = pool;
+  batch_budget_us_ = budget_us;
+  batch_max_size_ = max_size;
+  // Start from the longest interval counted, so that the first messages are
+  // not held before the rate is known
+  arrival_interval_us_ = 2.0 * budget_us;
+  if (budget_us == 0) FlushBatch();
+}
+
+UDPClient::Statistics UDPClient::AsyncUDPClient::GetStatistics(
+    std::size_t host) const
+{
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  return destinations_[host].stats;
+}
+
+QueueStatistics UDPClient::AsyncUDPClient::GetQueueStatistics(
+    int priority) const
+{
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  return queues_[priority];
+}
+
+void UDPClient::AsyncUDPClient::Release(boost::uint64_t sequence)
+{
+  io_service_.post(boost::bind(&AsyncUDPClient::DoRelease, this, sequence));
+}
+
+void UDPClient::AsyncUDPClient::Flush(const Completion& done)
+{
+  io_service_.post(boost::bind(&AsyncUDPClient::DoFlush, this, done));
+}
+
+void UDPClient::AsyncUDPClient::DoFlush(Completion done)
+{
+  // Messages sent before the flush have been posted before it as well, and
+  // the batch is not held any longer
+  FlushBatch();
+  if (writing_ || !held_msgs_.empty() || !pending_.empty()) {
+    flush_waiters_.push_back(done);
+  } else {
+    done(true);
+  }
+}
+
+void UDPClient::AsyncUDPClient::DoSend(MessageBufferPtr msg)
+{
+  CountQueued(msg->priority(), 1, false);
+  if (msg->sequence() > released_seq_ ||
+      !held_msgs_.lane(msg->priority()).empty()) {
+    // wait for the barrier; the queue counts as busy in the meantime
+    held_msgs_.push_back(msg);
+    {
+      boost::lock_guard<boost::mutex> lock(write_progress_mut_);
+      write_in_progress_ = true;
+      --sends_posted_;
+    }
+    return;
+  }
+
+  {
+    boost::lock_guard<boost::mutex> lock(write_progress_mut_);
+    write_in_progress_ = true;
+    --sends_posted_;
+  }
+  Batch(msg);
+}
+
+void UDPClient::AsyncUDPClient::DoSendFrom(MessageBufferPtr msg,
+    std::size_t target)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(write_progress_mut_);
+    write_in_progress_ = true;
+    --sends_posted_;
+  }
+  // The queue is empty as the message was sent inline
+  CountQueued(msg->priority(), 1, false);
+  next_target_ = target;
+  writing_lane_ = msg->priority();
+  Queue(msg);
+}
+
+void UDPClient::AsyncUDPClient::DoSendReliable(MessageBufferPtr msg,
+    boost::uint32_t sequence)
+{
+  {
+    boost::lock_guard<boost::mutex> lock(write_progress_mut_);
+    write_in_progress_ = true;
+    --sends_posted_;
+  }
+  FlushBatch();
+  if (!targets_.empty()) {
+    Pending& pending = pending_[sequence];
+    pending.msg = msg;
+    pending.acked.assign(destinations_.size(), false);
+    pending.unacked = targets_.size();
+    pending.attempts = 1;
+    pending.deadline = boost::posix_time::microsec_clock::universal_time() +
+      boost::posix_time::milliseconds((long)RETRANSMIT_TIMEOUT_MS);
+    {
+      boost::lock_guard<boost::mutex> lock(stats_mut_);
+      for (std::size_t i = 0; i < targets_.size(); ++i) {
+        destinations_[targets_[i]].stats.reliable_sent++;
+      }
+    }
+    StartReceive();
+    StartTimer();
+  }
+  // The first transmission goes through the queue like any other message
+  CountQueued(msg->priority(), 1, false);
+  Queue(msg);
+}
+
+void UDPClient::AsyncUDPClient::Queue(const MessageBufferPtr& msg)
 {
-  write_in_progress_ = !write_msgs_.empty();
   write_msgs_.push_back(msg);
-  if (!write_in_progress_) {
-    socket_.async_send_to(asio::buffer(write_msgs_.front()), endpoint_,
-        boost::bind(&AsyncUDPClient::HandlerWrite, this,
-          asio::placeholders::error,
-          asio::placeholders::bytes_transferred));
+  if (!writing_) {
+    writing_ = true;
+    StartWrite();
   }
-  msg_to_send_ = false;
 }
 
-void UDPClient::AsyncUDPClient::HandlerWrite(
+void UDPClient::AsyncUDPClient::Batch(const MessageBufferPtr& msg)
+{
+  if (batch_budget_us_ == 0 || msg->priority() != PRIORITY_BULK ||
+      msg->blob_count() != 0 || msg->data()[0] == '#' ||
+      BUNDLE_HEADER_SIZE + 4 + msg->size() > batch_max_size_) {
+    // the held messages go first to keep the bulk messages in order
+    if (msg->priority() == PRIORITY_BULK) FlushBatch();
+    Queue(msg);
+    return;
+  }
+
+  // Gaps are counted as twice the budget at most, so that a burst after a
+  // pause is batched right away while a steady low rate is not batched
+  using namespace boost::posix_time;
+  ptime now = microsec_clock::universal_time();
+  double interval = 2.0 * batch_budget_us_;
+  if (!last_arrival_.is_not_a_date_time()) {
+    interval = std::min(interval,
+        (double)(now - last_arrival_).total_microseconds());
+  }
+  last_arrival_ = now;
+  arrival_interval_us_ += (interval - arrival_interval_us_) / 8;
+  arrival_size_ += (4.0 + msg->size() - arrival_size_) / 8;
+
+  if (batch_) {
+    if (AddToBatch(msg)) {
+      // send the bundle once the next message is unlikely to fit
+      if (batch_->size() + arrival_size_ > batch_max_size_) FlushBatch();
+      return;
+    }
+    FlushBatch();
+  }
+
+  if (arrival_interval_us_ >= batch_budget_us_) {
+    // the next message is not expected within the budget
+    Queue(msg);
+    return;
+  }
+
+  // Hold the message about as long as it takes to fill a datagram, and
+  // less if the messages stop coming (see HandleBatchTimer)
+  double room = (double)(batch_max_size_ - BUNDLE_HEADER_SIZE - 4 -
+      msg->size());
+  double fill_us = arrival_interval_us_ * room / arrival_size_;
+  batch_deadline_ = now +
+    microseconds((long)std::min((double)batch_budget_us_, fill_us));
+  batch_ = msg;
+  batch_is_bundle_ = false;
+  StartBatchTimer(now);
+}
+
+void UDPClient::AsyncUDPClient::StartBatchTimer(
+    const boost::posix_time::ptime& now)
+{
+  using namespace boost::posix_time;
+  ptime idle = last_arrival_ + microseconds((long)(2 * arrival_interval_us_));
+  batch_timer_.expires_at(std::min(batch_deadline_, std::max(idle, now)));
+  batch_timer_.async_wait(boost::bind(&AsyncUDPClient::HandleBatchTimer,
+        this, asio::placeholders::error, batch_generation_));
+}
+
+bool UDPClient::AsyncUDPClient::AddToBatch(const MessageBufferPtr& msg)
+{
+  if (!batch_is_bundle_) {
+    // Turn the held message into the first element of a bundle
+    if (BUNDLE_HEADER_SIZE + 8 + batch_->size() + msg->size() >
+        batch_max_size_) {
+      return false;
+    }
+    MessageBufferPtr bundle = batch_pool_->Acquire();
+    if (!bundle) return false;
+    batch_writer_ = tnyosc::BundleWriter(bundle->data(),
+        std::min(bundle->capacity(), batch_max_size_));
+    batch_writer_.append(batch_->data(), batch_->size());
+    batch_ = bundle;
+    batch_is_bundle_ = true;
+  }
+  // The writer refuses elements past the batch size and fills in their size
+  bool appended = batch_writer_.append(msg->data(), msg->size());
+  batch_->Resize(batch_writer_.size());
+  if (!appended) return false;
+  // the message now travels in the bundle, which counts as one packet
+  CountQueued(PRIORITY_BULK, -1, false);
+  return true;
+}
+
+void UDPClient::AsyncUDPClient::FlushBatch()
+{
+  if (!batch_) return;
+  MessageBufferPtr batch;
+  batch.swap(batch_);
+  ++batch_generation_;
+  Queue(batch);
+}
+
+void UDPClient::AsyncUDPClient::HandleBatchTimer(
+    const boost::system::error_code& error, boost::uint64_t generation)
+{
+  // the timer is reused for the next batch, so an old wait may still fire
+  if (error == asio::error::operation_aborted ||
+      generation != batch_generation_) {
+    return;
+  }
+  // Send once the budget is used up or no message came for twice the usual
+  // interval; until then the timer is moved along with the last arrival
+  using namespace boost::posix_time;
+  ptime now = microsec_clock::universal_time();
+  ptime idle = last_arrival_ + microseconds((long)(2 * arrival_interval_us_));
+  if (now >= batch_deadline_ || now >= idle) {
+    FlushBatch();
+  } else {
+    StartBatchTimer(now);
+  }
+}
+
+#if defined(__linux__)
+void UDPClient::AsyncUDPClient::StartWrite()
+{
+  if (targets_.empty()) ClearQueue();
+
+  // Each message is encoded once and the same iovecs are used for every
+  // destination, so a batch holds up to MAX_BATCH (message, destination)
+  // pairs in queue order.
+  const std::size_t max_iov = 2 * MessageBuffer::MAX_BLOBS + 1;
+  while (!write_msgs_.empty()) {
+    // A batch holds messages of a single class, picked between messages so
+    // that urgent messages queued meanwhile go out before the bulk ones
+    if (next_target_ == 0) writing_lane_ = write_msgs_.next();
+    const MessageQueue& queue = write_msgs_.lane(writing_lane_);
+    struct mmsghdr msgs[MAX_BATCH];
+    struct iovec iovs[MAX_BATCH][max_iov];
+    std::size_t count = 0;
+    std::size_t index = 0;
+    std::size_t target = next_target_;
+    while (count < MAX_BATCH && index < queue.size()) {
+      if (count == 0 || target == 0) {
+        GatherBuffers buffers(*queue[index], false);
+        std::size_t n = 0;
+        for (GatherBuffers::const_iterator it = buffers.begin();
+            it != buffers.end(); ++it, ++n) {
+          iovs[index][n].iov_base = const_cast<void*>(it->data());
+          iovs[index][n].iov_len = it->size();
+        }
+        memset(&msgs[count].msg_hdr, 0, sizeof(msgs[count].msg_hdr));
+        msgs[count].msg_hdr.msg_iov = iovs[index];
+        msgs[count].msg_hdr.msg_iovlen = n;
+      } else {
+        msgs[count].msg_hdr = msgs[count - 1].msg_hdr;
+      }
+      const asio::ip::udp::endpoint& endpoint =
+        destinations_[targets_[target]].endpoint;
+      msgs[count].msg_hdr.msg_name = const_cast<void*>(
+          static_cast<const void*>(endpoint.data()));
+      msgs[count].msg_hdr.msg_namelen = endpoint.size();
+      msgs[count].msg_len = 0;
+      count++;
+      if (++target == targets_.size()) {
+        target = 0;
+        index++;
+      }
+    }
+
+    int sent;
+    do {
+#if defined(AM_USE_IO_URING)
+      if (uring_.ready()) {
+        sent = uring_.SendBatch(msgs, count);
+        if (!uring_.ready()) {
+          // The ring failed and was closed. The datagrams it sent are
+          // counted; if there are none, the batch goes out with sendmmsg,
+          // and otherwise the rest follows with the next batch.
+          std::cerr << "UDPClient: io_uring -> " << strerror(errno)
+            << ", using sendmmsg\n";
+          if (sent < 0) {
+            sent = sendmmsg(socket_.native_handle(), msgs, count,
+                MSG_DONTWAIT);
+          }
+        }
+      } else {
+        sent = sendmmsg(socket_.native_handle(), msgs, count, MSG_DONTWAIT);
+      }
+#else
+      sent = sendmmsg(socket_.native_handle(), msgs, count, MSG_DONTWAIT);
+#endif
+    } while (sent < 0 && errno == EINTR);
+
+    if (sent < 0) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        // Socket buffer is full; resume once it is writable
+        socket_.async_wait(asio::ip::udp::socket::wait_write,
+            boost::bind(&AsyncUDPClient::HandleWait, this,
+              asio::placeholders::error));
+        return;
+      }
+      // Drop the failing datagram and carry on with the next one
+      Account(targets_[next_target_], 0, false);
+      Advance(1);
+    } else {
+      std::size_t t = next_target_;
+      for (int i = 0; i < sent; ++i) {
+        Account(targets_[t], msgs[i].msg_len, true);
+        if (++t == targets_.size()) t = 0;
+      }
+      Advance(sent);
+    }
+  }
+  writing_ = false;
+  WriteDone();
+}
+#else
+void UDPClient::AsyncUDPClient::StartWrite()
+{
+  if (targets_.empty()) ClearQueue();
+  if (write_msgs_.empty()) {
+    writing_ = false;
+    WriteDone();
+    return;
+  }
+  if (next_target_ == 0) writing_lane_ = write_msgs_.next();
+  socket_.async_send_to(
+      GatherBuffers(*write_msgs_.lane(writing_lane_).front(), false),
+      destinations_[targets_[next_target_]].endpoint,
+      boost::bind(&AsyncUDPClient::HandleWrite, this,
+        asio::placeholders::error,
+        asio::placeholders::bytes_transferred));
+}
+#endif
+
+void UDPClient::AsyncUDPClient::DoRelease(boost::uint64_t sequence)
+{
+  if (sequence <= released_seq_) return;
+  {
+    // also read by SendInline on the caller's thread
+    boost::lock_guard<boost::mutex> lock(write_progress_mut_);
+    released_seq_ = sequence;
+  }
+  if (held_msgs_.empty()) return;
+
+  // batched messages were sent before the held ones
+  FlushBatch();
+  for (int i = 0; i < PRIORITY_COUNT; ++i) {
+    MessageQueue& held = held_msgs_.lane(i);
+    while (!held.empty() && held.front()->sequence() <= sequence) {
+      write_msgs_.push_back(held.front());
+      held.pop_front();
+    }
+  }
+  // nothing to send if everything is still held
+  if (!writing_ && !write_msgs_.empty()) {
+    writing_ = true;
+    StartWrite();
+  }
+}
+
+void UDPClient::AsyncUDPClient::HandleWrite(
     const boost::system::error_code& error,
     std::size_t bytes_transferred)
 {
-  if (!error) {
-    write_msgs_.pop_front();
-    if (!write_msgs_.empty()) {
-      socket_.async_send_to(asio::buffer(write_msgs_.front()), endpoint_,
-          boost::bind(&AsyncUDPClient::HandlerWrite, this,
-            asio::placeholders::error,
-            asio::placeholders::bytes_transferred));
+  // A failure only drops the message for this destination
+  Account(targets_[next_target_], bytes_transferred, !error);
+  Advance(1);
+  StartWrite();
+}
+
+void UDPClient::AsyncUDPClient::HandleWait(
+    const boost::system::error_code& error)
+{
+  if (error == asio::error::operation_aborted) return;
+  StartWrite();
+}
+
+void UDPClient::AsyncUDPClient::StartReceive()
+{
+  if (receiving_) return;
+  receiving_ = true;
+  socket_.async_receive_from(asio::buffer(receive_buf_), sender_,
+      boost::bind(&AsyncUDPClient::HandleReceive, this,
+        asio::placeholders::error,
+        asio::placeholders::bytes_transferred));
+}
+
+void UDPClient::AsyncUDPClient::HandleReceive(
+    const boost::system::error_code& error, std::size_t bytes_transferred)
+{
+  receiving_ = false;
+  if (error == asio::error::operation_aborted) return;
+
+  boost::uint32_t session, sequence;
+  if (!error && ParseReliableAck(receive_buf_, bytes_transferred, &session,
+        &sequence) && session == session_) {
+    // Acks of messages already done with are ignored
+    PendingMap::iterator it = pending_.find(sequence);
+    if (it != pending_.end()) {
+      Pending& pending = it->second;
+      for (std::size_t i = 0; i < targets_.size(); ++i) {
+        std::size_t d = targets_[i];
+        if (pending.acked[d] || destinations_[d].endpoint != sender_) continue;
+        pending.acked[d] = true;
+        pending.unacked--;
+        boost::lock_guard<boost::mutex> lock(stats_mut_);
+        destinations_[d].stats.reliable_acked++;
+      }
+      if (pending.unacked == 0) pending_.erase(it);
+    }
+  }
+
+  if (pending_.empty()) {
+    WriteDone();
+  } else {
+    StartReceive();
+  }
+}
+
+void UDPClient::AsyncUDPClient::StartTimer()
+{
+  if (timer_running_ || pending_.empty()) return;
+  boost::posix_time::ptime deadline = pending_.begin()->second.deadline;
+  for (PendingMap::const_iterator it = pending_.begin();
+      it != pending_.end(); ++it) {
+    if (it->second.deadline < deadline) deadline = it->second.deadline;
+  }
+  timer_running_ = true;
+  retransmit_timer_.expires_at(deadline);
+  retransmit_timer_.async_wait(boost::bind(&AsyncUDPClient::HandleTimer, this,
+        asio::placeholders::error));
+}
+
+void UDPClient::AsyncUDPClient::HandleTimer(
+    const boost::system::error_code& error)
+{
+  timer_running_ = false;
+  if (error == asio::error::operation_aborted) return;
+
+  boost::posix_time::ptime now =
+    boost::posix_time::microsec_clock::universal_time();
+  PendingMap::iterator it = pending_.begin();
+  while (it != pending_.end()) {
+    Pending& pending = it->second;
+    if (pending.deadline > now) {
+      ++it;
+    } else if (pending.attempts < MAX_ATTEMPTS) {
+      Retransmit(pending);
+      ++it;
     } else {
-      { 
-        boost::lock_guard<boost::mutex> lock(write_progress_mut_);
-        write_in_progress_ = false;
+      // Give up on the hosts that never acknowledged the message
+      boost::lock_guard<boost::mutex> lock(stats_mut_);
+      for (std::size_t i = 0; i < targets_.size(); ++i) {
+        if (!pending.acked[targets_[i]]) {
+          destinations_[targets_[i]].stats.reliable_failed++;
+        }
       }
-      write_progress_cond_.notify_all();
+      pending_.erase(it++);
     }
+  }
+
+  if (pending_.empty()) {
+    WriteDone();
   } else {
-    { 
-      boost::lock_guard<boost::mutex> lock(write_progress_mut_);
-      write_in_progress_ = false;
+    StartTimer();
+  }
+}
+
+void UDPClient::AsyncUDPClient::Retransmit(Pending& pending)
+{
+  // Only the hosts that did not acknowledge the message get it again
+  GatherBuffers buffers(*pending.msg, false);
+  for (std::size_t i = 0; i < targets_.size(); ++i) {
+    std::size_t d = targets_[i];
+    if (pending.acked[d]) continue;
+    boost::system::error_code error;
+    std::size_t bytes = socket_.send_to(buffers, destinations_[d].endpoint, 0,
+        error);
+    boost::lock_guard<boost::mutex> lock(stats_mut_);
+    Statistics& stats = destinations_[d].stats;
+    stats.retransmissions++;
+    if (error) {
+      // e.g. a full socket buffer; the next attempt may get through
+      stats.errors++;
+    } else {
+      stats.messages_sent++;
+      stats.bytes_sent += bytes;
     }
-    write_progress_cond_.notify_all();
-    socket_.close();
   }
+  pending.attempts++;
+  pending.deadline = boost::posix_time::microsec_clock::universal_time() +
+    boost::posix_time::milliseconds(
+        (long)RETRANSMIT_TIMEOUT_MS << (pending.attempts - 1));
+}
+
+void UDPClient::AsyncUDPClient::Advance(std::size_t count)
+{
+  MessageQueue& queue = write_msgs_.lane(writing_lane_);
+  next_target_ += count;
+  while (!queue.empty() && next_target_ >= targets_.size()) {
+    next_target_ -= targets_.size();
+    queue.pop_front();
+    CountQueued(writing_lane_, -1, true);
+  }
+}
+
+void UDPClient::AsyncUDPClient::Account(std::size_t target, std::size_t bytes,
+    bool sent)
+{
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  Statistics& stats = destinations_[target].stats;
+  if (sent) {
+    stats.messages_sent++;
+    stats.bytes_sent += bytes;
+  } else {
+    stats.errors++;
+  }
+}
+
+void UDPClient::AsyncUDPClient::CountQueued(int priority, int delta,
+    bool sent)
+{
+  boost::lock_guard<boost::mutex> lock(stats_mut_);
+  QueueStatistics& queue = queues_[priority];
+  queue.queued += delta;
+  if (queue.queued > queue.peak_queued) queue.peak_queued = queue.queued;
+  if (sent) queue.sent++;
+}
+
+void UDPClient::AsyncUDPClient::ClearQueue()
+{
+  {
+    boost::lock_guard<boost::mutex> lock(stats_mut_);
+    for (int i = 0; i < PRIORITY_COUNT; ++i) {
+      queues_[i].queued -= write_msgs_.lane(i).size();
+    }
+  }
+  write_msgs_.clear();
+}
+
+void UDPClient::AsyncUDPClient::WriteDone()
+{
+  // held messages keep the queue busy until they are released, batched
+  // messages until the batch is sent, and reliable messages until they are
+  // acknowledged or given up on
+  if (writing_ || batch_ || !held_msgs_.empty() || !pending_.empty()) {
+    return;
+  }
+  {
+    boost::lock_guard<boost::mutex> lock(write_progress_mut_);
+    write_in_progress_ = false;
+  }
+  write_progress_cond_.notify_all();
+  // Completions are posted so that they may start new flushes
+  for (std::size_t i = 0; i < flush_waiters_.size(); ++i) {
+    io_service_.post(boost::bind(flush_waiters_[i], true));
+  }
+  flush_waiters_.clear();
 }
 
 //-----------------------------------------------------------------------------
-UDPClient::UDPClient(const std::string& host, int port)
-: host_(host)
+UDPClient::UDPClient(const std::vector<std::string>& hosts, int port)
+: hosts_(hosts)
 , port_(port)
-, client_(io_service_, write_progress_cond_, write_progress_mut_)
+, client_(io_service_, hosts.size(), NewSession(this),
+    write_progress_cond_, write_progress_mut_)
+, barrier_(0)
+, reliable_seq_(0)
+, inline_(false)
+, batching_(false)
 , service_is_ready_(false)
 , thread_is_running_(false)
 {
@@ -117,12 +857,50 @@ UDPClient::~UDPClient()
   }
 }
 
-void UDPClient::Send(const std::vector<char>& msg)
+void UDPClient::Send(const MessageBufferPtr& msg)
 {
+  if (!msg) return;
   if (!thread_is_running_ && !RunThread()) return;
+  msg->set_sequence(barrier_);
+  // Endpoints are only known once the I/O thread is ready
+  if (inline_ && !batching_ && service_is_ready_ &&
+      client_.SendInline(msg)) {
+    return;
+  }
   client_.Send(msg);
 }
 
+void UDPClient::SendReliable(const MessageBufferPtr& msg)
+{
+  if (!msg || msg->size() < RELIABLE_HEADER_SIZE) return;
+  if (!thread_is_running_ && !RunThread()) return;
+  WriteReliableHeader(msg->data(), client_.session(), ++reliable_seq_,
+      msg->total_size() - RELIABLE_HEADER_SIZE);
+  client_.SendReliable(msg, reliable_seq_);
+}
+
+void UDPClient::SetBatching(MessageBufferPool* pool, long budget_us,
+    std::size_t max_size)
+{
+  batching_ = budget_us > 0;
+  client_.SetBatching(pool, budget_us, max_size);
+}
+
+void UDPClient::SetIoUring(bool enable, bool sqpoll)
+{
+  client_.SetIoUring(enable, sqpoll);
+}
+
+QueueStatistics UDPClient::GetQueueStatistics(int priority) const
+{
+  return client_.GetQueueStatistics(priority);
+}
+
+void UDPClient::Release(boost::uint64_t sequence)
+{
+  client_.Release(sequence);
+}
+
 void UDPClient::BlockUntilQueueIsEmpty()
 {
   // Block until IO thread reached a ready state
@@ -134,6 +912,43 @@ void UDPClient::BlockUntilQueueIsEmpty()
   }
 }
 
+void UDPClient::AsyncFlush(const Completion& done)
+{
+  if (!thread_is_running_) {
+    done(true);
+    return;
+  }
+  client_.Flush(done);
+}
+
+void UDPClient::SetMulticastOptions(int ttl, bool loopback,
+    const std::string& interface_address)
+{
+  // Handled by the I/O thread before any message sent afterwards
+  client_.SetMulticastOptions(ttl, loopback, interface_address);
+}
+
+UDPClient::Statistics UDPClient::GetStatistics(std::size_t host) const
+{
+  return client_.GetStatistics(host);
+}
+
+void UDPClient::SetThreadOptions(const ThreadOptions& options)
+{
+  if (thread_is_running_) {
+    io_service_.post(boost::bind(&UDPClient::ApplyThreadOptions, this,
+          options));
+  } else {
+    thread_options_ = options;
+  }
+}
+
+void UDPClient::ApplyThreadOptions(ThreadOptions options)
+{
+  thread_options_ = options;
+  ConfigureThread(thread_options_, "am_udp");
+}
+
 bool UDPClient::RunThread()
 {
   bool success = true;;
@@ -154,15 +969,24 @@ void UDPClient::Run()
   std::stringstream port_string;
   port_string << port_;
 
+  ConfigureThread(thread_options_, "am_udp");
+
   using asio::ip::udp;
   try {
     udp::resolver resolver(io_service_);
-    udp::resolver::query query(host_, port_string.str());
-    udp::endpoint endpoint = *resolver.resolve(query);
-    client_.SetEndpoint(endpoint);
+    for (std::size_t i = 0; i < hosts_.size(); ++i) {
+      // A host that does not resolve is skipped, the others are still served
+      try {
+        udp::resolver::query query(udp::v4(), hosts_[i], port_string.str());
+        client_.SetEndpoint(i, *resolver.resolve(query));
+      } catch (std::exception& e) {
+        std::cerr << "UDPClient::Run(): " << hosts_[i] << " -> " << e.what()
+          << "\n";
+      }
+    }
     asio::io_service::work work(io_service_);
     service_is_ready_ = true;
-    io_service_.run();
+    RunIoService(io_service_, thread_options_.busy_poll_us);
   } catch (std::exception& e) {
     std::cerr << "UDPClient::Run(): exception -> " << e.what() << "\n";
   }
@@ -170,4 +994,3 @@ void UDPClient::Run()
   service_is_ready_ = false;
   thread_is_running_ = false;
 }
-
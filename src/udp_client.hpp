@@ -20,27 +20,69 @@
 #ifndef _UDP_CLIENT_HPP_
 #define _UDP_CLIENT_HPP_
 
+#include <map>
 #include <string>
-#include <deque>
 #include <vector>
 
 #include <boost/asio.hpp>
+#include <boost/cstdint.hpp>
 #include <boost/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
 
+#include "completion.hpp"
 #include "disallow_copy_and_assign.hpp"
+#include "message_buffer.hpp"
+#include "thread_config.hpp"
+#include "tnyosc.hpp" // BundleWriter
+#if defined(AM_USE_IO_URING)
+#include "io_uring_sender.hpp"
+#endif
 
 namespace am {
 
 /// Wrapper for using boost::asio::udp
+///
+/// Every message is sent to each host of the list given to the constructor
+/// from a single socket. On Linux, queued messages are sent to all hosts with
+/// as few sendmmsg calls as possible, or through io_uring (see @a
+/// SetIoUring).
 class UDPClient {
  public:
-  UDPClient(const std::string& host, int port);
+  UDPClient(const std::vector<std::string>& hosts, int port);
   ~UDPClient();
 
-  /// Send a message.
-  void Send(const std::vector<char>& msg);
+  /// Send a message to every host. The buffer is shared with the I/O thread,
+  /// not copied. A null buffer, e.g. one refused by the memory cap, is
+  /// ignored. Queued messages of the class PRIORITY_URGENT are sent before
+  /// bulk ones; see @a SetBarrier for how the barrier applies to each class.
+  void Send(const MessageBufferPtr& msg);
+
+  /// Send a reliable message to every host (see reliable_udp.hpp). The first
+  /// RELIABLE_HEADER_SIZE bytes of @a msg are reserved for the header, which
+  /// is written here. The message is retransmitted to the hosts that did not
+  /// acknowledge it until all did or MAX_ATTEMPTS transmissions were made.
+  /// Reliable messages ignore the barrier and are meant for unicast hosts,
+  /// since a multicast group answers with one ack per listener.
+  void SendReliable(const MessageBufferPtr& msg);
+
+  enum {
+    /// Time before the first retransmission; doubled for each attempt.
+    RETRANSMIT_TIMEOUT_MS = 50,
+    /// Transmissions of a reliable message before giving up on a host.
+    MAX_ATTEMPTS = 6
+  };
+
+  /// Hold the messages sent from now on until @a Release is called with a
+  /// sequence number of at least @a sequence. Messages of a priority class
+  /// are never reordered, so a held message also holds back the messages of
+  /// its class sent after it, but not those of another class. Used to order
+  /// UDP messages after TCP messages (see TCPClient::last_sequence).
+  void SetBarrier(boost::uint64_t sequence) { barrier_ = sequence; }
+
+  /// Send the messages held for a barrier up to @a sequence. May be called
+  /// from any thread.
+  void Release(boost::uint64_t sequence);
 
   /// Can be used before exiting the program to make sure all messages are sent
   /// or at least processed before abruptly exiting the program. This is
@@ -48,6 +90,68 @@ class UDPClient {
   /// a call to Send does not gaurantee delivery.
   void BlockUntilQueueIsEmpty();
 
+  /// Asynchronous variant of @a BlockUntilQueueIsEmpty: calls @a done on the
+  /// I/O thread once every message sent so far has been sent, acknowledged
+  /// or given up on. If no message was ever sent, @a done is called right
+  /// away.
+  void AsyncFlush(const Completion& done);
+
+  /// Configure the socket for sending to multicast groups: @a ttl is the
+  /// number of hops, @a loopback delivers the messages to listeners on this
+  /// machine and @a interface_address, if not empty, is the IPv4 address of
+  /// the outgoing interface. Applies to the messages sent afterwards.
+  void SetMulticastOptions(int ttl, bool loopback,
+      const std::string& interface_address);
+
+  /// Send the queued datagrams through io_uring instead of sendmmsg, with a
+  /// kernel thread polling the submission queue if @a sqpoll is true. Falls
+  /// back to sendmmsg if the ring cannot be set up. Has no effect unless the
+  /// library was built with the AMCLIENT_IO_URING CMake option.
+  void SetIoUring(bool enable, bool sqpoll);
+
+  /// Send messages from the calling thread with a non-blocking sendmsg per
+  /// host instead of handing them to the I/O thread, saving the thread hop
+  /// and its wake-up. A message still goes through the I/O thread if earlier
+  /// messages are queued or held by the barrier, or if the socket would
+  /// block. Not available on Windows, where messages are always queued.
+  /// Ignored while batching (see @a SetBatching).
+  void SetInline(bool enable) { inline_ = enable; }
+
+  /// Coalesce standalone messages into bundles on the I/O thread, holding a
+  /// message for at most @a budget_us microseconds, or send every message
+  /// as is if @a budget_us is 0. The hold time follows the observed message
+  /// rate: when the next message is not expected within the budget, a
+  /// message is sent right away, otherwise it is held about as long as it
+  /// takes to fill a datagram of @a max_size bytes, and a bundle that is
+  /// full is sent without waiting. Bundles are taken from @a pool. Bundles,
+  /// messages with blobs and urgent messages are never held.
+  void SetBatching(MessageBufferPool* pool, long budget_us,
+      std::size_t max_size);
+
+  /// Traffic sent to one host.
+  struct Statistics {
+    std::size_t messages_sent;
+    std::size_t bytes_sent;
+    std::size_t errors;       ///< Messages that could not be sent.
+    bool resolved;            ///< False if the host name did not resolve.
+    std::size_t reliable_sent;    ///< Reliable messages sent.
+    std::size_t reliable_acked;   ///< Reliable messages acknowledged.
+    std::size_t retransmissions;  ///< Reliable messages sent again.
+    std::size_t reliable_failed;  ///< Reliable messages given up on.
+  };
+
+  std::size_t host_count() const { return hosts_.size(); }
+  const std::string& host(std::size_t i) const { return hosts_[i]; }
+  Statistics GetStatistics(std::size_t host) const;
+
+  /// Usage of the queue of the class @a priority, shared by all hosts. A
+  /// message counts as sent once it was passed to the socket for every host.
+  QueueStatistics GetQueueStatistics(int priority) const;
+
+  /// Configure the I/O thread (see ConfigureThread). Applied when the thread
+  /// starts, or right away by the thread if it is already running.
+  void SetThreadOptions(const ThreadOptions& options);
+
  private:
   DISALLOW_COPY_AND_ASSIGN(UDPClient);
 
@@ -55,26 +159,153 @@ class UDPClient {
   /// network IO events.
   class AsyncUDPClient {
    public:
-    AsyncUDPClient(boost::asio::io_service& io_service,
-        boost::condition_variable& cond, boost::mutex& mut);
+    AsyncUDPClient(boost::asio::io_service& io_service, std::size_t hosts,
+        boost::uint32_t session, boost::condition_variable& cond,
+        boost::mutex& mut);
     ~AsyncUDPClient();
 
-    void SetEndpoint(boost::asio::ip::udp::endpoint& endpoint);
-    void Send(const std::vector<char>& msg);
+    void SetEndpoint(std::size_t host,
+        const boost::asio::ip::udp::endpoint& endpoint);
+    void SetMulticastOptions(int ttl, bool loopback,
+        const std::string& interface_address);
+    void SetIoUring(bool enable, bool sqpoll);
+    void SetBatching(MessageBufferPool* pool, long budget_us,
+        std::size_t max_size);
+    void Send(const MessageBufferPtr& msg);
+    /// Send @a msg on the caller's thread. Returns false if it has to be
+    /// queued instead.
+    bool SendInline(const MessageBufferPtr& msg);
+    void SendReliable(const MessageBufferPtr& msg, boost::uint32_t sequence);
+    void Release(boost::uint64_t sequence);
+    void Flush(const Completion& done);
     bool WriteInProgress() const { return write_in_progress_; }
-    bool HaveMsgToSend() const { return msg_to_send_; }
+    bool HaveMsgToSend() const { return sends_posted_ != 0; }
+    boost::uint32_t session() const { return session_; }
+    Statistics GetStatistics(std::size_t host) const;
+    QueueStatistics GetQueueStatistics(int priority) const;
 
    private:
-    void DoSend(const std::vector<char> msg);
-    void HandlerWrite(const boost::system::error_code& error,
+    enum {
+      /// Maximum number of datagrams passed to a single sendmmsg call.
+      MAX_BATCH = 64
+    };
+
+    struct Destination {
+      boost::asio::ip::udp::endpoint endpoint;
+      Statistics stats;
+    };
+
+    /// A reliable message waiting for acknowledgements.
+    struct Pending {
+      MessageBufferPtr msg;
+      /// Per destination, true once the destination acknowledged the message.
+      std::vector<bool> acked;
+      std::size_t unacked;
+      int attempts;
+      boost::posix_time::ptime deadline;
+    };
+
+    typedef std::map<boost::uint32_t, Pending> PendingMap;
+
+    void DoSend(MessageBufferPtr msg);
+    /// Send @a msg to the hosts from target @a target on.
+    void DoSendFrom(MessageBufferPtr msg, std::size_t target);
+    void DoSendReliable(MessageBufferPtr msg, boost::uint32_t sequence);
+    void DoRelease(boost::uint64_t sequence);
+    void DoFlush(Completion done);
+    void DoSetMulticastOptions(int ttl, bool loopback,
+        std::string interface_address);
+    void DoSetIoUring(bool enable, bool sqpoll);
+    void DoSetBatching(MessageBufferPool* pool, long budget_us,
+        std::size_t max_size);
+    /// Queue @a msg, or hold it in the current batch.
+    void Batch(const MessageBufferPtr& msg);
+    /// Add @a msg to the held bundle. Returns false if it does not fit.
+    bool AddToBatch(const MessageBufferPtr& msg);
+    /// Queue the held message or bundle, if any.
+    void FlushBatch();
+    void StartBatchTimer(const boost::posix_time::ptime& now);
+    void HandleBatchTimer(const boost::system::error_code& error,
+        boost::uint64_t generation);
+    void StartWrite();
+    void HandleWrite(const boost::system::error_code& error,
          std::size_t bytes_transferred);
+    void HandleWait(const boost::system::error_code& error);
+    void StartReceive();
+    void HandleReceive(const boost::system::error_code& error,
+        std::size_t bytes_transferred);
+    void StartTimer();
+    void HandleTimer(const boost::system::error_code& error);
+    void Retransmit(Pending& pending);
+
+    /// Queue @a msg and start writing unless a write is already running.
+    void Queue(const MessageBufferPtr& msg);
+
+    /// Account for @a count datagrams, starting with the current one, and
+    /// move on to the next destination or message.
+    void Advance(std::size_t count);
+    void Account(std::size_t target, std::size_t bytes, bool sent);
+    /// Count a message of the class @a priority entering (@a delta 1) or
+    /// leaving (-1) the queues; @a sent if it left after being sent.
+    void CountQueued(int priority, int delta, bool sent);
+    /// Drop everything queued, e.g. when no host resolved.
+    void ClearQueue();
+    void WriteDone();
 
+    /// True while anything is queued, held or unacknowledged. Shared with
+    /// BlockUntilQueueIsEmpty.
     bool write_in_progress_;
-    bool msg_to_send_;
+    /// True while the I/O thread is working through @a write_msgs_.
+    bool writing_;
+    /// Messages posted to the I/O thread but not queued yet.
+    boost::detail::atomic_count sends_posted_;
     boost::asio::io_service& io_service_;
     boost::asio::ip::udp::socket socket_;
-    boost::asio::ip::udp::endpoint endpoint_;
-    std::deque< std::vector<char> > write_msgs_;
+    std::vector<Destination> destinations_;
+    /// Indices of the destinations with a resolved endpoint.
+    std::vector<std::size_t> targets_;
+    /// Target the front message is to be sent to next.
+    std::size_t next_target_;
+    PriorityQueue write_msgs_;
+    /// Class of the message being sent; only changes between messages.
+    int writing_lane_;
+    /// Messages waiting for a barrier, in the order they were sent.
+    PriorityQueue held_msgs_;
+    boost::uint64_t released_seq_;
+    boost::uint32_t session_;
+    PendingMap pending_;
+    boost::asio::deadline_timer retransmit_timer_;
+    bool timer_running_;
+    bool receiving_;
+    boost::asio::ip::udp::endpoint sender_;
+    char receive_buf_[64];
+    /// Flushes waiting for the queue to be idle.
+    std::vector<Completion> flush_waiters_;
+    /// Adaptive batching; disabled while @a batch_budget_us_ is 0.
+    MessageBufferPool* batch_pool_;
+    long batch_budget_us_;
+    std::size_t batch_max_size_;
+    /// The held message, or the bundle of held messages if @a
+    /// batch_is_bundle_.
+    MessageBufferPtr batch_;
+    bool batch_is_bundle_;
+    /// Encodes the elements of @a batch_ once it is a bundle.
+    tnyosc::BundleWriter batch_writer_;
+    /// Incremented for every flush so that a stale timer is ignored.
+    boost::uint64_t batch_generation_;
+    boost::asio::deadline_timer batch_timer_;
+    /// Latest time to send the batch.
+    boost::posix_time::ptime batch_deadline_;
+    boost::posix_time::ptime last_arrival_;
+    /// Moving averages of the time between batchable messages and of
+    /// their size.
+    double arrival_interval_us_;
+    double arrival_size_;
+#if defined(AM_USE_IO_URING)
+    IoUringSender uring_;
+#endif
+    QueueStatistics queues_[PRIORITY_COUNT];
+    mutable boost::mutex stats_mut_;
     boost::condition_variable& write_progress_cond_;
     boost::mutex& write_progress_mut_;
   };
@@ -83,14 +314,22 @@ class UDPClient {
   /// Thread is lazily created when Send funciton is called.
   bool RunThread();
 
-  /// Thread to run AsyncUDPClient. This function sets the endpoint and calls
+  void ApplyThreadOptions(ThreadOptions options);
+
+  /// Thread to run AsyncUDPClient. This function sets the endpoints and calls
   /// io_services's run to start processing the AsyncUDPClient service.
   void Run();
 
-  std::string host_;
+  std::vector<std::string> hosts_;
   int port_;
   boost::asio::io_service io_service_;
   AsyncUDPClient client_;
+  boost::uint64_t barrier_;
+  boost::uint32_t reliable_seq_;
+  bool inline_;
+  bool batching_;
+  /// Owned by the I/O thread while it is running.
+  ThreadOptions thread_options_;
   bool service_is_ready_;
   bool thread_is_running_;
   boost::thread thread_;
@@ -101,4 +340,3 @@ class UDPClient {
 } // namespace am
 
 #endif // _UDP_CLIENT_HPP_
-
@@ -0,0 +1,105 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Benchmark for encoding float arrays: one conversion per value, as done by
+// voscpack for an "fff..." format, against the bulk byte swap kernels.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "byte_swap.hpp"
+#include "osc_packer.hpp"
+
+namespace {
+
+const int kIterations = 200000;
+
+// Same conversion voscpack performs for each 'f' argument.
+void EncodePerValue(char* dst, const float* values, std::size_t count)
+{
+  am::OscWriter writer(dst, count * 4);
+  for (std::size_t i = 0; i < count; ++i) {
+    writer.WriteFloat(values[i]);
+  }
+}
+
+void EncodeScalar(char* dst, const float* values, std::size_t count)
+{
+  am::CopyToBigEndian32Scalar(dst, values, count);
+}
+
+void EncodeKernel(char* dst, const float* values, std::size_t count)
+{
+  am::CopyToBigEndian32(dst, values, count);
+}
+
+double Measure(void (*encode)(char*, const float*, std::size_t),
+    char* dst, const float* values, std::size_t count)
+{
+  using namespace boost::posix_time;
+  ptime start = microsec_clock::universal_time();
+  for (int i = 0; i < kIterations; ++i) {
+    encode(dst, values, count);
+    // keep the compiler from hoisting the loop
+    dst[i % (count * 4)] ^= 1;
+  }
+  time_duration elapsed = microsec_clock::universal_time() - start;
+  return elapsed.total_microseconds() * 1000.0 / kIterations;
+}
+
+double MeasureMessage(char* dst, std::size_t capacity, const float* values,
+    std::size_t count)
+{
+  using namespace boost::posix_time;
+  ptime start = microsec_clock::universal_time();
+  for (int i = 0; i < kIterations; ++i) {
+    am::PackArrayMessage(dst, capacity, "/project/speaker/gains", 'f', values,
+        count, false);
+  }
+  time_duration elapsed = microsec_clock::universal_time() - start;
+  return elapsed.total_microseconds() * 1000.0 / kIterations;
+}
+
+} // namespace
+
+int main()
+{
+  printf("byte swap kernel: %s\n", am::ByteSwapKernelName());
+  printf("%8s %14s %14s %14s %9s %14s\n", "values", "per-value ns",
+      "scalar ns", "kernel ns", "speedup", "message ns");
+
+  const std::size_t sizes[] = { 64, 128, 256, 512, 1024 };
+  for (std::size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); ++s) {
+    std::size_t count = sizes[s];
+    std::vector<float> values(count);
+    for (std::size_t i = 0; i < count; ++i) values[i] = i * 0.25f;
+    std::vector<char> dst(count * 4);
+    std::vector<char> msg(64 + count * 5);
+
+    double per_value = Measure(EncodePerValue, &dst[0], &values[0], count);
+    double scalar = Measure(EncodeScalar, &dst[0], &values[0], count);
+    double kernel = Measure(EncodeKernel, &dst[0], &values[0], count);
+    double message = MeasureMessage(&msg[0], msg.size(), &values[0], count);
+    printf("%8lu %14.1f %14.1f %14.1f %8.1fx %14.1f\n", (unsigned long)count,
+        per_value, scalar, kernel, per_value / kernel, message);
+  }
+  return 0;
+}
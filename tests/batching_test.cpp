@@ -0,0 +1,272 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Adaptive UDP batching over loopback: messages at a low rate go out one per
+// packet right away, a burst is packed into full datagrams that leave without
+// waiting for the budget, a steady rate too low to fill a datagram is held
+// no longer than the budget, and batched messages keep their order around
+// reliable messages and ordering barriers.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+#include "reliable_udp.hpp"
+
+namespace {
+
+const unsigned short kPort = 15172;
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+using boost::posix_time::ptime;
+using boost::posix_time::microsec_clock;
+
+ptime Now()
+{
+  return microsec_clock::universal_time();
+}
+
+int ReadInt32(const char* p)
+{
+  return ((unsigned char)p[0] << 24) | ((unsigned char)p[1] << 16) |
+    ((unsigned char)p[2] << 8) | (unsigned char)p[3];
+}
+
+// A "/batch/test" ",i" <index> message as received
+struct Arrival {
+  int index;
+  int packet;
+  ptime time;
+};
+
+struct Received {
+  boost::mutex mutex;
+  std::vector<Arrival> arrivals;
+  int packets;
+  std::size_t largest;
+};
+
+void Record(Received* received, const char* msg, std::size_t size,
+    const ptime& now)
+{
+  if (size != 20 || strcmp(msg, "/batch/test") != 0) return;
+  Arrival arrival = { ReadInt32(msg + 16), received->packets, now };
+  received->arrivals.push_back(arrival);
+}
+
+// Receive until "/stop" arrives, unpacking bundles and acknowledging
+// reliable messages
+void Receive(udp::socket* socket, Received* received)
+{
+  am::ReliableReceiver receiver;
+  char buf[65536];
+  char ack[am::RELIABLE_ACK_SIZE];
+  while (true) {
+    udp::endpoint sender;
+    boost::system::error_code error;
+    std::size_t size = socket->receive_from(boost::asio::buffer(buf), sender,
+        0, error);
+    ptime now = Now();
+    if (error || (size == 8 && strcmp(buf, "/stop") == 0)) break;
+
+    const char* packet = buf;
+    std::size_t packet_size = size;
+    am::ReliableReceiver::Result result = receiver.Receive(buf, size, &packet,
+        &packet_size, ack);
+    if (result == am::ReliableReceiver::DUPLICATE ||
+        result == am::ReliableReceiver::NEW_MESSAGE) {
+      socket->send_to(boost::asio::buffer(ack), sender, 0, error);
+    }
+    if (result != am::ReliableReceiver::NOT_RELIABLE &&
+        result != am::ReliableReceiver::NEW_MESSAGE) {
+      continue;
+    }
+
+    boost::lock_guard<boost::mutex> lock(received->mutex);
+    if (packet_size >= 16 && strcmp(packet, "#bundle") == 0) {
+      for (std::size_t i = 16; i + 4 <= packet_size;) {
+        std::size_t element = ReadInt32(packet + i);
+        Record(received, packet + i + 4, element, now);
+        i += 4 + element;
+      }
+    } else {
+      Record(received, packet, packet_size, now);
+    }
+    received->largest = std::max(received->largest, packet_size);
+    received->packets++;
+  }
+}
+
+// Accept the TCP connection and read until it closes
+void Drain(boost::asio::io_service* io_service, tcp::acceptor* acceptor)
+{
+  tcp::socket socket(*io_service);
+  acceptor->accept(socket);
+  char buf[1500];
+  boost::system::error_code error;
+  while (!error) socket.read_some(boost::asio::buffer(buf), error);
+}
+
+struct Result {
+  int messages;
+  int packets;
+  std::size_t largest;
+  long max_hold_us;
+  bool in_order;
+};
+
+// Wait for the last packets and collect the arrivals of the sends at @a sent
+Result Collect(Received* received, const std::vector<ptime>& sent)
+{
+  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  boost::lock_guard<boost::mutex> lock(received->mutex);
+  Result result = { 0, received->packets, received->largest, 0, true };
+  for (std::size_t i = 0; i < received->arrivals.size(); ++i) {
+    const Arrival& arrival = received->arrivals[i];
+    if (arrival.index != (int)i || arrival.index >= (int)sent.size()) {
+      result.in_order = false;
+      break;
+    }
+    result.messages++;
+    result.max_hold_us = std::max(result.max_hold_us,
+        (long)(arrival.time - sent[i]).total_microseconds());
+  }
+  received->arrivals.clear();
+  received->packets = 0;
+  received->largest = 0;
+  return result;
+}
+
+bool Check(const char* name, bool ok, const Result& result)
+{
+  printf("%-10s %4d messages in %4d packets (largest %4u bytes), "
+      "held at most %6ld us: %s\n", name, result.messages, result.packets,
+      (unsigned)result.largest, result.max_hold_us, ok ? "OK" : "FAILED");
+  return ok;
+}
+
+void Send(am::AssetManagerClient& am, std::vector<ptime>* sent)
+{
+  sent->push_back(Now());
+  am.SendCustomUDP("/test", "i", (int)sent->size() - 1);
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  udp::socket socket(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort + 1));
+  Received received;
+  received.packets = 0;
+  received.largest = 0;
+  boost::thread receiver(boost::bind(&Receive, &socket, &received));
+  bool ok = true;
+
+  {
+    // Low rate: the next message is not expected within the budget, so every
+    // message is sent right away, the first ones included
+    const long budget_us = 20000;
+    am::AssetManagerClient am("/batch", "127.0.0.1", kPort, kPort + 1);
+    am.SetUDPBatching(budget_us);
+    std::vector<ptime> sent;
+    for (int i = 0; i < 10; ++i) {
+      Send(am, &sent);
+      boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+    }
+    am.BlockUntilQueuesAreEmpty();
+    Result result = Collect(&received, sent);
+    ok &= Check("low rate", result.in_order && result.messages == 10 &&
+        result.packets == 10 && result.max_hold_us < budget_us / 4, result);
+  }
+
+  {
+    // Burst: datagrams are filled and sent without waiting for the budget
+    const long budget_us = 200000;
+    am::AssetManagerClient am("/batch", "127.0.0.1", kPort, kPort + 1);
+    am.SetUDPBatching(budget_us);
+    std::vector<ptime> sent;
+    for (int i = 0; i < 2000; ++i) Send(am, &sent);
+    am.BlockUntilQueuesAreEmpty();
+    Result result = Collect(&received, sent);
+    ok &= Check("burst", result.in_order && result.messages == 2000 &&
+        result.packets <= 2000 / 20 && result.largest > 1400 &&
+        result.max_hold_us < budget_us / 4, result);
+  }
+
+  {
+    // Steady rate within the budget that would take about 300 ms to fill a
+    // datagram: messages are held for the budget, not until the datagram is
+    // full (with some slack for the scheduler)
+    const long budget_us = 20000;
+    am::AssetManagerClient am("/batch", "127.0.0.1", kPort, kPort + 1);
+    am.SetUDPBatching(budget_us);
+    std::vector<ptime> sent;
+    for (int i = 0; i < 80; ++i) {
+      Send(am, &sent);
+      boost::this_thread::sleep(boost::posix_time::milliseconds(5));
+    }
+    am.BlockUntilQueuesAreEmpty();
+    Result result = Collect(&received, sent);
+    ok &= Check("budget", result.in_order && result.messages == 80 &&
+        result.packets <= 80 / 2 && result.max_hold_us >= budget_us / 2 &&
+        result.max_hold_us < 2 * budget_us, result);
+  }
+
+  {
+    // Held messages go out before a reliable message and before the messages
+    // released by an ordering barrier
+    const long budget_us = 200000;
+    tcp::acceptor acceptor(io_service, tcp::endpoint(
+          boost::asio::ip::address::from_string("127.0.0.1"), kPort));
+    boost::thread drain(boost::bind(&Drain, &io_service, &acceptor));
+    {
+      am::AssetManagerClient am("/batch", "127.0.0.1", kPort, kPort + 1);
+      am.SetOption(am::AssetManagerClient::ORDERED);
+      am.SetUDPBatching(budget_us);
+      std::vector<ptime> sent;
+      for (int i = 0; i < 100; ++i) Send(am, &sent);
+      sent.push_back(Now());
+      am.SendCustomReliableUDP("/test", "i", (int)sent.size() - 1);
+      for (int i = 0; i < 100; ++i) Send(am, &sent);
+      am.SendCustomTCP("/cue", "i", 1);
+      for (int i = 0; i < 100; ++i) Send(am, &sent);
+      am.BlockUntilQueuesAreEmpty();
+      Result result = Collect(&received, sent);
+      ok &= Check("ordering", result.in_order && result.messages == 301,
+          result);
+    }
+    drain.join();
+  }
+
+  udp::socket stop(io_service, udp::v4());
+  stop.send_to(boost::asio::buffer("/stop\0\0", 8), socket.local_endpoint());
+  receiver.join();
+
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
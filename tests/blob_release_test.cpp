@@ -0,0 +1,121 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Blob release: the release function of a blob sent in a single TCP message
+// must be called once the message is written, without waiting for another
+// message or for the client to be destroyed.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const unsigned short kPort = 15150;
+const std::size_t kPayload = 1024;
+const int kTimeoutMs = 1000;
+
+using boost::asio::ip::tcp;
+
+struct Release {
+  Release() : released(false) {}
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  bool released;
+};
+
+void Released(void* context)
+{
+  Release* release = static_cast<Release*>(context);
+  boost::lock_guard<boost::mutex> lock(release->mutex);
+  release->released = true;
+  release->cond.notify_all();
+}
+
+int ReadInt32(const char* p)
+{
+  return ((unsigned char)p[0] << 24) | ((unsigned char)p[1] << 16) |
+    ((unsigned char)p[2] << 8) | (unsigned char)p[3];
+}
+
+// Accept one connection and count the "/blob/test" frames until it closes
+void Receive(boost::asio::io_service* io_service, tcp::acceptor* acceptor,
+    int* received)
+{
+  tcp::socket socket(*io_service);
+  acceptor->accept(socket);
+
+  std::vector<char> buf;
+  boost::system::error_code error;
+  while (true) {
+    char prefix[4];
+    boost::asio::read(socket, boost::asio::buffer(prefix), error);
+    if (error) break;
+    buf.resize(ReadInt32(prefix));
+    boost::asio::read(socket, boost::asio::buffer(buf), error);
+    if (error) break;
+    if (strcmp(&buf[0], "/blob/test") == 0) (*received)++;
+  }
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  tcp::acceptor acceptor(io_service, tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort));
+  int received = 0;
+  boost::thread receiver(boost::bind(&Receive, &io_service, &acceptor,
+        &received));
+
+  // Both outlive the client, which releases whatever it still holds
+  std::vector<char> payload(kPayload, 'x');
+  Release release;
+  bool released_in_time;
+  {
+    am::AssetManagerClient am("/blob", "127.0.0.1", kPort, kPort + 1);
+    {
+      am::Blob blob(&payload[0], payload.size(), &Released, &release);
+      am.SendCustomTCP("/test", "b", &blob);
+    }
+    am.BlockUntilQueuesAreEmpty();
+
+    // No other message is sent while waiting
+    boost::unique_lock<boost::mutex> lock(release.mutex);
+    boost::system_time deadline = boost::get_system_time() +
+      boost::posix_time::milliseconds(kTimeoutMs);
+    while (!release.released && release.cond.timed_wait(lock, deadline)) {}
+    released_in_time = release.released;
+  }
+  receiver.join();
+
+  printf("received %d, released %s\n", received,
+      released_in_time ? "after the write" : "late");
+  bool ok = received == 1 && released_in_time;
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,172 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Bundle encoding in tnyosc: exact timetag bytes, the bundle header after
+// set_timetag, and BundleWriter's nested bundles, refusals and depth limit.
+// A nested bundle written with BundleWriter must match the same bundle built
+// with tnyosc::Bundle.
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "tnyosc.hpp"
+
+namespace {
+
+const uint64_t kTimetag = 0x0102030405060708ULL;
+const unsigned char kTimetagBytes[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+int failures = 0;
+
+void Expect(bool condition, const char* what)
+{
+  if (!condition) {
+    printf("FAILED: %s\n", what);
+    failures++;
+  }
+}
+
+int ReadInt32(const char* p)
+{
+  return ((unsigned char)p[0] << 24) | ((unsigned char)p[1] << 16) |
+    ((unsigned char)p[2] << 8) | (unsigned char)p[3];
+}
+
+void TestTimetags()
+{
+  char out[8];
+  tnyosc::write_timetag(out, kTimetag);
+  Expect(memcmp(out, kTimetagBytes, 8) == 0, "write_timetag bytes");
+
+  // "/t" ",t" <timetag>
+  tnyosc::Message msg("/t");
+  msg.append_time(kTimetag);
+  Expect(msg.size() == 16, "append_time size");
+  Expect(memcmp(msg.data() + 8, kTimetagBytes, 8) == 0, "append_time bytes");
+
+  tnyosc::Bundle bundle;
+  Expect(bundle.size() == 16, "bundle header size");
+  Expect(memcmp(bundle.data(), "#bundle\0", 8) == 0, "bundle id");
+  const unsigned char immediately[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+  Expect(memcmp(bundle.data() + 8, immediately, 8) == 0,
+      "bundle default timetag");
+  bundle.set_timetag(kTimetag);
+  Expect(bundle.size() == 16, "header size after set_timetag");
+  Expect(memcmp(bundle.data() + 8, kTimetagBytes, 8) == 0,
+      "set_timetag bytes");
+}
+
+void TestNesting()
+{
+  tnyosc::Message a("/a");
+  a.append(1);
+  tnyosc::Message b("/b");
+  b.append(2.0f);
+
+  // outer: a, inner(kTimetag): b, inner2: a
+  char buf[256];
+  tnyosc::BundleWriter writer(buf, sizeof(buf));
+  Expect(writer.empty(), "new writer is empty");
+  Expect(writer.append(a), "append a");
+  Expect(writer.begin_bundle(kTimetag), "begin inner");
+  Expect(writer.append(b), "append b");
+  Expect(writer.begin_bundle(), "begin inner2");
+  Expect(writer.append(a), "append a to inner2");
+  Expect(writer.depth() == 2, "depth 2");
+  Expect(writer.end_bundle(), "end inner2");
+  Expect(writer.end_bundle(), "end inner");
+  Expect(!writer.end_bundle(), "end without an open bundle");
+  Expect(writer.depth() == 0, "depth 0");
+
+  tnyosc::Bundle inner2;
+  inner2.append(a);
+  tnyosc::Bundle inner;
+  inner.set_timetag(kTimetag);
+  inner.append(b);
+  inner.append(inner2);
+  tnyosc::Bundle outer;
+  outer.append(a);
+  outer.append(inner);
+  Expect(writer.size() == outer.size() &&
+      memcmp(writer.data(), outer.data(), outer.size()) == 0,
+      "nested bundle matches tnyosc::Bundle");
+
+  // The size of the inner bundle was back-patched in front of its header
+  std::size_t inner_start = 16 + 4 + a.size();
+  Expect(ReadInt32(buf + inner_start) == (int)inner.size(),
+      "inner bundle size");
+  Expect(memcmp(buf + inner_start + 4, "#bundle\0", 8) == 0,
+      "inner bundle id");
+  Expect(memcmp(buf + inner_start + 12, kTimetagBytes, 8) == 0,
+      "inner bundle timetag");
+}
+
+void TestRefusals()
+{
+  tnyosc::Message msg("/abcdef");
+  msg.append(1);
+  Expect(msg.size() == 16, "message size");
+
+  // Room for the header and one element of 4 + 16 bytes
+  char buf[16 + 20 + 8];
+  tnyosc::BundleWriter writer(buf, sizeof(buf));
+  Expect(writer.append(msg), "first element fits");
+  Expect(writer.size() == 36, "size after first element");
+  Expect(!writer.append(msg), "second element refused");
+  Expect(writer.size() == 36, "size unchanged after refusal");
+  Expect(!writer.begin_bundle(), "nested bundle refused");
+  Expect(writer.size() == 36 && writer.depth() == 0,
+      "size unchanged after refused bundle");
+  Expect(!writer.append(msg.data(), 0), "empty element refused");
+
+  char tiny[8];
+  tnyosc::BundleWriter small(tiny, sizeof(tiny));
+  Expect(!small.reset(), "reset refused without room for the header");
+  Expect(small.size() == 0, "no header written");
+
+  // Nesting stops at MAX_DEPTH without writing anything
+  char deep[1024];
+  tnyosc::BundleWriter nested(deep, sizeof(deep));
+  for (int i = 0; i < tnyosc::BundleWriter::MAX_DEPTH; ++i) {
+    Expect(nested.begin_bundle(), "begin below MAX_DEPTH");
+  }
+  std::size_t size = nested.size();
+  Expect(!nested.begin_bundle(), "begin past MAX_DEPTH refused");
+  Expect(nested.size() == size, "size unchanged past MAX_DEPTH");
+  Expect(nested.depth() == tnyosc::BundleWriter::MAX_DEPTH, "depth at max");
+  for (int i = 0; i < tnyosc::BundleWriter::MAX_DEPTH; ++i) {
+    Expect(nested.end_bundle(), "end nested");
+  }
+  // Every nested bundle is empty: each size is that of the bundles inside
+  for (int i = 0; i < tnyosc::BundleWriter::MAX_DEPTH; ++i) {
+    int expected = 16 + 20 * (tnyosc::BundleWriter::MAX_DEPTH - 1 - i);
+    Expect(ReadInt32(deep + 16 + 20 * i) == expected, "nested sizes");
+  }
+}
+
+} // namespace
+
+int main()
+{
+  TestTimetags();
+  TestNesting();
+  TestRefusals();
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
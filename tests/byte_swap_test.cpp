@@ -0,0 +1,80 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// The vector byte swap kernels against the scalar reference: every length
+// from 0 to 40 words, so each vector loop and tail is taken, from and to
+// unaligned addresses. Bytes around the destination must not be touched.
+#include <cstdio>
+#include <cstring>
+
+#include "byte_swap.hpp"
+
+namespace {
+
+const std::size_t kMaxCount = 40;
+const std::size_t kGuard = 16;
+
+} // namespace
+
+int main()
+{
+  char src[4 * kMaxCount + 8];
+  for (std::size_t i = 0; i < sizeof(src); ++i) src[i] = (char)(i * 7 + 1);
+
+  int failures = 0;
+  for (std::size_t count = 0; count <= kMaxCount; ++count) {
+    for (std::size_t src_offset = 0; src_offset < 4; ++src_offset) {
+      for (std::size_t dst_offset = 0; dst_offset < 4; ++dst_offset) {
+        char expected[4 * kMaxCount + 2 * kGuard];
+        char actual[4 * kMaxCount + 2 * kGuard];
+        memset(expected, 0x55, sizeof(expected));
+        memset(actual, 0x55, sizeof(actual));
+        am::CopyToBigEndian32Scalar(expected + kGuard + dst_offset,
+            src + src_offset, count);
+        am::CopyToBigEndian32(actual + kGuard + dst_offset,
+            src + src_offset, count);
+        if (memcmp(expected, actual, sizeof(actual)) != 0) {
+          printf("count %lu, src offset %lu, dst offset %lu differ\n",
+              (unsigned long)count, (unsigned long)src_offset,
+              (unsigned long)dst_offset);
+          failures++;
+        }
+      }
+    }
+  }
+
+  // The reference itself on a known word
+  const unsigned char word[4] = { 0x01, 0x02, 0x03, 0x04 };
+  unsigned int host;
+  memcpy(&host, word, 4);
+  unsigned char swapped[4];
+  am::CopyToBigEndian32Scalar(swapped, &host, 1);
+  const unsigned int one = 1;
+  bool little = *(const char*)&one == 1;
+  for (int i = 0; i < 4; ++i) {
+    if (swapped[i] != (little ? word[3 - i] : word[i])) {
+      printf("scalar byte %d is 0x%02x\n", i, swapped[i]);
+      failures++;
+    }
+  }
+
+  printf("kernel %s: %s\n", am::ByteSwapKernelName(),
+      failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
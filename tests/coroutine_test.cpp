@@ -0,0 +1,146 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// C++20 coroutine interface: a coroutine connects, sends TCP and UDP
+// messages and awaits each of them against local TCP and UDP servers.
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <future>
+#include <utility> // std::exchange for boost/asio/awaitable.hpp
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client_coro.hpp"
+
+namespace {
+
+const unsigned short kTCPPort = 15140;
+const unsigned short kUDPPort = 15141;
+const int kMessages = 10;
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+// Fire-and-forget coroutine type
+struct Task {
+  struct promise_type {
+    Task get_return_object() { return Task(); }
+    std::suspend_never initial_suspend() noexcept { return {}; }
+    std::suspend_never final_suspend() noexcept { return {}; }
+    void return_void() {}
+    void unhandled_exception() { std::terminate(); }
+  };
+};
+
+struct Result {
+  bool connected;
+  bool sent;
+  bool flushed;
+  bool unreachable_connected;
+  std::promise<void> done;
+};
+
+Task Control(am::CoroutineClient& am, am::CoroutineClient& unreachable,
+    Result& result)
+{
+  result.connected = co_await am.Connected();
+  result.sent = true;
+  for (int i = 0; i < kMessages; ++i) {
+    result.sent = co_await am.SendTCP("/cue", "i", i) && result.sent;
+  }
+  co_await am.SendUDP("/pos", "fff", 1.0f, 2.0f, 3.0f);
+  result.flushed = co_await am.Flush();
+  result.unreachable_connected = co_await unreachable.Connected();
+  result.done.set_value();
+}
+
+// Count the TCP messages until the client disconnects
+void ServeTCP(boost::asio::io_service* io_service, tcp::acceptor* acceptor,
+    int* received)
+{
+  tcp::socket socket(*io_service);
+  acceptor->accept(socket);
+  char buf[1500];
+  boost::system::error_code error;
+  while (true) {
+    unsigned char prefix[4];
+    boost::asio::read(socket, boost::asio::buffer(prefix), error);
+    if (error) break;
+    std::size_t size = (prefix[0] << 24) | (prefix[1] << 16) |
+      (prefix[2] << 8) | prefix[3];
+    if (size > sizeof(buf)) break;
+    boost::asio::read(socket, boost::asio::buffer(buf, size), error);
+    if (error) break;
+    if (strcmp(buf, "/test/cue") == 0) (*received)++;
+  }
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  boost::asio::ip::address loopback =
+    boost::asio::ip::address::from_string("127.0.0.1");
+  tcp::acceptor acceptor(io_service, tcp::endpoint(loopback, kTCPPort));
+  udp::socket udp_socket(io_service, udp::endpoint(loopback, kUDPPort));
+  int tcp_received = 0;
+  boost::thread server(boost::bind(&ServeTCP, &io_service, &acceptor,
+        &tcp_received));
+
+  Result result;
+  {
+    am::AssetManagerClient client("/test", "127.0.0.1", kTCPPort, kUDPPort);
+    am::AssetManagerClient unreachable_client("/test", "127.0.0.1",
+        kTCPPort + 10, kUDPPort);
+    am::CoroutineClient am(client);
+    am::CoroutineClient unreachable(unreachable_client);
+
+    std::future<void> done = result.done.get_future();
+    Control(am, unreachable, result);
+    if (done.wait_for(std::chrono::seconds(10)) !=
+        std::future_status::ready) {
+      printf("FAILED: coroutine did not complete\n");
+      return 1;
+    }
+  }
+  server.join();
+
+  int udp_received = 0;
+  while (udp_socket.available()) {
+    char buf[1500];
+    udp_socket.receive(boost::asio::buffer(buf));
+    if (strcmp(buf, "/test/pos") == 0) udp_received++;
+  }
+
+  printf("connected %d, sent %d, flushed %d, unreachable connected %d\n",
+      result.connected, result.sent, result.flushed,
+      result.unreachable_connected);
+  printf("received %d TCP and %d UDP messages\n", tcp_received,
+      udp_received);
+  bool ok = result.connected && result.sent && result.flushed &&
+    !result.unreachable_connected && tcp_received == kMessages &&
+    udp_received == 1;
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,175 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Inline UDP sends behind an ordering barrier: with UDP_INLINE and ORDERED,
+// datagrams sent while a TCP message is still unwritten must wait in the
+// queue instead of going out from the caller's thread, and every datagram,
+// inline or queued, must arrive in the order it was sent.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const unsigned short kPort = 15184;
+// Larger than the socket buffers of both ends, so the TCP message behind it
+// is not written until the receiver starts reading
+const std::size_t kBlockingBlob = 32 << 20;
+const int kMessages = 10;
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+struct Gate {
+  Gate() : open(false) {}
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  bool open;
+};
+
+// Accept the connection, but only read once the gate opens
+void ReceiveTCP(boost::asio::io_service* io_service, tcp::acceptor* acceptor,
+    Gate* gate)
+{
+  tcp::socket socket(*io_service);
+  acceptor->accept(socket);
+  {
+    boost::unique_lock<boost::mutex> lock(gate->mutex);
+    while (!gate->open) gate->cond.wait(lock);
+  }
+  std::vector<char> buf(1 << 16);
+  boost::system::error_code error;
+  while (!error) socket.read_some(boost::asio::buffer(buf), error);
+}
+
+// Collect the indices of the "/inline/test" datagrams until "/stop" arrives
+void ReceiveUDP(udp::socket* socket, boost::mutex* mutex,
+    std::vector<int>* indices)
+{
+  char buf[1500];
+  while (true) {
+    boost::system::error_code error;
+    std::size_t size = socket->receive(boost::asio::buffer(buf), 0, error);
+    if (error || (size == 8 && strcmp(buf, "/stop") == 0)) break;
+    if (size == 24 && strcmp(buf, "/inline/test") == 0) {
+      int index = ((unsigned char)buf[20] << 24) |
+        ((unsigned char)buf[21] << 16) | ((unsigned char)buf[22] << 8) |
+        (unsigned char)buf[23];
+      boost::lock_guard<boost::mutex> lock(*mutex);
+      indices->push_back(index);
+    }
+  }
+}
+
+std::size_t Count(boost::mutex* mutex, const std::vector<int>& indices)
+{
+  boost::lock_guard<boost::mutex> lock(*mutex);
+  return indices.size();
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  tcp::acceptor acceptor(io_service, tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort));
+  udp::socket socket(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort + 1));
+  Gate gate;
+  boost::mutex mutex;
+  std::vector<int> indices;
+  boost::thread tcp_receiver(boost::bind(&ReceiveTCP, &io_service, &acceptor,
+        &gate));
+  boost::thread udp_receiver(boost::bind(&ReceiveUDP, &socket, &mutex,
+        &indices));
+
+  std::vector<char> payload(kBlockingBlob, 'x');
+  std::size_t before_barrier, while_held;
+  {
+    am::AssetManagerClient am("/inline", "127.0.0.1", kPort, kPort + 1);
+    // Setting an option again keeps it
+    for (int i = 0; i < 2; ++i) {
+      am.SetOption(am::AssetManagerClient::UDP_INLINE);
+      am.SetOption(am::AssetManagerClient::ORDERED);
+    }
+    int index = 0;
+
+    // Nothing is queued: sent from this thread
+    for (int i = 0; i < kMessages; ++i) {
+      am.SendCustomUDP("/test", "i", index++);
+    }
+    am.BlockUntilQueuesAreEmpty();
+    before_barrier = Count(&mutex, indices);
+
+    // The cue is stuck behind the blob, so these are held
+    {
+      am::Blob blob(&payload[0], payload.size());
+      am.SendCustomTCP("/blob", "b", &blob);
+    }
+    am.SendCustomTCP("/cue", "i", 1);
+    for (int i = 0; i < kMessages; ++i) {
+      am.SendCustomUDP("/test", "i", index++);
+    }
+    boost::this_thread::sleep(boost::posix_time::milliseconds(300));
+    while_held = Count(&mutex, indices);
+
+    // Sent once the cue is written, still behind the held ones
+    {
+      boost::lock_guard<boost::mutex> lock(gate.mutex);
+      gate.open = true;
+      gate.cond.notify_all();
+    }
+    for (int i = 0; i < kMessages; ++i) {
+      am.SendCustomUDP("/test", "i", index++);
+    }
+    am.BlockUntilQueuesAreEmpty();
+
+    // Idle again: inline
+    for (int i = 0; i < kMessages; ++i) {
+      am.SendCustomUDP("/test", "i", index++);
+    }
+    am.BlockUntilQueuesAreEmpty();
+  }
+  tcp_receiver.join();
+  boost::this_thread::sleep(boost::posix_time::milliseconds(100));
+  udp::socket stop(io_service, udp::v4());
+  stop.send_to(boost::asio::buffer("/stop\0\0", 8), socket.local_endpoint());
+  udp_receiver.join();
+
+  bool in_order = indices.size() == 4 * kMessages;
+  for (std::size_t i = 0; in_order && i < indices.size(); ++i) {
+    in_order = indices[i] == (int)i;
+  }
+  printf("before the barrier %d, while held %d, in total %d in %s\n",
+      (int)before_barrier, (int)while_held, (int)indices.size(),
+      in_order ? "order" : "the wrong order");
+  bool ok = before_barrier == kMessages && while_held == kMessages &&
+    in_order;
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
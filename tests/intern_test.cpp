@@ -0,0 +1,189 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Interned addresses: the table returns the same index for the same full
+// address and refuses indices out of range, and custom messages sent with a
+// handle over TCP, UDP and reliable UDP are the bytes of the messages sent
+// with the url, while invalid and foreign handles send nothing.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "address_table.hpp"
+#include "asset_manager_client.hpp"
+#include "reliable_udp.hpp"
+
+namespace {
+
+const unsigned short kPort = 15182;
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+int ReadInt32(const char* p)
+{
+  return ((unsigned char)p[0] << 24) | ((unsigned char)p[1] << 16) |
+    ((unsigned char)p[2] << 8) | (unsigned char)p[3];
+}
+
+// Accept one connection and collect its frames until it closes
+void ReceiveTCP(boost::asio::io_service* io_service, tcp::acceptor* acceptor,
+    std::vector<std::string>* frames)
+{
+  tcp::socket socket(*io_service);
+  acceptor->accept(socket);
+  boost::system::error_code error;
+  while (true) {
+    char prefix[4];
+    boost::asio::read(socket, boost::asio::buffer(prefix), error);
+    if (error) break;
+    std::vector<char> buf(ReadInt32(prefix));
+    boost::asio::read(socket, boost::asio::buffer(buf), error);
+    if (error) break;
+    frames->push_back(std::string(buf.begin(), buf.end()));
+  }
+}
+
+// Collect the datagrams, unwrapping and acknowledging reliable messages,
+// until "/stop" arrives
+void ReceiveUDP(udp::socket* socket, std::vector<std::string>* datagrams)
+{
+  am::ReliableReceiver receiver;
+  char buf[1500];
+  char ack[am::RELIABLE_ACK_SIZE];
+  while (true) {
+    udp::endpoint sender;
+    boost::system::error_code error;
+    std::size_t size = socket->receive_from(boost::asio::buffer(buf), sender,
+        0, error);
+    if (error || (size == 8 && strcmp(buf, "/stop") == 0)) break;
+    const char* packet = buf;
+    std::size_t packet_size = size;
+    am::ReliableReceiver::Result result = receiver.Receive(buf, size,
+        &packet, &packet_size, ack);
+    if (result == am::ReliableReceiver::NEW_MESSAGE ||
+        result == am::ReliableReceiver::DUPLICATE) {
+      socket->send_to(boost::asio::buffer(ack), sender, 0, error);
+    }
+    if (result == am::ReliableReceiver::NOT_RELIABLE ||
+        result == am::ReliableReceiver::NEW_MESSAGE) {
+      datagrams->push_back(std::string(packet, packet_size));
+    }
+  }
+}
+
+bool CheckTable()
+{
+  am::AddressTable table;
+  int pos = table.Intern("/hall/object/pos");
+  int gain = table.Intern("/hall/object/gain");
+  bool ok = pos != gain && table.Intern("/hall/object/pos") == pos &&
+    table.size() == 2;
+
+  // The entry keeps its null padding
+  am::PaddedAddress address;
+  ok &= table.Lookup(pos, &address) && address.size == 20 &&
+    memcmp(address.data, "/hall/object/pos\0\0\0\0", 20) == 0;
+  ok &= !table.Lookup(-1, &address) && !table.Lookup(2, &address);
+  printf("address table: %s\n", ok ? "OK" : "FAILED");
+  return ok;
+}
+
+// Every frame equals the first one and there are @a count of them
+bool Same(const char* name, const std::vector<std::string>& packets,
+    std::size_t count)
+{
+  bool ok = packets.size() == count;
+  for (std::size_t i = 1; ok && i < packets.size(); ++i) {
+    ok = packets[i] == packets[0];
+  }
+  ok &= !packets.empty() && packets[0].compare(0, 17,
+      std::string("/hall/object/pos\0", 17)) == 0;
+  printf("%s: %d of %d identical: %s\n", name, (int)packets.size(),
+      (int)count, ok ? "OK" : "FAILED");
+  return ok;
+}
+
+} // namespace
+
+int main()
+{
+  bool ok = CheckTable();
+
+  boost::asio::io_service io_service;
+  tcp::acceptor acceptor(io_service, tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort));
+  udp::socket socket(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort + 1));
+  std::vector<std::string> frames;
+  std::vector<std::string> datagrams;
+  boost::thread tcp_receiver(boost::bind(&ReceiveTCP, &io_service, &acceptor,
+        &frames));
+  boost::thread udp_receiver(boost::bind(&ReceiveUDP, &socket, &datagrams));
+
+  {
+    am::AssetManagerClient am("/hall", "127.0.0.1", kPort, kPort + 1);
+    // Interning is keyed by the full address, so the client and a project
+    // with a longer base address share the entry
+    am::AddressHandle pos = am.InternAddress("/object/pos");
+    am::AddressHandle again = am.InternAddress("/object/pos");
+    am::AddressHandle shared =
+      am.OpenProject("/hall/object").InternAddress("/pos");
+    ok &= pos.valid() && again.valid() && shared.valid();
+
+    am.SendCustomTCP("/object/pos", "fi", 1.5f, 2);
+    am.SendCustomTCP(pos, "fi", 1.5f, 2);
+    am.SendCustomUDP("/object/pos", "fi", 1.5f, 2);
+    am.SendCustomUDP(pos, "fi", 1.5f, 2);
+    am.SendCustomUDP(again, "fi", 1.5f, 2);
+    am.SendCustomUDP(shared, "fi", 1.5f, 2);
+    am.SendCustomReliableUDP("/object/pos", "fi", 1.5f, 2);
+    am.SendCustomReliableUDP(pos, "fi", 1.5f, 2);
+
+    // An invalid handle, and one beyond the table of another client
+    am::AddressHandle invalid;
+    am.SendCustomTCP(invalid, "fi", 1.5f, 2);
+    am.SendCustomUDP(invalid, "fi", 1.5f, 2);
+    am.SendCustomReliableUDP(invalid, "fi", 1.5f, 2);
+    am::AddressHandle foreign = am.InternAddress("/object/gain");
+    {
+      am::AssetManagerClient other("/other", "127.0.0.1", kPort + 2,
+          kPort + 1);
+      other.InternAddress("/only");
+      other.SendCustomUDP(foreign, "fi", 1.5f, 2);
+      other.SendCustomReliableUDP(foreign, "fi", 1.5f, 2);
+      other.BlockUntilQueuesAreEmpty();
+    }
+    am.BlockUntilQueuesAreEmpty();
+  }
+  tcp_receiver.join();
+  udp::socket stop(io_service, udp::v4());
+  stop.send_to(boost::asio::buffer("/stop\0\0", 8), socket.local_endpoint());
+  udp_receiver.join();
+
+  ok &= Same("TCP", frames, 2);
+  ok &= Same("UDP", datagrams, 6);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
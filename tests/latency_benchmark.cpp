@@ -0,0 +1,300 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// End-to-end latency of AssetManagerClient on loopback. Messages sent with
+// SendCustomUDP and SendCustomTCP carry their send time and a local sink
+// records the one-way latency in a log-linear (HDR-style) histogram. Each
+// send mode (UDP, bundled UDP, UDP with adaptive batching, TCP) is measured
+// at several message rates, along with the packets it took.
+//
+// Pass --json to print one JSON object per run instead of a table.
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <time.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/smart_ptr/detail/atomic_count.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const unsigned short kTcpPort = 15160;
+const unsigned short kUdpPort = 15161;
+const int kBurst = 16;
+const double kSeconds = 1.0;
+const double kWarmupSeconds = 0.2;
+const int kRates[] = { 1000, 10000, 50000 };
+const unsigned int kBatchingBudgetUs = 250;
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+long long Now()
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Histogram of positive values with a relative error below 1/64: values
+// below 128 have a bucket each, and every further power of two is split in
+// 64 buckets.
+class Histogram {
+ public:
+  enum { SUB_BUCKETS = 64, BUCKETS = 57 * SUB_BUCKETS + SUB_BUCKETS };
+
+  Histogram() : counts_(BUCKETS), count_(0), max_(0) {}
+
+  void Record(long long value) {
+    if (value < 0) value = 0;
+    counts_[Index(value)]++;
+    count_++;
+    if (value > max_) max_ = value;
+  }
+
+  void Reset() {
+    std::fill(counts_.begin(), counts_.end(), 0);
+    count_ = 0;
+    max_ = 0;
+  }
+
+  long long count() const { return count_; }
+  long long max() const { return max_; }
+
+  /// Highest value of the bucket holding the given fraction of the values.
+  long long Percentile(double fraction) const {
+    long long rank = (long long)(fraction * count_ + 0.5);
+    if (rank < 1) rank = 1;
+    long long seen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+      seen += counts_[i];
+      if (seen >= rank) return std::min(HighestValue(i), max_);
+    }
+    return max_;
+  }
+
+ private:
+  static int Index(long long value) {
+    if (value < 2 * SUB_BUCKETS) return (int)value;
+    int shift = 0;
+    while ((value >> shift) >= 2 * SUB_BUCKETS) ++shift;
+    return shift * SUB_BUCKETS + (int)(value >> shift);
+  }
+
+  static long long HighestValue(int index) {
+    if (index < 2 * SUB_BUCKETS) return index;
+    int shift = index / SUB_BUCKETS - 1;
+    long long lowest = (long long)(index - shift * SUB_BUCKETS) << shift;
+    return lowest + (1LL << shift) - 1;
+  }
+
+  std::vector<long long> counts_;
+  long long count_;
+  long long max_;
+};
+
+struct Sink {
+  boost::mutex mutex;
+  Histogram latencies;
+};
+
+// Records the latency of every "/lat ,h <send time>" message of a packet,
+// looking into bundles.
+void Measure(const char* packet, std::size_t size, long long now, Sink* sink)
+{
+  if (size >= 16 && memcmp(packet, "#bundle", 8) == 0) {
+    std::size_t offset = 16;
+    while (offset + 4 <= size) {
+      int32_t n;
+      memcpy(&n, packet + offset, 4);
+      n = ntohl(n);
+      offset += 4;
+      if (n <= 0 || offset + n > size) break;
+      Measure(packet + offset, n, now, sink);
+      offset += n;
+    }
+    return;
+  }
+  if (size != 20 || memcmp(packet, "/lat\0\0\0\0,h\0\0", 12) != 0) return;
+  long long sent = 0;
+  for (int i = 12; i < 20; ++i) sent = (sent << 8) | (unsigned char)packet[i];
+  boost::lock_guard<boost::mutex> lock(sink->mutex);
+  sink->latencies.Record(now - sent);
+}
+
+// Receive datagrams until "/stop" arrives
+void ReceiveUDP(udp::socket* socket, Sink* sink)
+{
+  char buf[65536];
+  while (true) {
+    std::size_t size = socket->receive(boost::asio::buffer(buf));
+    long long now = Now();
+    if (size == 8 && strcmp(buf, "/stop") == 0) break;
+    Measure(buf, size, now, sink);
+  }
+}
+
+// Read the TCP stream of one client after the other until @a stop is set
+void ReceiveTCP(tcp::acceptor* acceptor, Sink* sink,
+    boost::detail::atomic_count* stop)
+{
+  std::vector<char> frame;
+  while (true) {
+    tcp::socket socket(acceptor->get_executor());
+    acceptor->accept(socket);
+    if (*stop) break;
+    boost::system::error_code error;
+    while (!error) {
+      int32_t n;
+      boost::asio::read(socket, boost::asio::buffer(&n, 4), error);
+      n = ntohl(n);
+      if (error || n <= 0) break;
+      frame.resize(n);
+      boost::asio::read(socket, boost::asio::buffer(frame), error);
+      if (!error) Measure(&frame[0], frame.size(), Now(), sink);
+    }
+  }
+}
+
+enum Mode { UDP, UDP_BUNDLED, UDP_BATCHED, TCP };
+const char* const kModeNames[] = { "udp", "udp_bundled", "udp_batched",
+  "tcp" };
+
+// Packets, or TCP messages, sent by @a am so far
+std::size_t PacketsSent(am::AssetManagerClient& am, Mode mode)
+{
+  am::AssetManagerClient::DestinationStatistics stats =
+    am.GetDestinationStatistics()[0];
+  return mode == TCP ? stats.tcp_messages_sent : stats.udp_packets_sent;
+}
+
+// Send @a count messages, a multiple of kBurst, in bursts at @a rate
+// messages per second
+void SendMessages(am::AssetManagerClient& am, Mode mode, int rate, int count)
+{
+  long long interval = 1000000000LL * kBurst / rate;
+  long long due = Now();
+  for (int i = 0; i < count; i += kBurst) {
+    long long wait = due - Now();
+    if (wait > 0) {
+      boost::this_thread::sleep(boost::posix_time::microseconds(
+            wait / 1000));
+    }
+    due += interval;
+    if (mode == UDP_BUNDLED) am.StartBundle();
+    for (int j = 0; j < kBurst; ++j) {
+      if (mode == TCP) {
+        am.SendCustomTCP("/lat", "h", (int64_t)Now());
+      } else {
+        am.SendCustomUDP("/lat", "h", (int64_t)Now());
+      }
+    }
+    if (mode == UDP_BUNDLED) am.EndBundle();
+  }
+  am.BlockUntilQueuesAreEmpty();
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+}
+
+void Run(Mode mode, int rate, Sink& sink, bool json)
+{
+  am::AssetManagerClient am("", "127.0.0.1", kTcpPort, kUdpPort);
+  if (mode == UDP_BATCHED) am.SetUDPBatching(kBatchingBudgetUs);
+  // The first TCP messages wait for the connection
+  SendMessages(am, mode, rate, (int)(rate * kWarmupSeconds));
+  {
+    boost::lock_guard<boost::mutex> lock(sink.mutex);
+    sink.latencies.Reset();
+  }
+
+  int count = ((int)(rate * kSeconds) + kBurst - 1) / kBurst * kBurst;
+  std::size_t packets = PacketsSent(am, mode);
+  SendMessages(am, mode, rate, count);
+  packets = PacketsSent(am, mode) - packets;
+
+  Histogram latencies;
+  {
+    boost::lock_guard<boost::mutex> lock(sink.mutex);
+    latencies = sink.latencies;
+  }
+  if (json) {
+    printf("{\"mode\": \"%s\", \"rate\": %d, \"sent\": %d, \"received\": %lld, "
+        "\"packets\": %u, \"p50_us\": %.1f, \"p99_us\": %.1f, "
+        "\"p999_us\": %.1f, \"max_us\": %.1f}\n", kModeNames[mode], rate,
+        count, latencies.count(), (unsigned)packets,
+        latencies.Percentile(0.5) / 1000.0,
+        latencies.Percentile(0.99) / 1000.0,
+        latencies.Percentile(0.999) / 1000.0, latencies.max() / 1000.0);
+  } else {
+    printf("%-12s %8d %9d %9lld %9u %9.1f %9.1f %9.1f %9.1f\n",
+        kModeNames[mode], rate, count, latencies.count(), (unsigned)packets,
+        latencies.Percentile(0.5) / 1000.0,
+        latencies.Percentile(0.99) / 1000.0,
+        latencies.Percentile(0.999) / 1000.0, latencies.max() / 1000.0);
+  }
+  fflush(stdout);
+}
+
+} // namespace
+
+int main(int argc, const char* argv[])
+{
+  bool json = argc > 1 && strcmp(argv[1], "--json") == 0;
+
+  boost::asio::io_service io_service;
+  boost::asio::ip::address loopback =
+    boost::asio::ip::address::from_string("127.0.0.1");
+  udp::socket socket(io_service, udp::endpoint(loopback, kUdpPort));
+  socket.set_option(boost::asio::socket_base::receive_buffer_size(1 << 22));
+  tcp::acceptor acceptor(io_service, tcp::endpoint(loopback, kTcpPort));
+  Sink sink;
+  boost::detail::atomic_count stop(0);
+  boost::thread udp_receiver(boost::bind(&ReceiveUDP, &socket, &sink));
+  boost::thread tcp_receiver(boost::bind(&ReceiveTCP, &acceptor, &sink,
+        &stop));
+
+  if (!json) {
+    printf("%-12s %8s %9s %9s %9s %9s %9s %9s %9s\n", "mode", "msg/s",
+        "sent", "received", "packets", "p50 us", "p99 us", "p99.9 us",
+        "max us");
+  }
+  for (int mode = UDP; mode <= TCP; ++mode) {
+    for (std::size_t i = 0; i < sizeof(kRates) / sizeof(kRates[0]); ++i) {
+      Run((Mode)mode, kRates[i], sink, json);
+    }
+  }
+
+  udp::socket stop_udp(io_service, udp::v4());
+  stop_udp.send_to(boost::asio::buffer("/stop\0\0", 8),
+      socket.local_endpoint());
+  ++stop;
+  tcp::socket stop_tcp(io_service);
+  stop_tcp.connect(acceptor.local_endpoint());
+  udp_receiver.join();
+  tcp_receiver.join();
+  return 0;
+}
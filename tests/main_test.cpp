@@ -45,8 +45,9 @@ int main(int argc, const char* argv[])
   // Send a custom message over TCP
   am.SendCustomTCP("/object/cue", "i", 1);
 
-  // Sleep a little so the TCP message gets sent before the UDP messages.
-  usleep(1000);
+  // Hold the following UDP messages until the TCP message has been sent.
+  // This does not block; the client releases them once the TCP write is done.
+  am.OrderingBarrier();
 
   // Start a new bundle so UDP packets are bundled as many as possible.
   am.StartBundle();
@@ -0,0 +1,230 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// MessageBufferPool: released slots are reused before new slabs are reserved,
+// regular and large buffers come from their own slot classes, the memory cap
+// refuses new slabs and counts the refusals, and the client reports the pool
+// usage through GetMemoryStatistics.
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+#include "message_buffer.hpp"
+
+namespace {
+
+const unsigned short kPort = 15188;
+const std::size_t kSlotSize = 100;
+const std::size_t kLargeSlotSize = 1000;
+const std::size_t kSlots = am::MessageBufferPool::SLOTS_PER_SLAB;
+const std::size_t kLargeSlots = am::MessageBufferPool::LARGE_SLOTS_PER_SLAB;
+
+typedef std::vector<am::MessageBufferPtr> Buffers;
+
+bool Check(const char* name, bool ok)
+{
+  printf("%-24s %s\n", name, ok ? "OK" : "FAILED");
+  return ok;
+}
+
+// Acquire @a count regular buffers, false if any is refused
+bool AcquireAll(am::MessageBufferPool& pool, std::size_t count,
+    Buffers* buffers)
+{
+  for (std::size_t i = 0; i < count; ++i) {
+    am::MessageBufferPtr buffer = pool.Acquire();
+    if (!buffer) return false;
+    buffers->push_back(buffer);
+  }
+  return true;
+}
+
+void ReleaseAll(Buffers* buffers)
+{
+  buffers->clear();
+}
+
+} // namespace
+
+int main()
+{
+  bool ok = true;
+  char bytes[kLargeSlotSize + 1];
+  for (std::size_t i = 0; i < sizeof(bytes); ++i) bytes[i] = (char)(i * 7);
+
+  {
+    am::MessageBufferPool pool(kSlotSize, kLargeSlotSize);
+    am::MessageBufferPool::Statistics stats = pool.GetStatistics();
+    const std::size_t slot = stats.slot_size;
+    const std::size_t large_slot = stats.large_slot_size;
+    ok &= Check("initial statistics", slot >= kSlotSize +
+        am::MessageBuffer::HEADROOM && large_slot >= kLargeSlotSize +
+        am::MessageBuffer::HEADROOM && slot % sizeof(void*) == 0 &&
+        large_slot % sizeof(void*) == 0 && stats.slots_total == 0 &&
+        stats.slots_in_use == 0 && stats.bytes_reserved == 0 &&
+        stats.memory_limit == 0 && stats.failed_allocations == 0);
+
+    // The first buffer reserves one slab, and a released slot is handed out
+    // again, cleared, before any other
+    am::MessageBufferPtr buffer = pool.Acquire();
+    stats = pool.GetStatistics();
+    bool first = buffer && buffer->capacity() == kSlotSize &&
+      buffer->empty() && stats.slots_total == kSlots &&
+      stats.slots_in_use == 1 && stats.bytes_reserved == kSlots * slot;
+    am::MessageBuffer* reused = buffer.get();
+    if (buffer) buffer->Append(bytes, kSlotSize);
+    buffer.reset();
+    buffer = pool.Acquire();
+    stats = pool.GetStatistics();
+    ok &= Check("slot reuse", first && buffer.get() == reused &&
+        buffer->empty() && stats.slots_total == kSlots &&
+        stats.slots_in_use == 1);
+    buffer.reset();
+
+    // Filling the slab reserves a second one; once everything is released,
+    // the same number of buffers fits in the slabs already reserved
+    Buffers buffers;
+    bool filled = AcquireAll(pool, kSlots + 1, &buffers);
+    std::set<am::MessageBuffer*> distinct;
+    for (std::size_t i = 0; i < buffers.size(); ++i) {
+      distinct.insert(buffers[i].get());
+    }
+    stats = pool.GetStatistics();
+    filled &= distinct.size() == kSlots + 1 &&
+      stats.slots_total == 2 * kSlots && stats.slots_in_use == kSlots + 1 &&
+      stats.bytes_reserved == 2 * kSlots * slot;
+    ReleaseAll(&buffers);
+    filled &= AcquireAll(pool, 2 * kSlots, &buffers);
+    stats = pool.GetStatistics();
+    ok &= Check("slab reuse", filled && stats.slots_total == 2 * kSlots &&
+        stats.slots_in_use == 2 * kSlots &&
+        stats.peak_slots_in_use == 2 * kSlots &&
+        stats.bytes_reserved == 2 * kSlots * slot);
+
+    // Buffers may be released on any thread
+    boost::thread releaser(boost::bind(ReleaseAll, &buffers));
+    releaser.join();
+    stats = pool.GetStatistics();
+    ok &= Check("release on thread", buffers.empty() &&
+        stats.slots_in_use == 0 && stats.peak_slots_in_use == 2 * kSlots);
+
+    // Large buffers have their own, smaller slabs; copies go to the smallest
+    // class they fit in, and copies that fit in none are not a cap refusal
+    am::MessageBufferPtr large = pool.AcquireLarge();
+    stats = pool.GetStatistics();
+    bool large_ok = large && large->capacity() == kLargeSlotSize &&
+      stats.slots_total == 2 * kSlots + kLargeSlots &&
+      stats.bytes_reserved == 2 * kSlots * slot + kLargeSlots * large_slot;
+    am::MessageBufferPtr small_copy = pool.Acquire(bytes, kSlotSize);
+    am::MessageBufferPtr large_copy = pool.Acquire(bytes, kSlotSize + 1);
+    am::MessageBufferPtr too_large = pool.Acquire(bytes, kLargeSlotSize + 1);
+    stats = pool.GetStatistics();
+    ok &= Check("slot classes", large_ok && small_copy &&
+        small_copy->capacity() == kSlotSize &&
+        small_copy->size() == kSlotSize &&
+        memcmp(small_copy->data(), bytes, kSlotSize) == 0 && large_copy &&
+        large_copy->capacity() == kLargeSlotSize &&
+        large_copy->size() == kSlotSize + 1 &&
+        memcmp(large_copy->data(), bytes, kSlotSize + 1) == 0 &&
+        !too_large && stats.slots_in_use == 3 &&
+        stats.slots_total == 2 * kSlots + kLargeSlots &&
+        stats.failed_allocations == 0);
+  }
+
+  {
+    am::MessageBufferPool pool(kSlotSize);
+    am::MessageBufferPool::Statistics stats = pool.GetStatistics();
+    ok &= Check("no large class", !pool.AcquireLarge() &&
+        !pool.Acquire(bytes, kSlotSize + 1) && stats.large_slot_size == 0 &&
+        pool.GetStatistics().slots_total == 0 &&
+        pool.GetStatistics().failed_allocations == 0);
+  }
+
+  {
+    // Cap the pool at its first slab: the slab is used up, then every new
+    // slab is refused and counted, regular or large
+    am::MessageBufferPool pool(kSlotSize, kLargeSlotSize);
+    Buffers buffers;
+    bool filled = AcquireAll(pool, 1, &buffers);
+    std::size_t reserved = pool.GetStatistics().bytes_reserved;
+    pool.SetMemoryLimit(reserved);
+    filled &= AcquireAll(pool, kSlots - 1, &buffers);
+    am::MessageBufferPtr refused = pool.Acquire();
+    am::MessageBufferPtr refused_large = pool.AcquireLarge();
+    am::MessageBufferPtr refused_copy = pool.Acquire(bytes, kSlotSize);
+    am::MessageBufferPool::Statistics stats = pool.GetStatistics();
+    ok &= Check("limit refusals", filled && !refused && !refused_large &&
+        !refused_copy && stats.memory_limit == reserved &&
+        stats.bytes_reserved == reserved && stats.slots_total == kSlots &&
+        stats.slots_in_use == kSlots && stats.failed_allocations == 3);
+
+    // Released slots are still handed out under the cap, even one below the
+    // memory already reserved, which is kept
+    buffers.pop_back();
+    pool.SetMemoryLimit(1);
+    am::MessageBufferPtr reused = pool.Acquire();
+    refused = pool.Acquire();
+    stats = pool.GetStatistics();
+    ok &= Check("limit keeps slabs", reused && !refused &&
+        stats.memory_limit == 1 && stats.bytes_reserved == reserved &&
+        stats.failed_allocations == 4);
+
+    // Without a cap the pool grows again
+    pool.SetMemoryLimit(0);
+    am::MessageBufferPtr grown = pool.Acquire();
+    am::MessageBufferPtr grown_large = pool.AcquireLarge();
+    stats = pool.GetStatistics();
+    ok &= Check("limit lifted", grown && grown_large &&
+        stats.memory_limit == 0 && stats.slots_total == 2 * kSlots +
+        kLargeSlots && stats.failed_allocations == 4);
+  }
+
+  {
+    // The client reports its pool, refusals as dropped messages
+    am::AssetManagerClient am("/foyer", "127.0.0.1", kPort, kPort + 1);
+    am::AssetManagerClient::MemoryStatistics stats =
+      am.GetMemoryStatistics();
+    bool initial = stats.slots_total == 0 && stats.bytes_reserved == 0 &&
+      stats.slot_size > 0 && stats.large_slot_size > stats.slot_size &&
+      stats.dropped_messages == 0;
+    am.SetMemoryLimit(1);
+    const char packet[] = "/test\0\0\0,\0\0\0";
+    bool dropped = !am.SendPacketUDP(packet, sizeof(packet) - 1) &&
+      !am.SendPacketUDP(packet, sizeof(packet) - 1);
+    stats = am.GetMemoryStatistics();
+    dropped &= stats.memory_limit == 1 && stats.slots_total == 0 &&
+      stats.dropped_messages == 2;
+    am.SetMemoryLimit(0);
+    bool sent = am.SendPacketUDP(packet, sizeof(packet) - 1);
+    am.BlockUntilQueuesAreEmpty();
+    stats = am.GetMemoryStatistics();
+    ok &= Check("client statistics", initial && dropped && sent &&
+        stats.memory_limit == 0 && stats.slots_total > 0 &&
+        stats.bytes_reserved > 0 && stats.peak_slots_in_use > 0 &&
+        stats.dropped_messages == 2);
+  }
+
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,149 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// tnyosc::MessageBuilder against tnyosc::Message: the same arguments must
+// encode to the same bytes. The type tag string grows by 4 bytes every 4
+// tags and the arguments already written are moved, so every mix of 0 to 11
+// arguments is checked from every starting type, with addresses of each
+// length modulo 4.
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+#include "tnyosc.hpp"
+
+namespace {
+
+const int kTypes = 14;
+const int kMaxArguments = 11;
+const char* kAddresses[] = { "/a", "/ab", "/abc", "/abcd" };
+
+// Append argument @a k of type @a type to both messages
+void Append(int type, int k, tnyosc::Message& msg,
+    tnyosc::MessageBuilder& builder)
+{
+  char blob[7] = { 1, 2, 3, 4, 5, 6, 7 };
+  std::string str(k % 6 + 1, (char)('a' + k));
+  switch (type) {
+    case 0:
+      msg.append((int32_t)(k * 1000 - 7));
+      builder.append((int32_t)(k * 1000 - 7));
+      break;
+    case 1:
+      msg.append(k * 0.5f);
+      builder.append(k * 0.5f);
+      break;
+    case 2:
+      msg.append(str);
+      builder.append(str);
+      break;
+    case 3:
+      msg.append_cstring(str.data(), str.size());
+      builder.append_cstring(str.data(), str.size());
+      break;
+    case 4:
+      msg.append_blob(blob, k % 8);
+      builder.append_blob(blob, k % 8);
+      break;
+    case 5:
+      msg.append_time(0x0102030405060708ULL + k);
+      builder.append_time(0x0102030405060708ULL + k);
+      break;
+    case 6:
+      msg.append_true();
+      builder.append_true();
+      break;
+    case 7:
+      msg.append_false();
+      builder.append_false();
+      break;
+    case 8:
+      msg.append_null();
+      builder.append_null();
+      break;
+    case 9:
+      msg.append_impulse();
+      builder.append_impulse();
+      break;
+    case 10:
+      msg.append((int64_t)k << 40);
+      builder.append((int64_t)k << 40);
+      break;
+    case 11:
+      msg.append(k * 0.25);
+      builder.append(k * 0.25);
+      break;
+    case 12:
+      msg.append((char)('A' + k));
+      builder.append((char)('A' + k));
+      break;
+    default:
+      msg.append_midi(1, 0x90, (uint8_t)k, 100);
+      builder.append_midi(1, 0x90, (uint8_t)k, 100);
+      break;
+  }
+}
+
+// Encode @a count arguments whose types step through the list by @a stride
+// from @a first and compare the results
+bool Compare(const char* address, int count, int first, int stride)
+{
+  tnyosc::Message msg(address);
+  tnyosc::MessageBuilder builder(address, 0);
+  for (int k = 0; k < count; ++k) {
+    Append((first + k * stride) % kTypes, k, msg, builder);
+  }
+  if (msg.size() == builder.size() &&
+      memcmp(msg.data(), builder.data(), msg.size()) == 0) {
+    return true;
+  }
+  printf("%s with %d arguments from type %d by %d differs\n", address,
+      count, first, stride);
+  return false;
+}
+
+} // namespace
+
+int main()
+{
+  int checked = 0;
+  int failures = 0;
+  for (std::size_t a = 0; a < sizeof(kAddresses) / sizeof(*kAddresses); ++a) {
+    for (int count = 0; count <= kMaxArguments; ++count) {
+      for (int first = 0; first < kTypes; ++first) {
+        for (int stride = 0; stride < kTypes; ++stride) {
+          if (!Compare(kAddresses[a], count, first, stride)) failures++;
+          checked++;
+        }
+      }
+    }
+  }
+
+  // The default address
+  tnyosc::Message msg;
+  tnyosc::MessageBuilder builder;
+  if (msg.size() != builder.size() ||
+      memcmp(msg.data(), builder.data(), msg.size()) != 0) {
+    printf("default address differs\n");
+    failures++;
+  }
+
+  printf("%d argument lists: %s\n", checked, failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
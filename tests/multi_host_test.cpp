@@ -0,0 +1,121 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Multiple hosts on a single machine: every datagram is encoded once and sent
+// from one socket to each host, so two listeners on different loopback
+// addresses must receive the same bytes, while a host that does not resolve
+// and one that refuses every datagram only show up in their own statistics.
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const unsigned short kPort = 15178;
+const int kMessages = 50;
+
+using boost::asio::ip::udp;
+
+// Collect the datagrams that arrive until the socket stays quiet
+std::vector<std::string> Receive(udp::socket& socket)
+{
+  using namespace boost::posix_time;
+  std::vector<std::string> datagrams;
+  ptime deadline = microsec_clock::universal_time() + milliseconds(500);
+  char buf[65536];
+  while (microsec_clock::universal_time() < deadline) {
+    if (!socket.available()) {
+      boost::this_thread::sleep(milliseconds(10));
+      continue;
+    }
+    std::size_t size = socket.receive(boost::asio::buffer(buf));
+    datagrams.push_back(std::string(buf, size));
+    deadline = microsec_clock::universal_time() + milliseconds(500);
+  }
+  return datagrams;
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  udp::socket first(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort + 1));
+  udp::socket second(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.2"), kPort + 1));
+
+  // The broadcast address is refused without SO_BROADCAST
+  std::vector<std::string> hosts;
+  hosts.push_back("127.0.0.1");
+  hosts.push_back("unresolvable.invalid");
+  hosts.push_back("255.255.255.255");
+  hosts.push_back("127.0.0.2");
+
+  std::vector<char> payload(600, 'b');
+  std::vector<am::AssetManagerClient::DestinationStatistics> stats;
+  {
+    am::AssetManagerClient am("/multi", hosts, kPort, kPort + 1);
+    for (int i = 0; i < kMessages; ++i) {
+      if (i % 10 == 0) {
+        am::Blob blob(&payload[0], payload.size());
+        am.SendCustomUDP("/blob", "ib", i, &blob);
+      } else {
+        am.SendCustomUDP("/test", "if", i, 0.5f * i);
+      }
+    }
+    am.BlockUntilQueuesAreEmpty();
+    stats = am.GetDestinationStatistics();
+  }
+
+  std::vector<std::string> received[2] = { Receive(first), Receive(second) };
+  bool ok = true;
+  for (int i = 0; i < 2; ++i) {
+    printf("%-22s received %d\n", hosts[i * 3].c_str(),
+        static_cast<int>(received[i].size()));
+  }
+  if (received[0].size() != kMessages || received[0] != received[1]) {
+    printf("the listeners received different datagrams\n");
+    ok = false;
+  }
+
+  for (std::size_t i = 0; i < stats.size(); ++i) {
+    printf("%-22s resolved %d, sent %u, errors %u\n", stats[i].host.c_str(),
+        stats[i].resolved, (unsigned)stats[i].udp_packets_sent,
+        (unsigned)stats[i].udp_errors);
+  }
+  for (int i = 0; i < 2; ++i) {
+    const am::AssetManagerClient::DestinationStatistics& live = stats[i * 3];
+    ok &= live.resolved && live.udp_packets_sent == kMessages &&
+      live.udp_errors == 0;
+  }
+  ok &= !stats[1].resolved && stats[1].udp_packets_sent == 0 &&
+    stats[1].udp_errors == 0;
+  ok &= stats[2].resolved && stats[2].udp_packets_sent == 0 &&
+    stats[2].udp_errors == kMessages;
+
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Multicast test on a single machine: two listeners join a group on the
+// loopback interface and must each receive every message sent to the group.
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const char* kGroup = "239.255.0.1";
+const char* kInterface = "127.0.0.1";
+const unsigned short kPort = 15103;
+const int kMessages = 20;
+
+using boost::asio::ip::udp;
+
+// Count the messages received within the timeout
+int Receive(udp::socket& socket, int expected)
+{
+  using namespace boost::posix_time;
+  ptime deadline = microsec_clock::universal_time() + seconds(2);
+  int received = 0;
+  char buf[1500];
+  while (received < expected && microsec_clock::universal_time() < deadline) {
+    if (!socket.available()) {
+      boost::this_thread::sleep(milliseconds(10));
+      continue;
+    }
+    std::size_t size = socket.receive(boost::asio::buffer(buf));
+    if (size > 8 && strcmp(buf, "/multicast/test") == 0) received++;
+  }
+  return received;
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  boost::asio::ip::address group =
+    boost::asio::ip::address::from_string(kGroup);
+  boost::asio::ip::address_v4 interface =
+    boost::asio::ip::address_v4::from_string(kInterface);
+
+  // Two listeners standing for two Asset Manager instances
+  udp::socket listener0(io_service);
+  udp::socket listener1(io_service);
+  udp::socket* listeners[2] = { &listener0, &listener1 };
+  for (int i = 0; i < 2; ++i) {
+    listeners[i]->open(udp::v4());
+    listeners[i]->set_option(udp::socket::reuse_address(true));
+    listeners[i]->bind(udp::endpoint(udp::v4(), kPort));
+    listeners[i]->set_option(
+        boost::asio::ip::multicast::join_group(group.to_v4(), interface));
+  }
+
+  {
+    am::AssetManagerClient client("/multicast", kGroup, kPort - 1, kPort);
+    am::AssetManagerClient::MulticastOptions multicast;
+    multicast.ttl = 0;
+    multicast.loopback = true;
+    multicast.interface_address = kInterface;
+    client.SetMulticastOptions(multicast);
+    for (int i = 0; i < kMessages; ++i) {
+      client.SendCustomUDP("/test", "i", i);
+    }
+    client.BlockUntilQueuesAreEmpty();
+
+    std::vector<am::AssetManagerClient::DestinationStatistics> stats =
+      client.GetDestinationStatistics();
+    printf("sent %lu packets to %s\n",
+        (unsigned long)stats[0].udp_packets_sent, kGroup);
+  }
+
+  int failures = 0;
+  for (int i = 0; i < 2; ++i) {
+    int received = Receive(*listeners[i], kMessages);
+    printf("listener %d: received %d of %d\n", i, received, kMessages);
+    if (received != kMessages) failures++;
+  }
+  printf(failures ? "FAILED\n" : "OK\n");
+  return failures ? 1 : 0;
+}
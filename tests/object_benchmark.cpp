@@ -0,0 +1,161 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Benchmark for frame updates of many sound objects: one SendCustomUDP call
+// per object within a bundle against a single SendObjectsUDP call and
+// against writing every object into a SceneState, which only sends what
+// changed. Frames move either every object or a few of them. The datagrams
+// are received on a local socket to count the packets per frame.
+#include <cstdio>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const std::size_t kObjects = 1000;
+const int kFrameRate = 120;
+const int kFrames = kFrameRate * 5;
+// Objects moving per frame in the sparse run
+const std::size_t kSparseObjects = 50;
+
+struct Scene {
+  std::vector<int> ids;
+  std::vector<float> x, y, z, gains;
+};
+
+// Mirror used by SendSceneState, created once the client is
+am::SceneState* scene_state = NULL;
+
+struct Result {
+  double frame_us;
+  std::size_t datagrams;
+  std::size_t bytes;
+};
+
+// Receive everything sent so far without blocking
+void Drain(boost::asio::ip::udp::socket& socket, Result& result)
+{
+  char buf[65536];
+  while (socket.available()) {
+    result.bytes += socket.receive(boost::asio::buffer(buf));
+    result.datagrams++;
+  }
+}
+
+void SendPerObject(am::AssetManagerClient& client, const Scene& scene)
+{
+  char url[64];
+  client.StartBundle();
+  for (std::size_t i = 0; i < kObjects; ++i) {
+    snprintf(url, sizeof(url), "/object/%d/pos", scene.ids[i]);
+    client.SendCustomUDP(url, "fff", scene.x[i], scene.y[i], scene.z[i]);
+    snprintf(url, sizeof(url), "/object/%d/gain", scene.ids[i]);
+    client.SendCustomUDP(url, "f", scene.gains[i]);
+  }
+  client.EndBundle();
+}
+
+void SendBulk(am::AssetManagerClient& client, const Scene& scene)
+{
+  client.SendObjectsUDP("/object", &scene.ids[0], &scene.x[0], &scene.y[0],
+      &scene.z[0], kObjects, &scene.gains[0]);
+}
+
+void SendSceneState(am::AssetManagerClient&, const Scene& scene)
+{
+  for (std::size_t i = 0; i < kObjects; ++i) {
+    scene_state->SetPosition(i, scene.x[i], scene.y[i], scene.z[i]);
+    scene_state->SetGain(i, scene.gains[i]);
+  }
+  scene_state->Flush();
+}
+
+Result Measure(void (*send)(am::AssetManagerClient&, const Scene&),
+    am::AssetManagerClient& client, boost::asio::ip::udp::socket& socket,
+    Scene& scene, std::size_t moving)
+{
+  using namespace boost::posix_time;
+  Result result = { 0.0, 0, 0 };
+  time_duration elapsed;
+  for (int frame = 0; frame < kFrames; ++frame) {
+    for (std::size_t i = 0; i < moving; ++i) scene.x[i] += 0.01f;
+    ptime start = microsec_clock::universal_time();
+    send(client, scene);
+    elapsed += microsec_clock::universal_time() - start;
+    // Let the IO thread catch up so frames do not pile up in the queue
+    client.BlockUntilQueuesAreEmpty();
+    Drain(socket, result);
+  }
+  result.frame_us = (double)elapsed.total_microseconds() / kFrames;
+  return result;
+}
+
+void Print(const char* name, const Result& result)
+{
+  double messages = 2.0 * kObjects;
+  double frame_budget_us = 1e6 / kFrameRate;
+  printf("%-12s %10.1f %14.0f %12.1f %12.0f %9.1f%%\n", name,
+      result.frame_us, messages / result.frame_us * 1e6,
+      (double)result.datagrams / kFrames, (double)result.bytes / kFrames,
+      100.0 * result.frame_us / frame_budget_us);
+}
+
+} // namespace
+
+int main()
+{
+  using boost::asio::ip::udp;
+  boost::asio::io_service io_service;
+  udp::socket socket(io_service, udp::endpoint(udp::v4(), 0));
+  socket.set_option(boost::asio::socket_base::receive_buffer_size(1 << 22));
+  unsigned short port = socket.local_endpoint().port();
+
+  Scene scene;
+  for (std::size_t i = 0; i < kObjects; ++i) {
+    scene.ids.push_back((int)i + 1);
+    scene.x.push_back(i * 0.1f);
+    scene.y.push_back(i * 0.2f);
+    scene.z.push_back(1.5f);
+    scene.gains.push_back(0.5f);
+  }
+
+  am::AssetManagerClient client("/benchmark", "127.0.0.1", 15002, port);
+  am::SceneState state(client.OpenProject("/benchmark"), "/object");
+  for (std::size_t i = 0; i < kObjects; ++i) state.AddObject(scene.ids[i]);
+  scene_state = &state;
+
+  const std::size_t moving[2] = { kObjects, kSparseObjects };
+  for (int run = 0; run < 2; ++run) {
+    printf("%s%lu objects, %lu moving, position and gain, %d frames\n",
+        run ? "\n" : "", (unsigned long)kObjects, (unsigned long)moving[run],
+        kFrames);
+    printf("%-12s %10s %14s %12s %12s %10s\n", "", "us/frame", "messages/s",
+        "packets", "bytes", "@120Hz");
+    Print("per-object",
+        Measure(SendPerObject, client, socket, scene, moving[run]));
+    Print("bulk", Measure(SendBulk, client, socket, scene, moving[run]));
+    Print("scene-state",
+        Measure(SendSceneState, client, socket, scene, moving[run]));
+  }
+  return 0;
+}
@@ -0,0 +1,224 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Prebuilt packets over loopback: tnyosc messages and bundles sent through
+// every SendPacket, SendMessage and SendBundle variant must arrive byte for
+// byte, and packets that are not padded OSC messages or bundles must be
+// refused without sending anything.
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+#include "reliable_udp.hpp"
+#include "tnyosc.hpp"
+
+namespace {
+
+const unsigned short kPort = 15180;
+
+using boost::asio::ip::tcp;
+using boost::asio::ip::udp;
+
+int ReadInt32(const char* p)
+{
+  return ((unsigned char)p[0] << 24) | ((unsigned char)p[1] << 16) |
+    ((unsigned char)p[2] << 8) | (unsigned char)p[3];
+}
+
+// Accept one connection and collect its frames until it closes
+void ReceiveTCP(boost::asio::io_service* io_service, tcp::acceptor* acceptor,
+    std::vector<std::string>* frames)
+{
+  tcp::socket socket(*io_service);
+  acceptor->accept(socket);
+  boost::system::error_code error;
+  while (true) {
+    char prefix[4];
+    boost::asio::read(socket, boost::asio::buffer(prefix), error);
+    if (error) break;
+    std::vector<char> buf(ReadInt32(prefix));
+    boost::asio::read(socket, boost::asio::buffer(buf), error);
+    if (error) break;
+    frames->push_back(std::string(buf.begin(), buf.end()));
+  }
+}
+
+// Collect the datagrams, unwrapping and acknowledging reliable messages,
+// until "/stop" arrives
+void ReceiveUDP(udp::socket* socket, std::vector<std::string>* datagrams)
+{
+  am::ReliableReceiver receiver;
+  std::vector<char> buf(65536);
+  char ack[am::RELIABLE_ACK_SIZE];
+  while (true) {
+    udp::endpoint sender;
+    boost::system::error_code error;
+    std::size_t size = socket->receive_from(boost::asio::buffer(buf), sender,
+        0, error);
+    if (error || (size == 8 && strcmp(&buf[0], "/stop") == 0)) break;
+    const char* packet = &buf[0];
+    std::size_t packet_size = size;
+    am::ReliableReceiver::Result result = receiver.Receive(&buf[0], size,
+        &packet, &packet_size, ack);
+    if (result == am::ReliableReceiver::NEW_MESSAGE ||
+        result == am::ReliableReceiver::DUPLICATE) {
+      socket->send_to(boost::asio::buffer(ack), sender, 0, error);
+    }
+    if (result == am::ReliableReceiver::NOT_RELIABLE ||
+        result == am::ReliableReceiver::NEW_MESSAGE) {
+      datagrams->push_back(std::string(packet, packet_size));
+    }
+  }
+}
+
+std::string Bytes(const char* data, std::size_t size)
+{
+  return std::string(data, size);
+}
+
+bool Expect(const char* name, bool result, bool expected)
+{
+  if (result == expected) return true;
+  printf("%s returned %s\n", name, result ? "true" : "false");
+  return false;
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  tcp::acceptor acceptor(io_service, tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort));
+  udp::socket socket(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort + 1));
+  std::vector<std::string> frames;
+  std::vector<std::string> datagrams;
+  boost::thread tcp_receiver(boost::bind(&ReceiveTCP, &io_service, &acceptor,
+        &frames));
+  boost::thread udp_receiver(boost::bind(&ReceiveUDP, &socket, &datagrams));
+
+  tnyosc::Message message("/packet/message");
+  message.append(42);
+  message.append(0.5f);
+  message.append("text");
+  tnyosc::MessageBuilder builder("/packet/builder");
+  builder.append(7);
+  tnyosc::Bundle bundle;
+  bundle.append(message);
+  bundle.append(builder);
+  // Above the copy threshold, so Blob packets are sent from this memory
+  std::vector<char> payload(1000, 'p');
+  tnyosc::Message large("/packet/large");
+  large.append_blob(&payload[0], payload.size());
+  const char* invalid[] = { "/abc", "abc\0", "" };
+  const std::size_t invalid_size[] = { 3, 4, 0 };
+
+  std::vector<std::string> sent_tcp;
+  std::vector<std::string> sent_udp;
+  bool ok = true;
+  {
+    am::AssetManagerClient am("/unused", "127.0.0.1", kPort, kPort + 1);
+
+    ok &= Expect("SendPacketTCP",
+        am.SendPacketTCP(message.data(), message.size()), true);
+    ok &= Expect("SendPacketUDP",
+        am.SendPacketUDP(message.data(), message.size()), true);
+    ok &= Expect("SendPacketReliableUDP",
+        am.SendPacketReliableUDP(bundle.data(), bundle.size()), true);
+    ok &= Expect("SendPacketTCP(Blob)",
+        am.SendPacketTCP(am::Blob(large.data(), large.size())), true);
+    ok &= Expect("SendPacketUDP(Blob)",
+        am.SendPacketUDP(am::Blob(large.data(), large.size())), true);
+    ok &= Expect("SendMessageTCP", am.SendMessageTCP(message), true);
+    ok &= Expect("SendMessageUDP", am.SendMessageUDP(message), true);
+    ok &= Expect("SendMessageTCP(builder)", am.SendMessageTCP(builder), true);
+    ok &= Expect("SendMessageUDP(builder)", am.SendMessageUDP(builder), true);
+    ok &= Expect("SendBundleTCP", am.SendBundleTCP(bundle), true);
+    ok &= Expect("SendBundleUDP", am.SendBundleUDP(bundle), true);
+    std::string m = Bytes(message.data(), message.size());
+    std::string b = Bytes(builder.data(), builder.size());
+    std::string n = Bytes(bundle.data(), bundle.size());
+    std::string l = Bytes(large.data(), large.size());
+    const std::string tcp[] = { m, l, m, b, n };
+    const std::string udp[] = { m, n, l, m, b, n };
+    sent_tcp.assign(tcp, tcp + 5);
+    sent_udp.assign(udp, udp + 6);
+
+#if __cplusplus >= 201103L
+    ok &= Expect("SendPacketTCP(&&)",
+        am.SendPacketTCP(std::vector<char>(large.data(),
+            large.data() + large.size())), true);
+    ok &= Expect("SendPacketUDP(&&)",
+        am.SendPacketUDP(std::vector<char>(message.data(),
+            message.data() + message.size())), true);
+    tnyosc::Bundle moved_tcp(bundle);
+    tnyosc::Bundle moved_udp(bundle);
+    ok &= Expect("SendBundleTCP(&&)",
+        am.SendBundleTCP(std::move(moved_tcp)), true);
+    ok &= Expect("SendBundleUDP(&&)",
+        am.SendBundleUDP(std::move(moved_udp)), true);
+    sent_tcp.push_back(l);
+    sent_tcp.push_back(n);
+    sent_udp.push_back(m);
+    sent_udp.push_back(n);
+#endif
+
+    // Not padded, not an address or a bundle, and empty
+    for (int i = 0; i < 3; ++i) {
+      ok &= Expect("SendPacketTCP(invalid)",
+          am.SendPacketTCP(invalid[i], invalid_size[i]), false);
+      ok &= Expect("SendPacketUDP(invalid)",
+          am.SendPacketUDP(invalid[i], invalid_size[i]), false);
+      ok &= Expect("SendPacketReliableUDP(invalid)",
+          am.SendPacketReliableUDP(invalid[i], invalid_size[i]), false);
+      ok &= Expect("SendPacketTCP(invalid Blob)",
+          am.SendPacketTCP(am::Blob(invalid[i], invalid_size[i])), false);
+    }
+    am.BlockUntilQueuesAreEmpty();
+  }
+  tcp_receiver.join();
+  udp::socket stop(io_service, udp::v4());
+  stop.send_to(boost::asio::buffer("/stop\0\0", 8), socket.local_endpoint());
+  udp_receiver.join();
+
+  // TCP keeps the order; the reliable message may overtake on UDP
+  printf("TCP: %d of %d frames, UDP: %d of %d datagrams\n",
+      (int)frames.size(), (int)sent_tcp.size(), (int)datagrams.size(),
+      (int)sent_udp.size());
+  if (frames != sent_tcp) {
+    printf("the TCP frames differ from the packets sent\n");
+    ok = false;
+  }
+  std::sort(datagrams.begin(), datagrams.end());
+  std::sort(sent_udp.begin(), sent_udp.end());
+  if (datagrams != sent_udp) {
+    printf("the UDP datagrams differ from the packets sent\n");
+    ok = false;
+  }
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
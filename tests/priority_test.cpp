@@ -0,0 +1,121 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Priority lanes: a panic mute sent behind a large backlog of bulk TCP
+// messages must reach the server long before the backlog is drained, and the
+// bulk messages must still arrive in the order they were sent.
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const unsigned short kPort = 15120;
+const int kMessages = 20000;
+const std::size_t kPayload = 1024;
+
+using boost::asio::ip::tcp;
+
+struct Arrivals {
+  Arrivals() : mute_after(-1), bulk(0), in_order(true) {}
+  int mute_after;   // bulk messages received before the mute
+  int bulk;
+  bool in_order;
+};
+
+int ReadInt32(const char* p)
+{
+  return ((unsigned char)p[0] << 24) | ((unsigned char)p[1] << 16) |
+    ((unsigned char)p[2] << 8) | (unsigned char)p[3];
+}
+
+// Accept one connection, leave it unread for a while so that the client
+// builds up a backlog, then read every frame until the connection closes
+void Receive(boost::asio::io_service* io_service, tcp::acceptor* acceptor,
+    Arrivals* arrivals)
+{
+  tcp::socket socket(*io_service);
+  acceptor->accept(socket);
+  boost::this_thread::sleep(boost::posix_time::milliseconds(300));
+
+  std::vector<char> buf;
+  boost::system::error_code error;
+  while (true) {
+    char prefix[4];
+    boost::asio::read(socket, boost::asio::buffer(prefix), error);
+    if (error) break;
+    buf.resize(ReadInt32(prefix));
+    boost::asio::read(socket, boost::asio::buffer(buf), error);
+    if (error) break;
+
+    if (strcmp(&buf[0], "/AM/Mute") == 0) {
+      arrivals->mute_after = arrivals->bulk;
+    } else if (strcmp(&buf[0], "/priority/bulk") == 0) {
+      // "/priority/bulk" ",ib" <index> <blob>
+      if (ReadInt32(&buf[20]) != arrivals->bulk) arrivals->in_order = false;
+      arrivals->bulk++;
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  tcp::acceptor acceptor(io_service, tcp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort));
+  Arrivals arrivals;
+  boost::thread receiver(boost::bind(&Receive, &io_service, &acceptor,
+        &arrivals));
+
+  {
+    am::AssetManagerClient am("/priority", "127.0.0.1", kPort, kPort + 1);
+    std::vector<char> payload(kPayload, 'x');
+    am::Blob blob(&payload[0], payload.size());
+    for (int i = 0; i < kMessages; ++i) {
+      am.SendCustomTCP("/bulk", "ib", i, &blob);
+    }
+    am.SetSystemMute(true);
+    am.BlockUntilQueuesAreEmpty();
+
+    for (int p = am::PRIORITY_URGENT; p < am::PRIORITY_COUNT; ++p) {
+      am::AssetManagerClient::QueueStatistics stats =
+        am.GetQueueStatistics((am::Priority)p);
+      printf("%s: sent %u, peak queued %u\n",
+          p == am::PRIORITY_URGENT ? "urgent" : "bulk",
+          (unsigned)stats.tcp_sent, (unsigned)stats.tcp_peak_queued);
+    }
+  }
+  receiver.join();
+
+  printf("bulk received %d, mute after %d\n", arrivals.bulk,
+      arrivals.mute_after);
+  bool ok = arrivals.bulk == kMessages && arrivals.in_order &&
+    0 <= arrivals.mute_after && arrivals.mute_after < kMessages / 2;
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
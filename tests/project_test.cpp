@@ -0,0 +1,110 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Projects sharing a client: the UDP messages of two projects sent between
+// StartBundle and EndBundle must leave in a single datagram.
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const unsigned short kPort = 15170;
+const int kObjects = 4;
+
+using boost::asio::ip::udp;
+
+// Collect the datagrams that arrive until the socket stays quiet
+std::vector<std::string> Receive(udp::socket& socket)
+{
+  using namespace boost::posix_time;
+  std::vector<std::string> datagrams;
+  ptime deadline = microsec_clock::universal_time() + milliseconds(500);
+  char buf[65536];
+  while (microsec_clock::universal_time() < deadline) {
+    if (!socket.available()) {
+      boost::this_thread::sleep(milliseconds(10));
+      continue;
+    }
+    std::size_t size = socket.receive(boost::asio::buffer(buf));
+    datagrams.push_back(std::string(buf, size));
+  }
+  return datagrams;
+}
+
+bool Contains(const std::string& datagram, const char* address)
+{
+  // OSC strings are null terminated, so a prefix of a longer address does not
+  // match
+  std::string pattern(address, strlen(address) + 1);
+  return std::search(datagram.begin(), datagram.end(), pattern.begin(),
+      pattern.end()) != datagram.end();
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  udp::socket socket(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort + 1));
+
+  int ids[kObjects];
+  float x[kObjects], y[kObjects], z[kObjects];
+  for (int i = 0; i < kObjects; ++i) {
+    ids[i] = i + 1;
+    x[i] = y[i] = z[i] = static_cast<float>(i);
+  }
+
+  am::AssetManagerClient am("/hall", "127.0.0.1", kPort, kPort + 1);
+  am::Project foyer = am.OpenProject("/foyer");
+
+  am.StartBundle();
+  am.SendCustomUDP("/fader", "f", 0.5f);
+  foyer.SendCustomUDP("/fader", "f", 0.25f);
+  am.SendObjectsUDP("/object", ids, x, y, z, kObjects);
+  foyer.SendObjectsUDP("/object", ids, x, y, z, kObjects);
+  am.EndBundle();
+  am.BlockUntilQueuesAreEmpty();
+
+  std::vector<std::string> datagrams = Receive(socket);
+  bool ok = datagrams.size() == 1;
+  const char* addresses[] = { "/hall/fader", "/foyer/fader",
+    "/hall/object/1/pos", "/foyer/object/4/pos" };
+  for (std::size_t i = 0; ok && i < sizeof(addresses) / sizeof(*addresses);
+      ++i) {
+    if (!Contains(datagrams[0], addresses[i])) {
+      printf("%s missing from the bundle\n", addresses[i]);
+      ok = false;
+    }
+  }
+
+  printf("received %d datagrams for two projects\n",
+      static_cast<int>(datagrams.size()));
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
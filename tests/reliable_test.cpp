@@ -0,0 +1,122 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Reliable UDP over a lossy link: a stand-in receiver drops datagrams and
+// acknowledgements at random and every message must still be delivered
+// exactly once.
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+#include "reliable_udp.hpp"
+
+namespace {
+
+const unsigned short kPort = 15113;
+const int kMessages = 200;
+const double kLoss = 0.15;
+
+using boost::asio::ip::udp;
+
+bool Lost()
+{
+  return rand() < kLoss * RAND_MAX;
+}
+
+// Receive until "/stop" arrives, counting the deliveries of each message
+void Receive(udp::socket* socket, std::vector<int>* delivered)
+{
+  am::ReliableReceiver receiver;
+  char buf[1500];
+  char ack[am::RELIABLE_ACK_SIZE];
+  srand(1);
+  while (true) {
+    udp::endpoint sender;
+    boost::system::error_code error;
+    std::size_t size = socket->receive_from(boost::asio::buffer(buf), sender,
+        0, error);
+    if (error || (size == 8 && strcmp(buf, "/stop") == 0)) break;
+    if (Lost()) continue;
+
+    const char* packet;
+    std::size_t packet_size;
+    am::ReliableReceiver::Result result = receiver.Receive(buf, size, &packet,
+        &packet_size, ack);
+    if (result == am::ReliableReceiver::NEW_MESSAGE) {
+      // "/reliable/test" ",i" <index>
+      int index = -1;
+      if (packet_size == 24 && strcmp(packet, "/reliable/test") == 0) {
+        index = ((unsigned char)packet[20] << 24) |
+          ((unsigned char)packet[21] << 16) |
+          ((unsigned char)packet[22] << 8) | (unsigned char)packet[23];
+      }
+      if (0 <= index && index < kMessages) (*delivered)[index]++;
+    }
+    if (result != am::ReliableReceiver::NOT_RELIABLE &&
+        result != am::ReliableReceiver::INVALID && !Lost()) {
+      socket->send_to(boost::asio::buffer(ack), sender, 0, error);
+    }
+  }
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  udp::socket socket(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort));
+  std::vector<int> delivered(kMessages, 0);
+  boost::thread receiver(boost::bind(&Receive, &socket, &delivered));
+
+  {
+    am::AssetManagerClient am("/reliable", "127.0.0.1", 15112, kPort);
+    for (int i = 0; i < kMessages; ++i) {
+      am.SendCustomReliableUDP("/test", "i", i);
+    }
+    am.BlockUntilQueuesAreEmpty();
+
+    am::AssetManagerClient::DestinationStatistics stats =
+      am.GetDestinationStatistics()[0];
+    printf("sent %u, acked %u, retransmissions %u, failed %u\n",
+        (unsigned)stats.reliable_sent, (unsigned)stats.reliable_acked,
+        (unsigned)stats.retransmissions, (unsigned)stats.reliable_failed);
+  }
+
+  udp::socket stop(io_service, udp::v4());
+  stop.send_to(boost::asio::buffer("/stop\0\0", 8), socket.local_endpoint());
+  receiver.join();
+
+  int failures = 0;
+  for (int i = 0; i < kMessages; ++i) {
+    if (delivered[i] != 1) {
+      printf("message %d delivered %d times\n", i, delivered[i]);
+      failures++;
+    }
+  }
+  printf("%s\n", failures ? "FAILED" : "OK");
+  return failures ? 1 : 0;
+}
@@ -0,0 +1,168 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// SceneState dirty tracking: only changed parameters are sent, MarkAllDirty
+// covers exactly the objects that exist, the refresh resends every object
+// once per period, and messages dropped by the memory limit are sent again.
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <string>
+
+#include <boost/asio.hpp>
+#include <boost/date_time/posix_time/posix_time_types.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const unsigned short kPort = 15174;
+// More than one 32-bit word of dirty bits, the last one partly used
+const int kObjects = 40;
+
+using boost::asio::ip::udp;
+
+int ReadInt32(const char* p)
+{
+  return ((unsigned char)p[0] << 24) | ((unsigned char)p[1] << 16) |
+    ((unsigned char)p[2] << 8) | (unsigned char)p[3];
+}
+
+// Count the messages received until the socket stays quiet, by address
+std::map<std::string, int> Receive(udp::socket& socket)
+{
+  using namespace boost::posix_time;
+  std::map<std::string, int> received;
+  ptime deadline = microsec_clock::universal_time() + milliseconds(200);
+  char buf[65536];
+  while (microsec_clock::universal_time() < deadline) {
+    if (!socket.available()) {
+      boost::this_thread::sleep(milliseconds(10));
+      continue;
+    }
+    std::size_t size = socket.receive(boost::asio::buffer(buf));
+    if (size >= 16 && strcmp(buf, "#bundle") == 0) {
+      for (std::size_t i = 16; i + 4 <= size; i += 4 + ReadInt32(buf + i)) {
+        received[buf + i + 4]++;
+      }
+    } else if (size > 0) {
+      received[buf]++;
+    }
+  }
+  return received;
+}
+
+int Total(const std::map<std::string, int>& received)
+{
+  int total = 0;
+  std::map<std::string, int>::const_iterator it;
+  for (it = received.begin(); it != received.end(); ++it) total += it->second;
+  return total;
+}
+
+bool Check(const char* name, bool ok)
+{
+  printf("%-28s %s\n", name, ok ? "OK" : "FAILED");
+  return ok;
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  udp::socket socket(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort + 1));
+  bool ok = true;
+
+  am::AssetManagerClient am("/hall", "127.0.0.1", kPort, kPort + 1);
+  am::SceneState scene(am.OpenProject("/hall"), "/object");
+  for (int i = 0; i < kObjects; ++i) scene.AddObject(100 + i);
+
+  // New objects send every parameter once
+  std::size_t sent = scene.Flush();
+  am.BlockUntilQueuesAreEmpty();
+  std::map<std::string, int> received = Receive(socket);
+  ok &= Check("new objects", sent == 3 * kObjects &&
+      Total(received) == 3 * kObjects &&
+      received["/hall/object/139/mute"] == 1);
+
+  // Writing the current values sends nothing
+  for (int i = 0; i < kObjects; ++i) {
+    scene.SetPosition(i, 0.0f, 0.0f, 0.0f);
+    scene.SetGain(i, 1.0f);
+    scene.SetMute(i, false);
+  }
+  sent = scene.Flush();
+  am.BlockUntilQueuesAreEmpty();
+  ok &= Check("unchanged writes", sent == 0 && Total(Receive(socket)) == 0);
+
+  // Only the changed parameter of the changed objects is sent
+  scene.SetPosition(3, 1.0f, 2.0f, 3.0f);
+  scene.SetGain(35, 0.5f);
+  sent = scene.Flush();
+  am.BlockUntilQueuesAreEmpty();
+  received = Receive(socket);
+  ok &= Check("changed parameters", sent == 2 && Total(received) == 2 &&
+      received["/hall/object/103/pos"] == 1 &&
+      received["/hall/object/135/gain"] == 1);
+
+  // No bits are set past the last object
+  scene.MarkAllDirty();
+  sent = scene.Flush();
+  am.BlockUntilQueuesAreEmpty();
+  ok &= Check("mark all dirty", sent == 3 * kObjects &&
+      Total(Receive(socket)) == 3 * kObjects);
+
+  // A refresh period of 4 resends a quarter of the objects per flush and
+  // every object once over the period
+  scene.SetRefreshPeriod(4);
+  bool slices = true;
+  for (int i = 0; i < 4; ++i) slices &= scene.Flush() == 3 * kObjects / 4;
+  am.BlockUntilQueuesAreEmpty();
+  received = Receive(socket);
+  bool once = Total(received) == 3 * kObjects;
+  for (int i = 0; i < kObjects; ++i) {
+    char address[32];
+    sprintf(address, "/hall/object/%d/pos", 100 + i);
+    once &= received[address] == 1;
+  }
+  ok &= Check("refresh slices", slices && once);
+  scene.SetRefreshPeriod(0);
+
+  {
+    // A new client has no memory reserved yet, so with a limit every message
+    // is dropped and stays dirty until the limit is lifted
+    am::AssetManagerClient limited("/foyer", "127.0.0.1", kPort, kPort + 1);
+    limited.SetMemoryLimit(1);
+    am::SceneState dropped(limited.OpenProject("/foyer"), "/object");
+    for (int i = 0; i < kObjects; ++i) dropped.AddObject(100 + i);
+    std::size_t sent_limited = dropped.Flush();
+    limited.SetMemoryLimit(0);
+    sent = dropped.Flush();
+    limited.BlockUntilQueuesAreEmpty();
+    ok &= Check("dropped messages", sent_limited == 0 &&
+        sent == 3 * kObjects && Total(Receive(socket)) == 3 * kObjects &&
+        dropped.Flush() == 0);
+  }
+
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
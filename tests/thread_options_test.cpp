@@ -0,0 +1,175 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Thread options: ConfigureThread must apply the name and CPU affinity and
+// keep the scheduling a thread inherited when no policy is requested, and
+// the options passed to the client must reach its I/O threads.
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <string>
+
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+#include "thread_config.hpp"
+
+#if defined(__linux__)
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#endif
+
+#if defined(__linux__)
+namespace {
+
+const unsigned short kPort = 15186;
+
+// Highest CPU the process may run on, which differs from the default
+// affinity whenever there is more than one
+int LastCpu()
+{
+  cpu_set_t cpus;
+  sched_getaffinity(0, sizeof(cpus), &cpus);
+  int last = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+    if (CPU_ISSET(cpu, &cpus)) last = cpu;
+  }
+  return last;
+}
+
+bool OnlyCpu(const cpu_set_t& cpus, int cpu)
+{
+  return CPU_COUNT(&cpus) == 1 && CPU_ISSET(cpu, &cpus);
+}
+
+struct Configured {
+  std::string name;
+  bool pinned;
+  int policy;
+};
+
+// Start from SCHED_BATCH, which needs no privileges, and configure the
+// thread with @a options
+void Configure(am::ThreadOptions options, int cpu, Configured* result)
+{
+  struct sched_param param;
+  memset(&param, 0, sizeof(param));
+  pthread_setschedparam(pthread_self(), SCHED_BATCH, &param);
+
+  am::ConfigureThread(options, "am_default");
+
+  char name[16];
+  pthread_getname_np(pthread_self(), name, sizeof(name));
+  result->name = name;
+  cpu_set_t cpus;
+  pthread_getaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+  result->pinned = OnlyCpu(cpus, cpu);
+  pthread_getschedparam(pthread_self(), &result->policy, &param);
+}
+
+// Find the thread of this process named @a name and read its affinity
+bool FindThread(const char* name, int cpu, bool* pinned)
+{
+  DIR* dir = opendir("/proc/self/task");
+  if (!dir) return false;
+  bool found = false;
+  while (struct dirent* entry = readdir(dir)) {
+    if (entry->d_name[0] == '.') continue;
+    std::string comm;
+    std::ifstream file((std::string("/proc/self/task/") + entry->d_name +
+          "/comm").c_str());
+    std::getline(file, comm);
+    if (comm != name) continue;
+    cpu_set_t cpus;
+    sched_getaffinity(atoi(entry->d_name), sizeof(cpus), &cpus);
+    *pinned = OnlyCpu(cpus, cpu);
+    found = true;
+  }
+  closedir(dir);
+  return found;
+}
+
+bool Check(const char* name, bool ok)
+{
+  printf("%-34s %s\n", name, ok ? "OK" : "FAILED");
+  return ok;
+}
+
+} // namespace
+
+int main()
+{
+  bool ok = true;
+  int cpu = LastCpu();
+
+  am::ThreadOptions options;
+  options.name = "am_options_test";
+  options.cpu = cpu;
+  Configured configured;
+  boost::thread(boost::bind(&Configure, options, cpu, &configured)).join();
+  ok &= Check("name and affinity", configured.name == "am_options_test" &&
+      configured.pinned);
+  ok &= Check("inherited scheduling kept", configured.policy == SCHED_BATCH);
+
+  // Names are cut to the 15 characters Linux allows; the default applies
+  // without a name
+  options.name = "am_a_much_longer_name";
+  boost::thread(boost::bind(&Configure, options, cpu, &configured)).join();
+  ok &= Check("long name cut", configured.name == "am_a_much_longe");
+  options.name.clear();
+  boost::thread(boost::bind(&Configure, options, cpu, &configured)).join();
+  ok &= Check("default name", configured.name == "am_default");
+
+  {
+    am::AssetManagerClient am("/threads", "127.0.0.1", kPort, kPort + 1);
+    am::AssetManagerClient::ThreadOptions tcp_options;
+    tcp_options.name = "am_test_tcp";
+    am.SetTCPThreadOptions(tcp_options);
+    am::AssetManagerClient::ThreadOptions udp_options;
+    udp_options.name = "am_test_udp";
+    udp_options.cpu = cpu;
+    am.SetUDPThreadOptions(udp_options);
+
+    // The options apply from the next event of each thread on
+    am.SendCustomTCP("/test", "i", 1);
+    am.SendCustomUDP("/test", "i", 1);
+    bool tcp_found = false, udp_found = false;
+    bool tcp_pinned = false, udp_pinned = false;
+    for (int i = 0; i < 100 && !(tcp_found && udp_found); ++i) {
+      boost::this_thread::sleep(boost::posix_time::milliseconds(10));
+      tcp_found = FindThread("am_test_tcp", cpu, &tcp_pinned);
+      udp_found = FindThread("am_test_udp", cpu, &udp_pinned);
+    }
+    ok &= Check("SetTCPThreadOptions name", tcp_found);
+    ok &= Check("SetUDPThreadOptions name and cpu", udp_found && udp_pinned);
+  }
+
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
+#else
+int main()
+{
+  printf("thread names and affinity are only checked on Linux\n");
+  return 0;
+}
+#endif
@@ -0,0 +1,159 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+// Traffic logs: packets recorded with TrafficRecorder must read back
+// unchanged with TrafficReader, including blobs and skipped prefixes, and a
+// log left behind by a writer that crashed, with a zeroed tail or cut in the
+// middle of a record, must read up to its last complete record.
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "asset_manager_client.hpp"
+#include "message_buffer.hpp"
+#include "traffic_log.hpp"
+
+namespace {
+
+const char* kLogPath = "traffic_log_test.amlog";
+const char* kCopyPath = "traffic_log_test_copy.amlog";
+const int kPackets = 100;
+
+struct Packet {
+  am::TrafficTransport transport;
+  std::string bytes;
+};
+
+std::string ReadFile(const char* path)
+{
+  std::ifstream in(path, std::ios::binary);
+  return std::string(std::istreambuf_iterator<char>(in),
+      std::istreambuf_iterator<char>());
+}
+
+void WriteFile(const char* path, const std::string& bytes)
+{
+  std::ofstream out(path, std::ios::binary | std::ios::trunc);
+  out.write(bytes.data(), bytes.size());
+}
+
+// Read the log at @a path and compare it with the first packets of @a
+// expected. Returns the number of records read, or -1 on a mismatch.
+int ReadBack(const char* path, const std::vector<Packet>& expected)
+{
+  am::TrafficReader reader;
+  if (!reader.Open(path)) return -1;
+  am::TrafficRecord record;
+  const char* packet;
+  int count = 0;
+  while (reader.Next(&record, &packet)) {
+    if (count == (int)expected.size()) return -1;
+    const Packet& p = expected[count];
+    if (record.transport != p.transport || record.size != p.bytes.size() ||
+        memcmp(packet, p.bytes.data(), record.size) != 0) {
+      printf("%s: record %d differs\n", path, count);
+      return -1;
+    }
+    count++;
+  }
+  return count;
+}
+
+bool Check(const char* what, int read, int expected)
+{
+  printf("%-24s %d of %d records\n", what, read, expected);
+  return read == expected;
+}
+
+} // namespace
+
+int main()
+{
+  am::MessageBufferPool pool(1500);
+  std::vector<char> blob_bytes(600);
+  for (std::size_t i = 0; i < blob_bytes.size(); ++i) {
+    blob_bytes[i] = (char)i;
+  }
+  am::Blob blob(&blob_bytes[0], blob_bytes.size());
+
+  // Packets of every size modulo 4, with and without a blob or a skipped
+  // prefix such as the reliable UDP header
+  std::vector<Packet> packets;
+  am::TrafficRecorder recorder;
+  if (!recorder.Open(kLogPath)) return 1;
+  for (int i = 0; i < kPackets; ++i) {
+    std::string bytes(8 + i, (char)('a' + i % 26));
+    am::MessageBufferPtr msg = pool.Acquire(bytes.data(), bytes.size());
+    Packet packet;
+    packet.transport = (am::TrafficTransport)(am::TRAFFIC_TCP + i % 3);
+    std::size_t skip = packet.transport == am::TRAFFIC_RELIABLE_UDP ? 4 : 0;
+    packet.bytes = bytes.substr(skip);
+    if (i % 10 == 0) {
+      msg->AttachBlob(bytes.size() / 2, am::GetBlobData(blob));
+      packet.bytes.insert(bytes.size() / 2 - skip, &blob_bytes[0],
+          blob_bytes.size());
+    }
+    recorder.Record(packet.transport, *msg, skip);
+    packets.push_back(packet);
+  }
+
+  // A copy taken while the recorder is open ends in the zeroed tail of the
+  // mapping, as after a crash
+  std::string open_log = ReadFile(kLogPath);
+  bool ok = open_log.size() > recorder.size();
+  std::size_t recorded = (std::size_t)recorder.size();
+  recorder.Close();
+  std::string log = ReadFile(kLogPath);
+  ok = ok && log.size() == recorded;
+
+  ok = Check("closed log", ReadBack(kLogPath, packets), kPackets) && ok;
+  WriteFile(kCopyPath, open_log);
+  ok = Check("zeroed tail", ReadBack(kCopyPath, packets), kPackets) && ok;
+
+  // Cut the log in the middle of the last record, then in its header
+  std::size_t last_size = sizeof(am::TrafficRecord) +
+    ((packets.back().bytes.size() + 3) & ~(std::size_t)3);
+  WriteFile(kCopyPath, log.substr(0, log.size() - last_size / 2));
+  ok = Check("cut in a packet", ReadBack(kCopyPath, packets),
+      kPackets - 1) && ok;
+  WriteFile(kCopyPath, log.substr(0, log.size() - last_size + 4));
+  ok = Check("cut in a header", ReadBack(kCopyPath, packets),
+      kPackets - 1) && ok;
+
+  // A record whose transport was not written yet ends the log
+  std::string unfinished = log;
+  unfinished[log.size() - last_size +
+    offsetof(am::TrafficRecord, transport)] = am::TRAFFIC_END;
+  WriteFile(kCopyPath, unfinished);
+  ok = Check("unfinished record", ReadBack(kCopyPath, packets),
+      kPackets - 1) && ok;
+
+  // Not a traffic log
+  WriteFile(kCopyPath, log.substr(0, 4));
+  am::TrafficReader reader;
+  ok = !reader.Open(kCopyPath) && ok;
+
+  remove(kLogPath);
+  remove(kCopyPath);
+  printf("%s\n", ok ? "OK" : "FAILED");
+  return ok ? 0 : 1;
+}
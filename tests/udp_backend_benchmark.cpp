@@ -0,0 +1,171 @@
+// Copyright (C) 2011 by Toshiro Yamada
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in
+// all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+// THE SOFTWARE.
+
+// Benchmark of the UDP send paths: sendmmsg on the I/O thread's reactor,
+// with the I/O thread sleeping or busy-polling between messages, inline
+// sends from the calling thread and, if the library was built with
+// AMCLIENT_IO_URING, io_uring with and without a submission queue polling
+// thread. Messages carry their send time and are received by a local sink,
+// which records the latency. CPU time per message covers the caller and the
+// I/O thread; the sink thread is excluded.
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <pthread.h>
+#include <time.h>
+
+#include <boost/asio.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "asset_manager_client.hpp"
+
+namespace {
+
+const unsigned short kPort = 15130;
+const int kMessages = 100000;
+const int kWarmup = 1000;
+const int kBurst = 16;
+const int kBurstIntervalUs = 200;
+
+using boost::asio::ip::udp;
+
+long long Now(clockid_t clock)
+{
+  struct timespec ts;
+  clock_gettime(clock, &ts);
+  return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+struct Sink {
+  boost::mutex mutex;
+  std::vector<long long> latencies;
+};
+
+// Receive "/bench ,h <send time>" until "/stop" arrives
+void Receive(udp::socket* socket, Sink* sink)
+{
+  char buf[1500];
+  while (true) {
+    std::size_t size = socket->receive(boost::asio::buffer(buf));
+    long long now = Now(CLOCK_MONOTONIC);
+    if (size == 8 && strcmp(buf, "/stop") == 0) break;
+    if (size != 20 || strcmp(buf, "/bench") != 0) continue;
+    long long sent = 0;
+    for (int i = 12; i < 20; ++i) sent = (sent << 8) | (unsigned char)buf[i];
+    boost::lock_guard<boost::mutex> lock(sink->mutex);
+    sink->latencies.push_back(now - sent);
+  }
+}
+
+void SendMessages(am::AssetManagerClient& am, int count)
+{
+  for (int i = 0; i < count; i += kBurst) {
+    for (int j = 0; j < kBurst; ++j) {
+      am.SendCustomUDP("/bench", "h", (int64_t)Now(CLOCK_MONOTONIC));
+    }
+    boost::this_thread::sleep(boost::posix_time::microseconds(
+          kBurstIntervalUs));
+  }
+  am.BlockUntilQueuesAreEmpty();
+  boost::this_thread::sleep(boost::posix_time::milliseconds(50));
+}
+
+void Run(const char* name, int options, Sink& sink, clockid_t sink_clock,
+    int busy_poll_us=0)
+{
+  am::AssetManagerClient am("", "127.0.0.1", kPort - 1, kPort);
+  if (options) am.SetOption((am::AssetManagerClient::Option)options);
+  am::AssetManagerClient::ThreadOptions thread_options;
+  thread_options.busy_poll_us = busy_poll_us;
+  am.SetUDPThreadOptions(thread_options);
+
+  SendMessages(am, kWarmup);
+  {
+    boost::lock_guard<boost::mutex> lock(sink.mutex);
+    sink.latencies.clear();
+  }
+
+  long long cpu = Now(CLOCK_PROCESS_CPUTIME_ID) - Now(sink_clock);
+  SendMessages(am, kMessages);
+  cpu = Now(CLOCK_PROCESS_CPUTIME_ID) - Now(sink_clock) - cpu;
+
+  std::vector<long long> latencies;
+  {
+    boost::lock_guard<boost::mutex> lock(sink.mutex);
+    latencies.swap(sink.latencies);
+  }
+  std::sort(latencies.begin(), latencies.end());
+  std::size_t n = latencies.size();
+  if (n == 0) {
+    printf("%-16s no messages received\n", name);
+    return;
+  }
+  printf("%-16s %8.2f %10.1f %10.1f %10.1f %9zu\n", name,
+      (double)cpu / kMessages / 1000.0, latencies[n / 2] / 1000.0,
+      latencies[n * 99 / 100] / 1000.0, latencies[n - 1] / 1000.0, n);
+}
+
+} // namespace
+
+int main()
+{
+  boost::asio::io_service io_service;
+  udp::socket socket(io_service, udp::endpoint(
+        boost::asio::ip::address::from_string("127.0.0.1"), kPort));
+  socket.set_option(boost::asio::socket_base::receive_buffer_size(1 << 22));
+  Sink sink;
+  boost::thread receiver(boost::bind(&Receive, &socket, &sink));
+  clockid_t sink_clock;
+  pthread_getcpuclockid(receiver.native_handle(), &sink_clock);
+
+  printf("%d messages of 20 bytes in bursts of %d every %d us\n", kMessages,
+      kBurst, kBurstIntervalUs);
+  printf("%-16s %8s %10s %10s %10s %9s\n", "backend", "cpu us", "p50 us",
+      "p99 us", "max us", "received");
+  Run("reactor", 0, sink, sink_clock);
+  Run("inline", am::AssetManagerClient::UDP_INLINE, sink, sink_clock);
+  // A spinning I/O thread needs a core of its own as well
+  if (boost::thread::hardware_concurrency() > 1) {
+    Run("reactor polling", 0, sink, sink_clock, kBurstIntervalUs * 2);
+  } else {
+    printf("%-16s skipped on a single core\n", "reactor polling");
+  }
+#if defined(AM_USE_IO_URING)
+  Run("io_uring", am::AssetManagerClient::UDP_USE_IO_URING, sink,
+      sink_clock);
+  // The polling thread needs a core of its own; sharing one with the
+  // sender only measures the scheduler
+  if (boost::thread::hardware_concurrency() > 1) {
+    Run("io_uring sqpoll", am::AssetManagerClient::UDP_USE_IO_URING |
+        am::AssetManagerClient::IO_URING_SQPOLL, sink, sink_clock);
+  } else {
+    printf("%-16s skipped on a single core\n", "io_uring sqpoll");
+  }
+#endif
+
+  udp::socket stop(io_service, udp::v4());
+  stop.send_to(boost::asio::buffer("/stop\0\0", 8), socket.local_endpoint());
+  receiver.join();
+  return 0;
+}
@@ -48,6 +48,7 @@
 #include <arpa/inet.h> // htonl
 #endif
 #include <cstddef> // size_t
+#include <cstring> // memcpy
 #include <string>
 #include <vector>
 #include <algorithm>
@@ -190,6 +191,18 @@ inline uint64_t get_current_ntp_time()
   return ((tv_ntp << 32) | tv_usecs);
 }
 
+/// Write an NTP timestamp in network byte order, the seconds first.
+///
+/// @param[in] out      8 bytes to write to.
+/// @param[in] ntp_time NTP timestamp.
+inline void write_timetag(char* out, uint64_t ntp_time)
+{
+  int32_t sec = htonl((uint32_t)(ntp_time >> 32));
+  int32_t frac = htonl((uint32_t)ntp_time);
+  memcpy(out, (char*)&sec, 4);
+  memcpy(out + 4, (char*)&frac, 4);
+}
+
 
 /// This class represents an Open Sound Control message. It supports Open Sound
 /// Control 1.0 and 1.1 specifications and extra non-standard arguments listed
@@ -263,11 +276,8 @@ class Message {
   void append_time(uint64_t v) {
     is_cached_ = false;
     types_.push_back('t');
-    uint64_t sec = htonl((uint32_t)(v >> 32));
-    uint64_t frac = htonl((uint32_t)v);
-    uint64_t a = sec << 32 | frac;
     ByteArray b(8);
-    memcpy(&b[0], (char*)&a, 8);
+    write_timetag(&b[0], v);
     data_.insert(data_.end(), b.begin(), b.end()); }
   // appends the current UTP timestamp
   void append_current_time() { append_time(get_current_ntp_time()); }
@@ -398,6 +408,115 @@ class Message {
     return cache_; }
 };
 
+/// This class builds an Open Sound Control message in a single contiguous
+/// buffer. The address, the type tag string and the arguments are laid out
+/// as they are on the wire while arguments are appended, so unlike Message
+/// there is no cache to rebuild and byte_array() costs nothing. The type tag
+/// string grows by 4 bytes every 4 arguments, which moves the arguments
+/// written so far; reserve enough bytes up front to avoid reallocations.
+///
+/// <pre>
+///   tnyosc::MessageBuilder msg("/AM/Volume");
+///   msg.append(-6.0f);
+///   send_to(sockfd, msg.data(), msg.size(), 0);
+/// </pre>
+class MessageBuilder {
+ public:
+  /// Starts a message without arguments.
+  ///
+  /// @param[in] address OSC address; "/tnyosc" if empty.
+  /// @param[in] reserve Bytes to reserve for the whole message.
+  explicit MessageBuilder(const std::string& address="/tnyosc",
+      size_t reserve=64) {
+    data_.reserve(reserve);
+    if (address.empty()) append_padded("/tnyosc", 7);
+    else append_padded(address.data(), address.size());
+    tags_ = data_.size();
+    tags_len_ = 1;
+    append_padded(",", 1); }
+
+  // @{
+  /// @name Functions for adding arguments, as in Message.
+  void append(int32_t v) {
+    add_tag('i');
+    int32_t a = htonl(v);
+    append_bytes(&a, 4); }
+  void append(float v) {
+    add_tag('f');
+    int32_t a = htonf(v);
+    append_bytes(&a, 4); }
+  void append(const std::string& v) {
+    add_tag('s');
+    append_padded(v.data(), v.size()); }
+  void append_cstring(const char* v, size_t len) {
+    if (!v || len == 0) return;
+    add_tag('s');
+    append_padded(v, len); }
+  void append_blob(void* blob, uint32_t size) {
+    add_tag('b');
+    int32_t a = htonl(size);
+    append_bytes(&a, 4);
+    append_bytes(blob, size);
+    data_.resize(data_.size() + (4 - size % 4) % 4, 0); }
+  void append_time(uint64_t v) {
+    add_tag('t');
+    data_.resize(data_.size() + 8);
+    write_timetag(&data_[data_.size() - 8], v); }
+  void append_current_time() { append_time(get_current_ntp_time()); }
+  void append_true() { add_tag('T'); }
+  void append_false() { add_tag('F'); }
+  void append_null() { add_tag('N'); }
+  void append_impulse() { add_tag('I'); }
+  void append(int64_t v) {
+    add_tag('h');
+    int64_t a = htonll(v);
+    append_bytes(&a, 8); }
+  void append(double v) {
+    add_tag('d');
+    int64_t a = htond(v);
+    append_bytes(&a, 8); }
+  void append(char v) {
+    add_tag('c');
+    int32_t a = htonl(v);
+    append_bytes(&a, 4); }
+  void append_midi(uint8_t port, uint8_t status, uint8_t data1,
+      uint8_t data2) {
+    add_tag('m');
+    uint8_t b[4] = { port, status, data1, data2 };
+    append_bytes(b, 4); }
+  // @}
+
+  /// Returns the OSC message as a ByteArray.
+  const ByteArray& byte_array() const { return data_; }
+
+  /// Returns the OSC message as a char pointer.
+  const char* data() const { return get_pointer(data_); }
+
+  /// Returns the size of the OSC message in bytes.
+  size_t size() const { return data_.size(); }
+
+ private:
+  ByteArray data_;
+  size_t tags_;     // offset of the type tag string
+  size_t tags_len_; // length of the type tag string including the ','
+
+  void append_bytes(const void* bytes, size_t len) {
+    data_.insert(data_.end(), (const char*)bytes, (const char*)bytes + len); }
+
+  // Appends @a len characters followed by 1 to 4 null bytes.
+  void append_padded(const char* str, size_t len) {
+    append_bytes(str, len);
+    data_.resize(data_.size() + 4 - len % 4, 0); }
+
+  void add_tag(char tag) {
+    // The tag string needs another 4 bytes once the new tag takes the place
+    // of its last null byte
+    if ((tags_len_ + 1) % 4 == 0) {
+      data_.insert(data_.begin() + tags_ + tags_len_ + 1, 4, '\0');
+    }
+    data_[tags_ + tags_len_++] = tag; }
+};
+
 /// This class represents an Open Sound Control bundle message. A bundle can
 /// contain any number of Message and Bundle.
 class Bundle {
@@ -431,6 +550,8 @@ class Bundle {
   /// changes to the bundle
   void append(const Bundle* bundle) { append_data(bundle->byte_array()); }
   void append(const Message& message) { append_data(message.byte_array()); }
+  void append(const MessageBuilder& message) {
+    append_data(message.byte_array()); }
   void append(const Bundle& bundle) { append_data(bundle.byte_array()); }
 #ifdef TNYOSC_WITH_BOOST
   void append(const Message::Ptr message) { append_data(message->byte_array()); }
@@ -443,12 +564,7 @@ class Bundle {
   /// @param[in] ntp_time NTP Timestamp
   /// @see get_current_ntp_time
   void set_timetag(uint64_t ntp_time) {
-    uint64_t sec = htonl((uint32_t)(ntp_time >> 32));
-    uint64_t frac = htonl((uint32_t)ntp_time);
-    uint64_t a = sec << 32 | frac;
-    ByteArray b(8);
-    memcpy(&b[0], (char*)&a, 8);
-    data_.insert(data_.begin()+8, b.begin(), b.end()); }
+    if (data_.size() >= 16) write_timetag(&data_[8], ntp_time); }
 
   /// Returns a complete byte array of this OSC bundle as a tnyosc::ByteArray
   /// type.
@@ -483,15 +599,115 @@ class Bundle {
   /// Clears the bundle.
   void clear() { data_.clear(); }
 
+  /// Exchanges the byte array of this bundle with @a data, so the bundle can
+  /// be handed over without copying it. The bundle is left holding whatever
+  /// @a data held.
+  void swap(ByteArray& data) { data_.swap(data); }
+
  private:
   ByteArray data_;
 
   void append_data(const ByteArray& data) {
     int32_t a = htonl(data.size());
-    ByteArray b(4 + data.size());
-    memcpy(&b[0], (char*)&a, 4);
-    std::copy(data.begin(), data.end(), b.begin() + 4);
-    data_.insert(data_.end(), b.begin(), b.end()); }
+    data_.insert(data_.end(), (char*)&a, (char*)&a + 4);
+    data_.insert(data_.end(), data.begin(), data.end()); }
+};
+
+/// This class encodes an Open Sound Control bundle straight into a buffer of
+/// fixed capacity supplied by the caller. Elements are copied in place and
+/// the size of a nested bundle is filled in when it is closed, so nothing is
+/// allocated or moved. An element that does not fit is refused and leaves the
+/// buffer unchanged, so the caller can send the bundle and start a new one.
+///
+/// <pre>
+///   char buf[1500];
+///   tnyosc::BundleWriter writer(buf, sizeof(buf));
+///   if (!writer.append(msg)) {
+///     send_to(sockfd, writer.data(), writer.size(), 0);
+///     writer.reset();
+///     writer.append(msg);
+///   }
+/// </pre>
+class BundleWriter {
+ public:
+  /// Maximum number of nested bundles open at once.
+  enum { MAX_DEPTH = 8 };
+
+  /// Starts a bundle in @a buffer.
+  ///
+  /// @param[in] buffer   Memory to encode the bundle into.
+  /// @param[in] capacity Size of @a buffer in bytes.
+  /// @param[in] ntp_time Timestamp of the bundle; 1 means immediately.
+  BundleWriter(char* buffer, size_t capacity, uint64_t ntp_time=1)
+    : buffer_(buffer), capacity_(capacity), size_(0), depth_(0) {
+    reset(ntp_time); }
+
+  /// Discards the contents and starts a new bundle. Returns false if the
+  /// buffer cannot even hold the 16 bytes of the bundle header.
+  bool reset(uint64_t ntp_time=1) {
+    size_ = 0;
+    depth_ = 0;
+    return write_header(ntp_time); }
+
+  // @{
+  /// @name Functions for adding elements. They return false, leaving the
+  /// bundle unchanged, if the element does not fit.
+  bool append(const Message& message) {
+    return append(message.data(), message.size()); }
+  bool append(const MessageBuilder& message) {
+    return append(message.data(), message.size()); }
+  bool append(const Bundle& bundle) {
+    return append(bundle.data(), bundle.size()); }
+  /// Appends an element that is already encoded.
+  bool append(const char* data, size_t size) {
+    if (!data || size == 0 || capacity_ - size_ < 4 + size) return false;
+    int32_t a = htonl(size);
+    memcpy(buffer_ + size_, (char*)&a, 4);
+    memcpy(buffer_ + size_ + 4, data, size);
+    size_ += 4 + size;
+    return true; }
+
+  /// Opens a nested bundle. Following elements go into it until
+  /// end_bundle is called.
+  bool begin_bundle(uint64_t ntp_time=1) {
+    if (depth_ == MAX_DEPTH || capacity_ - size_ < 4 + 16) return false;
+    starts_[depth_++] = size_;
+    size_ += 4;
+    return write_header(ntp_time); }
+
+  /// Closes the innermost nested bundle. Returns false if none is open.
+  bool end_bundle() {
+    if (depth_ == 0) return false;
+    size_t start = starts_[--depth_];
+    int32_t a = htonl(size_ - start - 4);
+    memcpy(buffer_ + start, (char*)&a, 4);
+    return true; }
+  // @}
+
+  /// Returns the encoded bundle. It is complete once every nested bundle is
+  /// closed.
+  const char* data() const { return buffer_; }
+  size_t size() const { return size_; }
+
+  /// Returns true if no element was appended since the last reset.
+  bool empty() const { return size_ <= 16; }
+
+  /// Returns the number of nested bundles open.
+  size_t depth() const { return depth_; }
+
+ private:
+  char* buffer_;
+  size_t capacity_;
+  size_t size_;
+  size_t depth_;
+  size_t starts_[MAX_DEPTH];
+
+  bool write_header(uint64_t ntp_time) {
+    if (capacity_ - size_ < 16) return false;
+    memcpy(buffer_ + size_, "#bundle", 8);
+    write_timetag(buffer_ + size_ + 8, ntp_time);
+    size_ += 16;
+    return true; }
 };
 
 } // namespace tnyosc